@@ -0,0 +1,38 @@
+#version 430
+
+// Cell binning, pass 1: count the particles of every cell
+// The value returned by the atomic is the rank of the particle inside its cell, kept for the scatter pass
+
+layout(local_size_x = 256) in;
+
+struct Particle {
+    vec2 position;
+    vec2 velocity;
+};
+
+layout(std430, binding = 0) restrict readonly buffer Particles {
+    Particle particles[];
+};
+
+// particle count per cell, cleared before this pass
+layout(std430, binding = 2) buffer CellStart {
+    uint cellStart[];
+};
+
+// cell and rank inside the cell, per particle
+layout(std430, binding = 5) restrict writeonly buffer ParticleBins {
+    uvec2 particleBins[];
+};
+
+uniform ivec2 gridSize;
+uniform float invCellSize;
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= particles.length()) return;
+
+    ivec2 cell = clamp(ivec2(particles[index].position * invCellSize), ivec2(0), gridSize - 1);
+    uint cellIndex = uint(cell.y * gridSize.x + cell.x);
+
+    particleBins[index] = uvec2(cellIndex, atomicAdd(cellStart[cellIndex], 1u));
+}
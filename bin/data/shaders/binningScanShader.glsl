@@ -0,0 +1,55 @@
+#version 430
+
+// Cell binning, pass 2: exclusive prefix sum of the cell counts, in place
+// Runs as a single workgroup: every thread sums a contiguous chunk of cells,
+// the chunk totals are scanned in shared memory, then every thread writes the offsets of its chunk
+// cellStart[cellCount] ends up holding the total amount of particles
+
+#define THREADS 256
+
+layout(local_size_x = THREADS) in;
+
+layout(std430, binding = 2) buffer CellStart {
+    uint cellStart[];
+};
+
+uniform uint cellCount;
+
+shared uint chunkSums[THREADS];
+
+void main() {
+    uint thread = gl_LocalInvocationID.x;
+    uint chunkSize = (cellCount + THREADS - 1u) / THREADS;
+    uint begin = min(thread * chunkSize, cellCount);
+    uint end = min(begin + chunkSize, cellCount);
+
+    uint sum = 0u;
+    for (uint c = begin; c < end; c++) {
+        sum += cellStart[c];
+    }
+    chunkSums[thread] = sum;
+
+    memoryBarrierShared();
+    barrier();
+
+    // Hillis-Steele inclusive scan of the chunk totals
+    for (uint offset = 1u; offset < THREADS; offset <<= 1) {
+        uint value = thread >= offset ? chunkSums[thread - offset] : 0u;
+        memoryBarrierShared();
+        barrier();
+        chunkSums[thread] += value;
+        memoryBarrierShared();
+        barrier();
+    }
+
+    uint running = chunkSums[thread] - sum;
+    for (uint c = begin; c < end; c++) {
+        uint count = cellStart[c];
+        cellStart[c] = running;
+        running += count;
+    }
+
+    if (thread == THREADS - 1u) {
+        cellStart[cellCount] = chunkSums[thread];
+    }
+}
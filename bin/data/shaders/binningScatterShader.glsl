@@ -0,0 +1,41 @@
+#version 430
+
+// Cell binning, pass 3: copy the particles sorted by cell, keeping their original index
+
+layout(local_size_x = 256) in;
+
+struct Particle {
+    vec2 position;
+    vec2 velocity;
+};
+
+layout(std430, binding = 0) restrict readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, binding = 2) restrict readonly buffer CellStart {
+    uint cellStart[];
+};
+
+layout(std430, binding = 3) restrict writeonly buffer CellParticles {
+    uint cellParticles[];
+};
+
+layout(std430, binding = 4) restrict writeonly buffer SortedParticles {
+    Particle sortedParticles[];
+};
+
+layout(std430, binding = 5) restrict readonly buffer ParticleBins {
+    uvec2 particleBins[];
+};
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= particles.length()) return;
+
+    uvec2 bin = particleBins[index];
+    uint target = cellStart[bin.x] + bin.y;
+
+    sortedParticles[target] = particles[index];
+    cellParticles[target] = index;
+}
@@ -0,0 +1,51 @@
+#version 430
+
+// Depth field gradient, once per camera frame: central differences of the depth texture (clamped at the borders),
+// stored in an RG texture the force kernel samples once per particle
+// Also flags the TILE x TILE tiles with any gradient around, particles over the other tiles skip the sampling
+// (same values as DepthField on the cpu)
+
+#define TILE 16
+
+layout(local_size_x = TILE, local_size_y = TILE) in;
+
+// camera bytes as uploaded (r8, read back normalized to [0..1])
+layout(binding = 0, r8) uniform restrict readonly image2D depthField;
+
+layout(binding = 1, rg32f) uniform restrict writeonly image2D depthGradient;
+
+// one uint per tile, cleared before the pass, the force kernel reads it at binding 8 too
+layout(std430, binding = 8) restrict writeonly buffer DepthOccupancy {
+    uint occupiedTiles[];
+};
+
+// inverted, white is near
+float depth(ivec2 texel) {
+    return 1.0 - imageLoad(depthField, texel).r;
+}
+
+void main() {
+    ivec2 size = imageSize(depthField);
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (texel.x >= size.x || texel.y >= size.y) return;
+
+    float left = depth(ivec2(max(texel.x - 1, 0), texel.y));
+    float right = depth(ivec2(min(texel.x + 1, size.x - 1), texel.y));
+    float up = depth(ivec2(texel.x, max(texel.y - 1, 0)));
+    float down = depth(ivec2(texel.x, min(texel.y + 1, size.y - 1)));
+
+    vec2 gradient = vec2(right - left, down - up) * 0.5;
+    imageStore(depthGradient, texel, vec4(gradient, 0.0, 0.0));
+
+    if (gradient != vec2(0.0)) {
+        // bilinear samples up to one texel away read this texel too, so the tiles of its neighbours are flagged as well
+        // (the tiles of the four diagonal neighbours cover the whole 3x3)
+        int tilesX = (size.x + TILE - 1) / TILE;
+        ivec2 tileMin = max(texel - 1, ivec2(0)) / TILE;
+        ivec2 tileMax = min(texel + 1, size - 1) / TILE;
+        occupiedTiles[tileMin.y * tilesX + tileMin.x] = 1u;
+        occupiedTiles[tileMin.y * tilesX + tileMax.x] = 1u;
+        occupiedTiles[tileMax.y * tilesX + tileMin.x] = 1u;
+        occupiedTiles[tileMax.y * tilesX + tileMax.x] = 1u;
+    }
+}
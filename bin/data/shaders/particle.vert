@@ -2,10 +2,10 @@
 
 uniform mat4 modelViewProjectionMatrix;
 in vec4 position;
-in float instanceSize; // Attribute 1: particle size
+uniform float particleSize; // same for all the particles
 
 void main() {
     gl_Position = modelViewProjectionMatrix * position;
     // Make particles larger to accommodate the glow effect
-    gl_PointSize = instanceSize * 1.8;
+    gl_PointSize = particleSize * 1.8;
 }
\ No newline at end of file
@@ -2,12 +2,10 @@
 
 layout(local_size_x = 512) in;
 
+// radius and mass are the same for all the particles (particleRadius, particleMass)
 struct Particle {
-    //int index;
     vec2 position;
     vec2 velocity;
-    float radius;
-    float mass;
 };
 
 struct CollisionData {
@@ -18,24 +16,71 @@ struct CollisionData {
     float distance;
     float velocityMagnitude;
     uint valid; // 1 if collision is valid, 0 otherwise
-    uint padding; // for alignment
+    float impactSpeed; // relative speed of the two particles
 };
 
-layout(std430, binding = 0) buffer Particles {
+// output, in the original particle order
+// ping-pong with the buffer the binning passes read, it becomes their input on the next step
+layout(std430, binding = 0) restrict writeonly buffer Particles {
     Particle particles[];
 };
 
+// collision summary bins, same values as SimulationBackend.h
+#define COLLISION_SPEED_BINS 8
+#define COLLISION_SPEED_BASE 8.0
+#define COLLISION_REGIONS 8
+#define COLLISION_SAMPLES_PER_GROUP 4
+
+// collisions over all the particles, counted per workgroup in shared memory and added here once per workgroup (CollisionSummary)
 layout(std430, binding = 1) buffer Collisions {
     uint collisionCount;
     uint maxCollisions;
     uint frameNumber;
-    uint padding;
-    CollisionData collisions[];
+    uint sampleCount;
+    uint speedHistogram[COLLISION_SPEED_BINS];
+    uint regionCounts[COLLISION_REGIONS * COLLISION_REGIONS];
+    CollisionData collisions[]; // the first records of every workgroup
+};
+
+// Cell list, built every step by the binning passes (binningHistogram, binningScan, binningScatter)
+// particles of cell c are sortedParticles[cellStart[c]] .. sortedParticles[cellStart[c + 1] - 1]
+layout(std430, binding = 2) restrict readonly buffer CellStart {
+    uint cellStart[];
+};
+
+// original index of every sorted particle
+layout(std430, binding = 3) restrict readonly buffer CellParticles {
+    uint cellParticles[];
+};
+
+// particles sorted by cell, so the neighbours of a cell are contiguous in memory
+layout(std430, binding = 4) restrict readonly buffer SortedParticles {
+    Particle sortedParticles[];
 };
 
-layout(binding = 0) uniform sampler2D depthField;
+// largest acceleration and speed of the step, for the adaptive timestep
+// (the float bits of positive values sort as uints, so atomicMax works on them)
+layout(std430, binding = 6) buffer StepStats {
+    uint maxAccelerationBits;
+    uint maxVelocityBits;
+};
+
+// pair force divided by r, sampled at evenly spaced r² (PairPotentialTable)
+// every entry holds the value and the slope to the next one
+layout(std430, binding = 7) restrict readonly buffer PairForceTable {
+    vec2 pairForceTable[];
+};
+
+// tiles of the depth field with any gradient, filled with the gradient by depthGradientShader
+#define DEPTH_TILE 16
+layout(std430, binding = 8) restrict readonly buffer DepthOccupancy {
+    uint occupiedTiles[];
+};
+
+layout(binding = 0) uniform sampler2D depthGradient;
 
 uniform float deltaTime;
+uniform float stepScale;   // deltaTime / 0.01, the step the damping and the thermostat limits were tuned for
 uniform vec2 worldSize;
 uniform vec2 videoOffset;
 uniform vec2 videoScale;
@@ -46,96 +91,133 @@ uniform bool applyThermostat;
 uniform float depthFieldScale;
 uniform bool enableCollisionLogging;
 
-// Lennard-Jones parameters
-uniform float ljEpsilon;   // Depth of potential well
-uniform float ljCutoff;    // Cutoff for interaction distance
-uniform float maxForce;    // Max allowable force magnitude     
+// Pair potential
+uniform float cutoff;         // range of the table, no interaction beyond
+uniform float pairTableScale; // table entries per unit of r²
 
-void main() {
-    uint index = gl_GlobalInvocationID.x;
-    if (index >= particles.length()) return;
-
-    Particle p = particles[index];
-    vec2 totalLJForce = vec2(0.0);
-
-    // Interaction loop
-    for (uint i = 0; i < particles.length(); i++) {
-        if (i == index) continue;
-
-        Particle other = particles[i];
-        vec2 diff = p.position - other.position;
-        float dist = length(diff);
-        float minDist = p.radius + other.radius; // Minimum interaction distance
-
-        // Check for collision (when particles are very close or overlapping)
-        // Only check collisions for first 512 particles
-        bool isCollision = (dist > 0.0 && dist <= minDist * 1.1); // Allow a small margin for numerical stability
-        bool shouldLogCollision = ( i < 512u); // Only log collisions between first 512 particles
-
-        // Lennard-Jones potential
-        if (dist > 0.0 && dist < ljCutoff) {
-            // Standard LJ
-            float invDist = minDist / dist;
-            float invDist6 = pow(invDist, 6.0);
-            float invDist12 = invDist6 * invDist6;
-            float ljForceMag = 24.0 * ljEpsilon * (2.0 * invDist12 - invDist6) / dist;
-
-            // Optionally clamp
-            ljForceMag = clamp(ljForceMag, -maxForce, maxForce);
-
-            // Direction from other -> p
-            vec2 dir = normalize(diff); // diff = p - other
-            totalLJForce += dir * ljForceMag;
-
-
-            if (enableCollisionLogging && isCollision && shouldLogCollision && index < i) { // Only log once per pair (index < i prevents duplicates)
-                uint currentCollisionIndex = atomicAdd(collisionCount, 1);
-                if (currentCollisionIndex < maxCollisions) {
-                    collisions[currentCollisionIndex].particleA = index;
-                    collisions[currentCollisionIndex].particleB = i;
-                    collisions[currentCollisionIndex].positionA = p.position;
-                    collisions[currentCollisionIndex].positionB = other.position;
-                    collisions[currentCollisionIndex].distance = dist;
-                    collisions[currentCollisionIndex].velocityMagnitude = length(p.velocity);
-                    collisions[currentCollisionIndex].valid = 1;
+// Shared by all the particles
+uniform float particleRadius;
+uniform float particleMass;
+
+// Cell list grid, cells are at least cutoff wide
+uniform ivec2 gridSize;
+uniform float invCellSize;
+
+shared uint groupMaxAccelerationBits;
+shared uint groupMaxVelocityBits;
+
+shared uint groupCollisionCount;
+shared uint groupSpeedHistogram[COLLISION_SPEED_BINS];
+shared uint groupRegionCounts[COLLISION_REGIONS * COLLISION_REGIONS];
+shared uint groupSampleCount;
+shared CollisionData groupSamples[COLLISION_SAMPLES_PER_GROUP];
+
+// impact speed bin k starts at COLLISION_SPEED_BASE * 2^k
+uint collisionSpeedBin(float impactSpeed) {
+    float octave = floor(log2(max(impactSpeed, 1e-6) / COLLISION_SPEED_BASE));
+    return uint(clamp(octave, 0.0, float(COLLISION_SPEED_BINS - 1)));
+}
+
+uint collisionRegion(vec2 position) {
+    ivec2 region = clamp(ivec2(position / worldSize * float(COLLISION_REGIONS)), ivec2(0), ivec2(COLLISION_REGIONS - 1));
+    return uint(region.y * COLLISION_REGIONS + region.x);
+}
+
+void countCollision(uint index, uint other, Particle p, Particle q, float distSq) {
+    atomicAdd(groupCollisionCount, 1u);
+    float impactSpeed = length(p.velocity - q.velocity);
+    atomicAdd(groupSpeedHistogram[collisionSpeedBin(impactSpeed)], 1u);
+    atomicAdd(groupRegionCounts[collisionRegion(0.5 * (p.position + q.position))], 1u);
+
+    uint slot = atomicAdd(groupSampleCount, 1u);
+    if (slot < COLLISION_SAMPLES_PER_GROUP) {
+        groupSamples[slot].particleA = index;
+        groupSamples[slot].particleB = other;
+        groupSamples[slot].positionA = p.position;
+        groupSamples[slot].positionB = q.position;
+        groupSamples[slot].distance = sqrt(distSq);
+        groupSamples[slot].velocityMagnitude = length(p.velocity);
+        groupSamples[slot].valid = 1u;
+        groupSamples[slot].impactSpeed = impactSpeed;
+    }
+}
+
+void updateParticle(uint sortedIndex) {
+    // threads run in cell order, original indices are used for the output and the collision log
+    uint index = cellParticles[sortedIndex];
+    Particle p = sortedParticles[sortedIndex];
+    vec2 totalPairForce = vec2(0.0);
+
+    // Interaction loop, only over the 3x3 cells around the particle
+    ivec2 cell = clamp(ivec2(p.position * invCellSize), ivec2(0), gridSize - 1);
+    ivec2 cellMin = max(cell - 1, ivec2(0));
+    ivec2 cellMax = min(cell + 1, gridSize - 1);
+
+    for (int cy = cellMin.y; cy <= cellMax.y; cy++) {
+        // cells of a row are contiguous, so the 3 cells of the row are a single range
+        uint rowBegin = cellStart[cy * gridSize.x + cellMin.x];
+        uint rowEnd = cellStart[cy * gridSize.x + cellMax.x + 1];
+        for (uint k = rowBegin; k < rowEnd; k++) {
+            if (k == sortedIndex) continue;
+
+            uint i = cellParticles[k];
+            Particle other = sortedParticles[k];
+            vec2 diff = p.position - other.position;
+            float distSq = dot(diff, diff);
+            float minDist = particleRadius + particleRadius; // Minimum interaction distance
+            float collisionDist = minDist * 1.1; // Allow a small margin for numerical stability
+
+            // Check for collision (when particles are very close or overlapping)
+            bool isCollision = (distSq > 0.0 && distSq <= collisionDist * collisionDist);
+
+            if (distSq > 0.0 && distSq < cutoff * cutoff) {
+                // force over r from the table, linear between the two entries around distSq
+                float t = distSq * pairTableScale;
+                vec2 entry = pairForceTable[uint(t)];
+                float forceOverR = entry.x + entry.y * fract(t);
+
+                // diff = p - other, so diff * forceOverR is the force along other -> p
+                totalPairForce += diff * forceOverR;
+
+
+                if (enableCollisionLogging && isCollision && sortedIndex < k) { // Only count once per pair
+                    countCollision(index, i, p, other, distSq);
                 }
             }
         }
     }
 
-    // Apply Lennard-Jones forces to acceleration
-    vec2 acceleration = totalLJForce / p.mass;
+    // Apply pair forces to acceleration
+    vec2 acceleration = totalPairForce / particleMass;
 
     // Add additional forces like depth-based gradient
     vec2 adjustedPos = (p.position - videoOffset) / videoScale;
     vec2 texCoord = adjustedPos / sourceSize;
     texCoord = clamp(texCoord, vec2(0.0), vec2(1.0));
 
-    // Sample depth field
-    float depth = texture(depthField, texCoord).r;
-
-    // Calculate depth gradient
-    vec2 texelSize = 1.0 / sourceSize;
-    float dx = (texture(depthField, clamp(texCoord + vec2(texelSize.x, 0), vec2(0), vec2(1))).r -
-        texture(depthField, clamp(texCoord - vec2(texelSize.x, 0), vec2(0), vec2(1))).r) * 0.5;
-    float dy = (texture(depthField, clamp(texCoord + vec2(0, texelSize.y), vec2(0), vec2(1))).r -
-        texture(depthField, clamp(texCoord - vec2(0, texelSize.y), vec2(0), vec2(1))).r) * 0.5;
-
-    vec2 depthForce = (depthFieldScale * 3.0) * vec2(dx, dy) * videoScale;
+    // Sample the depth gradient (computed once per camera frame by depthGradientShader), only over tiles that have any
+    vec2 depthForce = vec2(0.0);
+    ivec2 depthSize = textureSize(depthGradient, 0);
+    ivec2 depthTexel = min(ivec2(texCoord * vec2(depthSize)), depthSize - 1);
+    ivec2 depthTile = depthTexel / DEPTH_TILE;
+    if (depthFieldScale != 0.0 && occupiedTiles[depthTile.y * ((depthSize.x + DEPTH_TILE - 1) / DEPTH_TILE) + depthTile.x] != 0u) {
+        vec2 gradient = texture(depthGradient, texCoord).rg;
+        depthForce = (depthFieldScale * 3.0) * gradient * videoScale;
+    }
 
     // Combine all forces
-    vec2 totalForce = depthForce + totalLJForce;
-    acceleration += totalForce / p.mass;
+    vec2 totalForce = depthForce + totalPairForce;
+    acceleration += totalForce / particleMass;
 
     // Update velocity with damping
-    p.velocity = p.velocity * 0.99 + acceleration * deltaTime;
+    p.velocity = p.velocity * pow(0.99, stepScale) + acceleration * deltaTime;
 
     // Apply thermostat
     if (applyThermostat) {
-        float kineticEnergy = 0.5 * p.mass * dot(p.velocity, p.velocity);
+        float kineticEnergy = 0.5 * particleMass * dot(p.velocity, p.velocity);
         float currentTemperature = kineticEnergy / 3.0;
         float scaleFactor = sqrt(targetTemperature / (coupling * currentTemperature));
-        scaleFactor = clamp(scaleFactor, 0.95, 1.05);
+        scaleFactor = pow(clamp(scaleFactor, 0.95, 1.05), stepScale);
         p.velocity *= scaleFactor;
     }
 
@@ -158,4 +240,50 @@ void main() {
 
 
     particles[index] = p;
+
+    atomicMax(groupMaxAccelerationBits, floatBitsToUint(length(acceleration)));
+    atomicMax(groupMaxVelocityBits, floatBitsToUint(length(p.velocity)));
+}
+
+void main() {
+    uint local = gl_LocalInvocationIndex;
+    if (local == 0u) {
+        groupMaxAccelerationBits = 0u;
+        groupMaxVelocityBits = 0u;
+        groupCollisionCount = 0u;
+        groupSampleCount = 0u;
+    }
+    if (local < COLLISION_SPEED_BINS) groupSpeedHistogram[local] = 0u;
+    if (local < COLLISION_REGIONS * COLLISION_REGIONS) groupRegionCounts[local] = 0u;
+    barrier();
+
+    uint sortedIndex = gl_GlobalInvocationID.x;
+    if (sortedIndex < sortedParticles.length()) {
+        updateParticle(sortedIndex);
+    }
+
+    // one global atomic per workgroup (and per non empty bin)
+    barrier();
+    if (local == 0u) {
+        atomicMax(maxAccelerationBits, groupMaxAccelerationBits);
+        atomicMax(maxVelocityBits, groupMaxVelocityBits);
+    }
+
+    if (!enableCollisionLogging || groupCollisionCount == 0u) return;
+
+    if (local == 0u) {
+        atomicAdd(collisionCount, groupCollisionCount);
+
+        uint samples = min(groupSampleCount, uint(COLLISION_SAMPLES_PER_GROUP));
+        uint first = atomicAdd(sampleCount, samples);
+        for (uint s = 0u; s < samples && first + s < maxCollisions; s++) {
+            collisions[first + s] = groupSamples[s];
+        }
+    }
+    if (local < COLLISION_SPEED_BINS && groupSpeedHistogram[local] != 0u) {
+        atomicAdd(speedHistogram[local], groupSpeedHistogram[local]);
+    }
+    if (local < COLLISION_REGIONS * COLLISION_REGIONS && groupRegionCounts[local] != 0u) {
+        atomicAdd(regionCounts[local], groupRegionCounts[local]);
+    }
 }
@@ -105,6 +105,11 @@ void AudioApp::update() {
     }
     
     
+    // Take every collision event published since the last update
+    if (collisionEvents != nullptr) {
+        drainCollisionEvents();
+    }
+
     // Process collision data
     if (collisionData != nullptr) {
         if (collisionData->frameNumber > lastProcessedFrame && collisionData->collisionCount > 0) {
@@ -222,30 +227,51 @@ void AudioApp::logClusterDetails(const ClusterAnalysisData& clusterData) {
 /// <summary>
 /// display collision details in the console for debugging; no processing
 /// </summary>
-void AudioApp::logCollisionDetails(const CollisionBuffer& collisionData) {
+void AudioApp::logCollisionDetails(const CollisionSummary& collisionData) {
     if (collisionData.collisionCount == 0) return;
 
-    uint32_t actualCollisions = std::min((int)collisionData.collisionCount, parameters->maxCollisionSampling.get());
-
     ofLogNotice("AudioApp::CollisionData") << "Frame " << collisionData.frameNumber
-        << ": Processing " << actualCollisions << " collisions for audio";
+        << ": " << collisionData.collisionCount << " collisions, " << collisionData.sampleCount << " sampled for audio";
 
-    // Log details for each collision (limit to first 10 to avoid spam)
-    uint32_t logLimit = std::min(actualCollisions, static_cast<uint32_t>(10));
-    for (uint32_t i = 0; i < logLimit; i++) {
-        const CollisionData& collision = collisionData.collisions[i];
-        if (collision.valid) {
-            ofLogNotice("AudioApp::CollisionDetails") << "  Audio Processing Collision " << (i + 1)
-                << ": Particles " << collision.particleA << " & " << collision.particleB
-                << " | Distance: " << std::fixed << std::setprecision(2) << collision.distance
-                << " | Velocity Magnitude: " << std::fixed << std::setprecision(2) << collision.velocityMagnitude
-                << " | Pos A: (" << std::fixed << std::setprecision(1) << collision.positionA.x << ", " << collision.positionA.y << ")"
-                << " | Pos B: (" << std::fixed << std::setprecision(1) << collision.positionB.x << ", " << collision.positionB.y << ")";
+    std::ostringstream histogram;
+    for (uint32_t b = 0; b < COLLISION_SPEED_BINS; b++) {
+        histogram << " " << collisionData.speedHistogram[b];
+    }
+    ofLogNotice("AudioApp::CollisionData") << "  Impact speed histogram:" << histogram.str();
+}
+
+
+/// <summary>
+/// take all the collision events the simulator published since the last update, in the order they happened
+/// (up to maxCollisionSampling of them are used, the rest are only taken out of the ring)
+/// </summary>
+void AudioApp::drainCollisionEvents() {
+    const uint32_t maxEvents = static_cast<uint32_t>(std::max(parameters->maxCollisionSampling.get(), 0));
+    uint32_t eventCount = 0;
+    float totalImpactSpeed = 0.0f;
+
+    CollisionEvent event;
+    while (collisionEvents->pop(event)) {
+        if (eventCount >= maxEvents) continue;
+
+        // Log details for each collision (limit to first 10 to avoid spam)
+        if (DEBUG_LOG && eventCount < 10) {
+            ofLogNotice("AudioApp::CollisionDetails") << "  Audio Processing Collision " << (eventCount + 1)
+                << ": Particles " << event.particleA << " & " << event.particleB
+                << " | Frame: " << event.frameNumber
+                << " | Impact Speed: " << std::fixed << std::setprecision(2) << event.impactSpeed
+                << " | Pos: (" << std::fixed << std::setprecision(2) << event.position.x << ", " << event.position.y << ")";
         }
+
+        totalImpactSpeed += event.impactSpeed;
+        eventCount++;
     }
 
-    if (actualCollisions > 10) {
-        ofLogNotice("AudioApp::CollisionDetails") << "  ... and " << (actualCollisions - 10) << " more collisions being processed for audio";
+    if (eventCount > 0) {
+        parameters->collisionImpactSpeed.set(totalImpactSpeed / static_cast<float>(eventCount));
+    }
+    if (DEBUG_LOG && eventCount > 10) {
+        ofLogNotice("AudioApp::CollisionDetails") << "  ... and " << (eventCount - 10) << " more collision events being processed for audio";
     }
 }
 
@@ -266,11 +292,7 @@ void AudioApp::processClusterStatistics(const ClusterAnalysisData& clusterData)
     float totalVelocityMagnitude = 0;
     glm::vec2 centerOfMass(0.0f);
 
-    //sort clusters by size descending
-    std::vector<ClusterStats>* clustersPtr = const_cast<std::vector<ClusterStats>*>(&clusterData.clusters);
-    std::sort(clustersPtr->begin(), clustersPtr->end(), [](const ClusterStats& a, const ClusterStats& b) {
-        return a.particleCount > b.particleCount;
-        });
+    // the clusters come sorted by size, biggest first
 
     // Calculate aggregate statistics
     for (uint32_t i = 0; i < clusterData.clusterCount; i++) {
@@ -314,7 +336,7 @@ void AudioApp::processClusterStatistics(const ClusterAnalysisData& clusterData)
     parameters->particlesInClusters.set((float)totalParticlesInClusters);
     parameters->avgClusterSize.set(averageClusterSize);
     parameters->avgClusterVelocity.set(totalVelocityMagnitude / static_cast<float>(clusterData.clusterCount));
-    parameters->particlesInClusterRate.set(totalParticlesInClusters / fminf(allParameters->simulationParameters.amount, Simulator::MAX_PARTICLES_FOR_CLUSTER_ANALYSIS));
+    parameters->particlesInClusterRate.set(totalParticlesInClusters / static_cast<float>(std::max(clusterData.particleCount, 1u)));
     parameters->avgClusterSpatialSpread.set(averageSpatialSpread);
     parameters->avgClusterVelocityMagitude.set(averageVelocityMagnitude);
 }
@@ -332,6 +354,7 @@ void AudioApp::cleanClusterStatistics() {
 void AudioApp::cleanCollisionStatistics() {
     parameters->collisionRate.set(0);
     parameters->collisions.set(0);
+    parameters->collisionImpactSpeed.set(0);
 }
 
 
@@ -340,14 +363,15 @@ void AudioApp::cleanCollisionStatistics() {
 /// preparing data for the actual sonification step
 /// </summary>
 /// <param name="collisionData"></param>
-void AudioApp::processCollisionsStatistics(const CollisionBuffer& collisionData) {
+void AudioApp::processCollisionsStatistics(const CollisionSummary& collisionData) {
     //if (collisionData.collisionCount == 0) return;
 
-    int actualEvaluations = std::min((int)allParameters->simulationParameters.amount.get(), parameters->maxCollisionSampling.get());
+    // the counts cover all the particles, not only the sampled records
+    int actualEvaluations = std::max((int)allParameters->simulationParameters.amount.get(), 1);
     int actualCollisions = std::min((int)collisionData.collisionCount, actualEvaluations);
 
     parameters->collisionRate.set(static_cast<float>(actualCollisions) / actualEvaluations);
-    parameters->collisions.set(static_cast<float>(actualCollisions));
+    parameters->collisions.set(static_cast<float>(collisionData.collisionCount));
 }
 
 
@@ -366,7 +390,7 @@ void AudioApp::processCollisionsStatistics(const CollisionBuffer& collisionData)
 /// </summary>
 /// <param name="collisionData"></param>
 /// <param name="clusterData"></param>
-void AudioApp::sonificationControl(const CollisionBuffer& collisionData, const ClusterAnalysisData& clusterData) {
+void AudioApp::sonificationControl(const CollisionSummary& collisionData, const ClusterAnalysisData& clusterData) {
     if (!audioEnabled) return;
 
     // update volumes from the gui (via parameters)
@@ -527,7 +551,7 @@ const int   CLUSTER_VOLUME_MEAN = 200;
 void AudioApp::playClusterSounds() {
     static float clustersToProcess = min(clusterData->clusters.size(), clusterSampler.size());
     for (int i = 0; i < clustersToProcess; ++i) {
-        ClusterStats &cd = clusterData->clusters[i % clusterData->clusters.size()];
+        const ClusterStats &cd = clusterData->clusters[i % clusterData->clusters.size()];
         AudioSampler &cs = clusterSampler[i % clusterSampler.size()];
         
         float reso = 0.6f;
@@ -12,10 +12,10 @@
 
 #include "EsenciaParameters.h"
 #include "GuiApp.h"
+#include "CollisionEvents.h"
 
 // Forward declarations
-struct CollisionData;
-struct CollisionBuffer;
+struct CollisionSummary;
 struct ClusterStats;
 struct ClusterAnalysisData;
 
@@ -28,8 +28,9 @@ public:
     void drawScope(pdsp::Scope &s, int x, int y, int w, int h) const;
 
     // collision processing
-    void logCollisionDetails(const CollisionBuffer& collisionData);
-    void processCollisionsStatistics(const CollisionBuffer& collisionData);
+    void logCollisionDetails(const CollisionSummary& collisionData);
+    void processCollisionsStatistics(const CollisionSummary& collisionData);
+    void drainCollisionEvents();
 
     // cluster analysis
     void logClusterDetails(const ClusterAnalysisData& clusterData);
@@ -40,10 +41,11 @@ public:
     void cleanCollisionStatistics();
 
     // audio processing
-    void sonificationControl(const CollisionBuffer& collisionData, const ClusterAnalysisData& clusterData);
+    void sonificationControl(const CollisionSummary& collisionData, const ClusterAnalysisData& clusterData);
 
-    CollisionBuffer* collisionData = nullptr;
-    ClusterAnalysisData* clusterData = nullptr;
+    const CollisionSummary* collisionData = nullptr;
+    CollisionEventRing* collisionEvents = nullptr; // this is its only reader
+    const ClusterAnalysisData* clusterData = nullptr;
 
     // timming functions for audio triggers
     bool triggerAtInterval(float intervalInSeconds, std::function<void()> callback);
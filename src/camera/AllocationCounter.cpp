@@ -0,0 +1,46 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+// the global operator new and delete of the app: malloc and free, as the default ones, plus a counter per thread
+// (the aligned versions keep the default implementation)
+
+namespace {
+    thread_local uint64_t threadAllocationCount = 0;
+
+    void* allocate(std::size_t size) {
+        threadAllocationCount++;
+        if (size == 0) size = 1;
+        while (true) {
+            if (void* memory = std::malloc(size)) return memory;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocateNothrow(std::size_t size) noexcept {
+        try {
+            return allocate(size);
+        }
+        catch (...) {
+            return nullptr;
+        }
+    }
+}
+
+uint64_t getThreadAllocationCount() {
+    return threadAllocationCount;
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocateNothrow(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocateNothrow(size); }
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
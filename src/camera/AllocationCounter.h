@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+/// <summary>
+/// Heap allocations (operator new) made by the calling thread since it started
+/// Counted by the global operator new of AllocationCounter.cpp; take it before and after a piece of work to get what the work allocated
+/// Memory allocated by the libraries with malloc (opencv images) is not counted
+/// </summary>
+uint64_t getThreadAllocationCount();
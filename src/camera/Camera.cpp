@@ -1,6 +1,11 @@
 #include "Camera.h"
+#include "AllocationCounter.h"
 #include "../ofApp.h"
 
+Camera::~Camera() {
+    stopThread();
+}
+
 /// <summary>
 /// assign params pointer and listeners to value changes
 /// </summary>
@@ -13,6 +18,8 @@ void Camera::setup(CameraParameters* params) {
     blurHorizontal.load("shaders/blur.vert", "shaders/blurHorizontal.frag");
     blurVertical.load("shaders/blur.vert", "shaders/blurVertical.frag");
 
+    ofLogNotice("Camera::setup()") << "Segmentation kernel: " << SegmentationKernel::getName();
+
     // for when the 'bg reference' button is pressed
     parameters->startBackgroundReference.addListener(this, &Camera::onGUIStartBackgroundReference);
 
@@ -38,11 +45,7 @@ void Camera::setup(CameraParameters* params) {
         // show an alert if the depth camera is not connected when starting the app, maybe there is an issue with it
         ofSystemAlertDialog("// esencia //\n\nDepth camera not connected\nUsing video file");
     }
-
-    if (!restoreBackgroundReference(backgroundReference)) {
-        ofLogWarning("Camera::setup()") << "Couldn't load a background reference, attempting to get a new one";
-        startBackgroundReferenceSampling(BG_SAMPLE_FRAMES);
-    }
+    // the background reference was restored (or its sampling started) by changeSource, that also started the camera thread
 }
 
 /// <summary>
@@ -73,9 +76,11 @@ void Camera::onGUIChangeSource(bool& _) {
 /// <summary>
 /// Use this to change the current video source
 /// It handles everything: stops previous source and reset frames sizes
+/// The camera thread is stopped meanwhile, and started again with the new source
 /// </summary>
 /// <param name="newSource">From the list of VideoSources</param>
 void Camera::changeSource(VideoSources newSource) {
+    stopThread();
     stopCurrentSource();
 
     currentVideosource = VideoSources::VIDEOSOURCE_NONE; // in the new setup fail, stay at None
@@ -113,6 +118,8 @@ void Camera::changeSource(VideoSources newSource) {
         ofLogWarning("Camera::changeSource()") << "Couldn't load a background reference, attempting to get a new one";
         startBackgroundReferenceSampling(BG_SAMPLE_FRAMES);
     }
+
+    startThread();
 }
 
 /// <summary>
@@ -138,13 +145,18 @@ void Camera::setFrameSize(int width, int height) {
     fboBlurOnePass.allocate(IMG_WIDTH, IMG_HEIGHT, GL_R8);  // or GL_R8 if you want single channel
     fboBlurTwoPass.allocate(IMG_WIDTH, IMG_HEIGHT, GL_R8);
 
+    // the images of the camera thread never get drawn, without a texture they make no gl calls there
+    for (ofxCvImage* image : std::initializer_list<ofxCvImage*>{ &source, &processedImage, &backgroundNewFrame, &backgroundReference,
+                                                                 &frameSegment, &colorFrame }) {
+        image->setUseTexture(false);
+    }
+
     source.allocate(IMG_WIDTH, IMG_HEIGHT);
     processedImage.allocate(IMG_WIDTH, IMG_HEIGHT);
     backgroundNewFrame.allocate(IMG_WIDTH, IMG_HEIGHT);
     backgroundReference.allocate(IMG_WIDTH, IMG_HEIGHT);
-    maskImage.allocate(IMG_WIDTH, IMG_HEIGHT);
     segment.allocate(IMG_WIDTH, IMG_HEIGHT);
-    fillMaskforHoles.allocate(IMG_WIDTH+2, IMG_HEIGHT+2);
+    frameSegment.allocate(IMG_WIDTH, IMG_HEIGHT);
     colorFrame.allocate(IMG_WIDTH, IMG_HEIGHT);
     
     parameters->previewSource.allocate(IMG_WIDTH, IMG_HEIGHT, OF_IMAGE_GRAYSCALE);
@@ -216,9 +228,10 @@ void Camera::setupWebcam() {
 
 /// <summary>
 /// Class exit.
-/// Calls a funtion to stop the current video source
+/// Stops the camera thread, then calls a funtion to stop the current video source
 /// </summary>
 void Camera::exit() {
+    stopThread();
     stopCurrentSource();
 }
 
@@ -251,18 +264,18 @@ void Camera::draw() {
     }
 
     //prerecordedVideo.draw(1, 1);
-    source.draw(1, 1, drawWidth, drawHeight);
+    parameters->previewSource.draw(1, 1, drawWidth, drawHeight);
     ofDrawBitmapStringHighlight("Raw camera", 11, 20, ofColor(30, 30, 30), ofColor(104, 140, 247));
 
-    backgroundNewFrame.draw(1, drawHeight + 1, drawWidth, drawHeight);
+    parameters->previewBackground.draw(1, drawHeight + 1, drawWidth, drawHeight);
     ofDrawBitmapStringHighlight("Background reference", 11, drawHeight + 20, ofColor(30, 30, 30), ofColor(104, 140, 247));
 
     if (isTakingBackgroundReference) {
-        ofDrawBitmapStringHighlight("registering background reference: -" + ofToString(backgroundReferenceLeftFrames), 10, drawHeight * 1.5, ofColor(230, 30, 40), ofColor(250, 250, 250));
+        ofDrawBitmapStringHighlight("registering background reference: -" + ofToString(backgroundReferenceLeftFrames.load()), 10, drawHeight * 1.5, ofColor(230, 30, 40), ofColor(250, 250, 250));
         return;
     }
     if (parameters->recordTestingVideo) {
-        ofDrawBitmapStringHighlight("recording testing video " + ofToString(recordTestingFramesCounter), 30, drawHeight / 2, ofColor(230, 30, 40), ofColor(250, 250, 250));
+        ofDrawBitmapStringHighlight("recording testing video " + ofToString(recordTestingFramesCounter.load()), 30, drawHeight / 2, ofColor(230, 30, 40), ofColor(250, 250, 250));
         return;
     }
 
@@ -278,7 +291,7 @@ void Camera::draw() {
         ofPushMatrix();
         ofTranslate(1, drawHeight);
         ofScale(0.5);
-        for (const auto& polyline : polygons) {
+        for (const auto& polyline : previewPolygons) {
             polyline.draw();
             ofDrawBox(polyline.getCentroid2D().x, polyline.getCentroid2D().y, 10, 10);
         }
@@ -292,47 +305,211 @@ void Camera::draw() {
 
 
 //--------------------------------------------------------------
+/// <summary>
+/// Main thread side of a frame: hand the settings and the video frames to the camera thread,
+/// then take its newest processed frame, blur it and update the gui previews
+/// </summary>
 void Camera::update() {
+    shareSettings();
 
-    // acquire frame
+    // the video players are tied to the main thread, only their decoded frames go to the camera thread
     if (currentVideosource == VideoSources::VIDEOSOURCE_VIDEOFILE) {
         prerecordedVideo.update();
 
         if (prerecordedVideo.isFrameNew()) {
-            colorFrame.setFromPixels(prerecordedVideo.getPixels());
-            source = colorFrame;
+            VideoFrame& videoFrame = videoFrames.getWriteBuffer();
+            videoFrame.pixels = prerecordedVideo.getPixels();
+            videoFrame.captureTime = ofGetElapsedTimeMicros();
+            videoFrames.publish();
         }
     }
 
-    if (currentVideosource == VideoSources::VIDEOSOURCE_ORBBEC) {
-        orbbecCam.update();
-
-        if (orbbecCam.isFrameNewDepth()) {
-            source.setFromPixels(orbbecCam.getDepthPixels());
-        }
+    // a new background reference, sampled by the camera thread
+    if (backgroundPreviewGeneration != shownBackgroundPreviewGeneration) {
+        std::lock_guard<std::mutex> lock(backgroundPreviewMutex);
+        shownBackgroundPreviewGeneration = backgroundPreviewGeneration;
+        parameters->previewBackground.setFromPixels(backgroundPreview);
     }
 
-    // to-do: make backgroundref an object with state?
-    if (isTakingBackgroundReference) {
-        addSampleToBackgroundReference(source, backgroundReference, BG_SAMPLE_FRAMES);
-        return;
-    }
+    // the app runs faster than the sensor, most updates have no new frame
+    if (!frames.update()) return;
 
-    // all the processing from source to extract the final segment
-    processCameraFrame(source, backgroundReference);
+    const uint64_t allocationsBefore = getThreadAllocationCount();
 
+    CameraFrame& frame = frames.getReadBuffer();
+    segment.setFromPixels(frame.segment);
+    std::swap(previewPolygons, frame.polygons);
+    captureTime = frame.captureTime;
+
+    // add gaussian blur to the silouetes, on the gpu when the camera thread did not blur it on the cpu
+    // (this step was originaly performed by the simulation on the sorounds of each particle, its here now to test if the performance is better)
+    if (frame.blurred) {
+        parameters->blurTime = frame.blurTime;
+    }
+    else {
+        const uint64_t blurStart = ofGetElapsedTimeMicros();
+        gpuBlur(segment, parameters->gaussianBlur);
+        parameters->blurTime = (ofGetElapsedTimeMicros() - blurStart) / 1000.0f;
+    }
 
     // update the preview images on the shared parameters data structure for the GUI
-    parameters->previewSource.setFromPixels(source.getPixels());
+    parameters->previewSource.setFromPixels(frame.source);
     convertToTransparent(segment, parameters->previewSegment); // to-do: should be called only when accessed 
-    // parameters->previewBackground.setFromPixels(backgroundReference.getPixels()); // this does not need to run every update, so its placed when updating backgroundReference data
+    // parameters->previewBackground is updated above, only when the camera thread takes a new background reference
+
+    parameters->frameAllocations = static_cast<float>(frame.allocations + getThreadAllocationCount() - allocationsBefore);
+    parameters->frameGeneration++;
+}
+
+/// <summary>
+/// Main thread: copy the parameters the processing uses for the camera thread
+/// </summary>
+void Camera::shareSettings() {
+    ProcessingSettings current;
+    current.enableClipping = parameters->enableClipping;
+    current.clipFar = parameters->clipFar;
+    current.clipNear = parameters->clipNear;
+    current.floodfillHoles = parameters->floodfillHoles;
+    current.useMask = parameters->useMask;
+    current.showPolygons = parameters->showPolygons;
+    current.blobMinArea = parameters->blobMinArea;
+    current.blobMaxArea = parameters->blobMaxArea;
+    current.nConsidered = parameters->nConsidered;
+    current.fillHolesOnPolygons = parameters->fillHolesOnPolygons;
+    current.polygonTolerance = parameters->polygonTolerance;
+    current.saveDebugImages = parameters->saveDebugImages;
+    current.recordTestingVideo = parameters->recordTestingVideo;
+    current.gaussianBlur = parameters->gaussianBlur;
+    current.useCpuBlur = parameters->useCpuBlur;
+
+    std::lock_guard<std::mutex> lock(settingsMutex);
+    sharedSettings = current;
 }
 
+#pragma region Camera thread
+
+void Camera::startThread() {
+    if (cameraThread.joinable() || currentVideosource == VideoSources::VIDEOSOURCE_NONE) return;
+
+    threadStopping = false;
+    cameraThread = std::thread(&Camera::threadLoop, this);
+    ofLogNotice("Camera::startThread()") << "Camera frames processed on their own thread";
+}
+
+void Camera::stopThread() {
+    if (!cameraThread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        threadStopping = true;
+    }
+    threadWake.notify_one();
+    cameraThread.join();
+}
+
+/// <summary>
+/// Poll the source, and process every new frame into the newest one for the main thread
+/// </summary>
+void Camera::threadLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(threadMutex);
+            threadWake.wait_for(lock, std::chrono::duration<float>(CAPTURE_POLL_INTERVAL), [this] { return threadStopping; });
+            if (threadStopping) return;
+        }
+
+        const uint64_t allocationsBefore = getThreadAllocationCount();
+        if (!acquireFrame()) continue;
+
+        {
+            std::lock_guard<std::mutex> lock(settingsMutex);
+            settings = sharedSettings;
+        }
+
+        const int samples = requestedBackgroundSamples.exchange(0);
+        if (samples > 0) {
+            beginBackgroundReferenceSampling(samples);
+        }
+
+        // to-do: make backgroundref an object with state?
+        if (isTakingBackgroundReference) {
+            addSampleToBackgroundReference(source, backgroundReference, BG_SAMPLE_FRAMES);
+            continue;
+        }
+
+        // all the processing from source to extract the final segment
+        processCameraFrame(source, backgroundReference);
+
+        // a frame the main thread did not take yet is replaced, it only gets the newest
+        CameraFrame& frame = frames.getWriteBuffer();
+        copyToPixels(source, frame.source);
+        copyToPixels(frameSegment, frame.segment);
+
+        // the copy is blurred (not frameSegment), a frame that is published again without processing is not blurred twice
+        frame.blurred = settings.useCpuBlur;
+        if (frame.blurred) {
+            const uint64_t blurStart = ofGetElapsedTimeMicros();
+            cpuBlur.blur(frame.segment.getData(), frame.segment.getWidth(), frame.segment.getHeight(), frame.segment.getWidth(), settings.gaussianBlur);
+            frame.blurTime = (ofGetElapsedTimeMicros() - blurStart) / 1000.0f;
+        }
+
+        // swapped, not copied: the polylines of the frame in the buffer come back to be filled by the next one
+        if (settings.showPolygons) {
+            std::swap(frame.polygons, polygons);
+        }
+        else {
+            frame.polygons.clear();
+        }
+        frame.captureTime = frameCaptureTime;
+        frame.allocations = getThreadAllocationCount() - allocationsBefore;
+        frames.publish();
+    }
+}
+
+/// <summary>
+/// Camera thread: take a new frame from the current source into source
+/// </summary>
+/// <returns>false if the source has no new frame</returns>
+bool Camera::acquireFrame() {
+    if (currentVideosource == VideoSources::VIDEOSOURCE_ORBBEC) {
+        orbbecCam.update();
+
+        if (!orbbecCam.isFrameNewDepth()) return false;
+        frameCaptureTime = ofGetElapsedTimeMicros();
+        source.setFromPixels(orbbecCam.getDepthPixels());
+        return true;
+    }
+
+    if (currentVideosource == VideoSources::VIDEOSOURCE_VIDEOFILE) {
+        if (!videoFrames.update()) return false;
+        const VideoFrame& videoFrame = videoFrames.getReadBuffer();
+        frameCaptureTime = videoFrame.captureTime;
+
+        // straight from the decoded pixels to the gray frame, without the copy into colorFrame
+        if (videoFrame.pixels.getNumChannels() == 3 && videoFrame.pixels.getWidth() == IMG_WIDTH && videoFrame.pixels.getHeight() == IMG_HEIGHT) {
+            const cv::Mat color(IMG_HEIGHT, IMG_WIDTH, CV_8UC3, const_cast<unsigned char*>(videoFrame.pixels.getData()));
+            cv::Mat gray = cv::cvarrToMat(source.getCvImage());
+            cv::cvtColor(color, gray, cv::COLOR_RGB2GRAY);
+            source.flagImageChanged();
+        }
+        else {
+            colorFrame.setFromPixels(videoFrame.pixels);
+            source = colorFrame;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+#pragma endregion
+
 #pragma region Frame processing
 
 
 /// <summary>
 /// Process each camera frame to extract interested objects
+/// Every stage writes into one of the images allocated by setFrameSize, the segment ends in frameSegment
 /// </summary>
 void Camera::processCameraFrame(ofxCvGrayscaleImage &frame, ofxCvGrayscaleImage &backgroundReference) {
     // The processing assumes a depth grayscalled image, a background reference if available
@@ -343,105 +520,127 @@ void Camera::processCameraFrame(ofxCvGrayscaleImage &frame, ofxCvGrayscaleImage
     // 4. (optional) uses the previous all-white image as a mask to extract the actual depth values from the frame
     // 5. (optional) obtains a series of polygons from the images
     // // additional noise reduction
-    // 6. apply gaussian blur to the roi 
+    // 6. apply gaussian blur to the roi (done on the copy for the main thread, see threadLoop and update)
+    //
+    // the stages read the output of the previous one where it is, the frame itself is never changed (the mask needs it)
 
-    processedImage = frame;
-    backgroundNewFrame = backgroundReference;
-    saveDebugImage(processedImage, "cameraFrame", "initial");
-    if (parameters->recordTestingVideo) {
-        recordTestingFrames(processedImage);
+    saveDebugImage(frame, "cameraFrame", "initial");
+    if (settings.recordTestingVideo) {
+        recordTestingFrames(frame);
         return;
     }
 
     // 1. Depth threshold 
     // ---------
-    // remove far and near by thresholding, from the background and from the 
-    if (parameters->enableClipping) {
-        // clipping the camera
-        cvThreshold(processedImage.getCvImage(), processedImage.getCvImage(), parameters->clipFar, 0, CV_THRESH_TOZERO_INV);
-        saveDebugImage(processedImage, "processedImage", "low threshold");
-        // to-do: near detection is needed to stop all the processing/visualization (near clipping is not needed)
-        cvThreshold(processedImage.getCvImage(), processedImage.getCvImage(), parameters->clipNear, 0, CV_THRESH_TOZERO);
-        saveDebugImage(processedImage, "processedImage", "high threshold");
-    }
-
-    // clipping the background reference after subtraction
-    if (parameters->enableClipping) {
-        // to-do: get reference background from the disk if available
-        if (backgroundReferenceTaken) {
-            cvThreshold(backgroundReference.getCvImage(), backgroundNewFrame.getCvImage(), parameters->clipFar, 0, CV_THRESH_TOZERO_INV);
-            cvThreshold(backgroundNewFrame.getCvImage(), backgroundNewFrame.getCvImage(), parameters->clipNear, 0, CV_THRESH_TOZERO);
-            saveDebugImage(backgroundNewFrame, "backgroundNewFrame", "thresholded");
-        }
-    }
-
+    // remove far and near by thresholding, from the background and from the frame
     // 2. Subtract BG from frame
     // ---------
-    // remove the background from the frame (save the output in maskImage object)
-    if (backgroundReferenceTaken) {
-        cvAbsDiff(processedImage.getCvImage(), backgroundNewFrame.getCvImage(), segment.getCvImage()); // this works great for a single background frame of reference!
-
-        saveDebugImage(processedImage, "processedImage", "removed background absdiff");
-    }
-    else {
-        segment = processedImage;
-        // when no background ref taken to be subtracted, just use the frame
-        //processedImage = segment;
-        //maskImage = processedImage;
-        //segment = proce
-    }
-
+    // remove the background from the frame
     // 3. Flat the segment image
     // ---------
     // make it black and white
-    segment.threshold(5);
-    processedImage = segment;
-    saveDebugImage(segment, "segment", "threshold 5");
+    //
+    // all three in a single pass over the frame into frameSegment (SegmentationKernel),
+    // against the background clipped beforehand, only when the reference or the clipping range change
+    const SegmentationKernelParameters segmentation = SegmentationKernel::getParameters(settings.enableClipping, settings.clipNear, settings.clipFar, SEGMENT_THRESHOLD);
+
+    ofxCvGrayscaleImage* background = nullptr;
+    if (backgroundReferenceTaken) {
+        // to-do: get reference background from the disk if available
+        if (settings.enableClipping) {
+            updateClippedBackground(segmentation);
+            background = &backgroundNewFrame;
+        }
+        else {
+            background = &backgroundReference;
+        }
+    }
+
+    segmentFrame(frame, background, segmentation);
+    saveDebugImage(frameSegment, "segment", "threshold");
 
 
     // 4. Remove holes
     // ---------
-    if (parameters->floodfillHoles) {
-        fillMaskforHoles.allocate(IMG_WIDTH + 2, IMG_HEIGHT + 2);
-        fillMaskforHoles.clear();
-        cvFloodFill(processedImage.getCvImage(), cvPoint(0, 0), cvScalar(255), cvScalar(0), cvScalarAll(0), comp CV_DEFAULT(NULL), CV_FLOODFILL_FIXED_RANGE, fillMaskforHoles.getCvImage());
-        processedImage.invert();
+    // the fill changes its image, so it runs on a copy of the segment; the holes are what it did not reach
+    if (settings.floodfillHoles) {
+        cvCopy(frameSegment.getCvImage(), processedImage.getCvImage());
+        cvFloodFill(processedImage.getCvImage(), cvPoint(0, 0), cvScalar(255), cvScalar(0), cvScalarAll(0), NULL, CV_FLOODFILL_FIXED_RANGE, NULL);
+        cvNot(processedImage.getCvImage(), processedImage.getCvImage());
         saveDebugImage(processedImage, "processedImage", "extracted holes");
-        cvOr(segment.getCvImage(), processedImage.getCvImage(), processedImage.getCvImage());
-        saveDebugImage(processedImage, "processedImage", "floodfill");
+        cvOr(frameSegment.getCvImage(), processedImage.getCvImage(), frameSegment.getCvImage());
+        saveDebugImage(frameSegment, "segment", "floodfill");
     }
-    processedImage.erode();
+    cvErode(frameSegment.getCvImage(), processedImage.getCvImage());
 
 
     // 5. Mask image = preserve depth
     // ---------
     //// use the mask against the original frame, to get the original depth values from the roi
-    ////maskImage = segment; // or use a previous state of segment before holes were filled
-    //maskImage = segment;
-    if (parameters->useMask) {
-        maskImage = processedImage;
-        processedImage = source;
-        processedImage *= maskImage;
-        // source *= maskImage;  // this is for masking the original frame against the masked!
-        // processedImage = source;
+    if (settings.useMask) {
+        cvMul(frame.getCvImage(), processedImage.getCvImage(), processedImage.getCvImage(), 1.0 / 255.0);
         saveDebugImage(processedImage, "processedImage", "masked");
     }
 
     // remove noise from the extracted image
     // to-do: a single erode pass is usually enough to remove the noise
-    processedImage.erode();
-    //saveDebugImage(processedImage, "processedImage", "eroded");
+    cvErode(processedImage.getCvImage(), frameSegment.getCvImage());
+    frameSegment.flagImageChanged();
+    //saveDebugImage(frameSegment, "segment", "eroded");
 
     // calculate the polygons from the roi
-    if (parameters->showPolygons) {
-        getContourPolygonsFromImage(processedImage, &polygons);
+    if (settings.showPolygons) {
+        getContourPolygonsFromImage(frameSegment, &polygons);
     }
 
-    // add gaussian blur to the silouetes
-    // (this step was originaly performed by the simulation on the sorounds of each particle, its here now to test if the performance is better)
-    gpuBlur(processedImage, parameters->gaussianBlur);
+    // the blur is done on the frame for the main thread (cpuBlur in threadLoop, or gpuBlur in update)
+}
+
+/// <summary>
+/// Run the segmentation kernel from frame (and background, if any) into frameSegment, over the whole image when the rows are contiguous
+/// </summary>
+void Camera::segmentFrame(ofxCvGrayscaleImage& frame, ofxCvGrayscaleImage* background, const SegmentationKernelParameters& params) {
+    const IplImage* frameImage = frame.getCvImage();
+    const IplImage* backgroundImage = background ? background->getCvImage() : nullptr;
+    IplImage* segmentImage = frameSegment.getCvImage();
+
+    const int width = frameImage->width;
+    const int height = frameImage->height;
+    const bool contiguous = frameImage->widthStep == width && segmentImage->widthStep == width && (!backgroundImage || backgroundImage->widthStep == width);
+    const int rows = contiguous ? 1 : height;
+    const size_t rowLength = contiguous ? static_cast<size_t>(width) * height : width;
+
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* frameRow = reinterpret_cast<const uint8_t*>(frameImage->imageData + y * frameImage->widthStep);
+        const uint8_t* backgroundRow = backgroundImage ? reinterpret_cast<const uint8_t*>(backgroundImage->imageData + y * backgroundImage->widthStep) : nullptr;
+        uint8_t* segmentRow = reinterpret_cast<uint8_t*>(segmentImage->imageData + y * segmentImage->widthStep);
+        segmentationKernel(frameRow, backgroundRow, segmentRow, rowLength, params);
+    }
+    frameSegment.flagImageChanged();
+}
+
+/// <summary>
+/// Clip the background reference into backgroundNewFrame, if it or the clipping range changed since the last time
+/// </summary>
+void Camera::updateClippedBackground(const SegmentationKernelParameters& params) {
+    if (hasClippedBackground && clippedBackgroundGeneration == backgroundReferenceGeneration &&
+        clippedBackgroundParameters.clipNear == params.clipNear && clippedBackgroundParameters.clipFar == params.clipFar) {
+        return;
+    }
+
+    const IplImage* referenceImage = backgroundReference.getCvImage();
+    IplImage* clippedImage = backgroundNewFrame.getCvImage();
+    for (int y = 0; y < referenceImage->height; y++) {
+        SegmentationKernel::clip(reinterpret_cast<const uint8_t*>(referenceImage->imageData + y * referenceImage->widthStep),
+                                 reinterpret_cast<uint8_t*>(clippedImage->imageData + y * clippedImage->widthStep),
+                                 referenceImage->width, params);
+    }
+    backgroundNewFrame.flagImageChanged();
+    saveDebugImage(backgroundNewFrame, "backgroundNewFrame", "thresholded");
 
-    segment = processedImage;
+    hasClippedBackground = true;
+    clippedBackgroundGeneration = backgroundReferenceGeneration;
+    clippedBackgroundParameters = params;
 }
 
 void Camera::gpuBlur(ofxCvGrayscaleImage& input, float sigma) {
@@ -481,39 +680,43 @@ void Camera::gpuBlur(ofxCvGrayscaleImage& input, float sigma) {
     }
     fboBlurTwoPass.end();
 
-    // 4) Copy back to CPU (ofxCvGrayscaleImage) if needed
-    //    For your pipeline, you need "processedImage" updated on CPU side.
-    //    The easiest approach: read the 8-bit grayscale channel from the FBO
-    //    (though we stored RGBA, the image is grayscale in .r)
-    ofPixels pixels;
-    fboBlurTwoPass.readToPixels(pixels);
-
-    // If you used GL_RGBA, `pixels` is 4-channel RGBA. We only need the red channel.
-    // We'll build a single-channel (grayscale) pixels object:
-    ofPixels grayPix;
-    grayPix.allocate(pixels.getWidth(), pixels.getHeight(), 1);
+    // 4) Copy back to CPU (ofxCvGrayscaleImage)
+    //    The FBO is GL_R8, so the read back is already a single channel;
+    //    blurPixels keeps its allocation from one frame to the next
+    fboBlurTwoPass.readToPixels(blurPixels);
 
-	// copy the red channel from the RGBA pixels into grayPix
-	grayPix.setChannel(0, pixels.getChannel(0));
+    if (blurPixels.getNumChannels() == 1) {
+        input.setFromPixels(blurPixels);
+        return;
+    }
 
-    // Now set it to the incoming ofxCvGrayscaleImage
-    input.setFromPixels(grayPix);
-    // done
+    // if the driver gave more channels, the image is grayscale in .r
+    blurGrayPixels.allocate(blurPixels.getWidth(), blurPixels.getHeight(), OF_PIXELS_GRAY);
+    const size_t channels = blurPixels.getNumChannels();
+    const unsigned char* rgba = blurPixels.getData();
+    unsigned char* gray = blurGrayPixels.getData();
+    for (size_t i = 0; i < blurGrayPixels.size(); i++) {
+        gray[i] = rgba[i * channels];
+    }
+    input.setFromPixels(blurGrayPixels);
 }
 
-void Camera::getContourPolygonsFromImage(ofxCvGrayscaleImage image, vector<ofPolyline> *output) {
+void Camera::getContourPolygonsFromImage(ofxCvGrayscaleImage& image, vector<ofPolyline> *output) {
 //    ofxCvContourFinder contourFinder;
-    vector<ofPolyline> _polys;
+    vector<ofPolyline>& _polys = *output; // filled in place, the vector keeps its capacity
 
     // regular find contours with defined parameters
-    contourFinder.findContours(image, parameters->blobMinArea * image.getPixels().size(), parameters->blobMaxArea * image.getPixels().size(), parameters->nConsidered, parameters->fillHolesOnPolygons, true);
+    const float imageArea = image.getWidth() * image.getHeight();
+    contourFinder.findContours(image, settings.blobMinArea * imageArea, settings.blobMaxArea * imageArea, settings.nConsidered, settings.fillHolesOnPolygons, true);
     //ofLog() << "Camera::getContourPolygonsFromImage Blobs size after findContours: " << contourFinder.blobs.size();
 
-    // generate (simplified) polygons from blobs
-    _polys.clear();
+    // generate (simplified) polygons from blobs, into the polylines of an older frame: clear keeps their vertex buffers
+    _polys.resize(contourFinder.blobs.size());
     _polyLineCount = 0;
-    for (const auto& blob : contourFinder.blobs) {
-        ofPolyline polyline;
+    for (size_t i = 0; i < contourFinder.blobs.size(); i++) {
+        const auto& blob = contourFinder.blobs[i];
+        ofPolyline& polyline = _polys[i];
+        polyline.clear();
         for (const auto& point : blob.pts) {
             polyline.addVertex(point.x, point.y);
         }
@@ -521,14 +724,10 @@ void Camera::getContourPolygonsFromImage(ofxCvGrayscaleImage image, vector<ofPol
         //polyline.addVertex(polyline.getVertices()[0].x, polyline.getVertices()[0].y);
         _polyLineCount++;
         // simplify the shape to have less edges
-        polyline.simplify(parameters->polygonTolerance);
-
-        _polys.push_back(polyline);
+        polyline.simplify(settings.polygonTolerance);
         //_polyLineCount += polyline.size();
     }
     // to-do: convert poly into image
-
-    *output = _polys;
 }
 
 #pragma endregion
@@ -540,12 +739,12 @@ void Camera::getContourPolygonsFromImage(ofxCvGrayscaleImage image, vector<ofPol
 /// <summary>
 /// Updates the background reference for later removal
 /// </summary>
-void Camera::addSampleToBackgroundReference(ofxCvGrayscaleImage newFrame, ofxCvGrayscaleImage &output, int samples) {
+void Camera::addSampleToBackgroundReference(ofxCvGrayscaleImage& newFrame, ofxCvGrayscaleImage &output, int samples) {
     int currSample = samples - backgroundReferenceLeftFrames;
 
     // original artwork strategy: sampleFrame = (sampleFrame + newFrame) * currentsamplef * (1 / (currentsamplef + 1)) //wtf?
 
-    output = source; // good enough for 1 frame!!
+    output = newFrame; // good enough for 1 frame!!
 
     // ---- failed strategies:
 
@@ -574,6 +773,7 @@ void Camera::addSampleToBackgroundReference(ofxCvGrayscaleImage newFrame, ofxCvG
     //    output.getCvImage());
 
     output.flagImageChanged();
+    backgroundReferenceGeneration++;
 
     backgroundReferenceLeftFrames--;
 
@@ -596,19 +796,31 @@ void Camera::startBackgroundReferenceSampling() {
     startBackgroundReferenceSampling(BG_SAMPLE_FRAMES);
 }
 
+/// <summary>
+/// Main thread: ask for a new background reference, the camera thread starts sampling on its next frame
+/// </summary>
 void Camera::startBackgroundReferenceSampling(int samples) {
     ofLogNotice("Camera::startBackgroundReferenceSampling()") << "Starting background";
+    parameters->previewBackground.clear();
+    requestedBackgroundSamples = samples;
+}
+
+/// <summary>
+/// Camera thread: start sampling the background reference from the current frame
+/// </summary>
+void Camera::beginBackgroundReferenceSampling(int samples) {
     isTakingBackgroundReference = true;
     backgroundReferenceTaken = false;
     clearBackgroundReference();
     backgroundReference = source; // Important step to take an initial sample, so any strategy of adding/weighting/... dont start from a black image
+    backgroundReferenceGeneration++;
     backgroundReferenceLeftFrames = samples;
 }
 
 void Camera::clearBackgroundReference() {
     ofLogNotice("Camera::clearBackgroundReference()") << "Clearing background";
     backgroundReference.set(0);
-    parameters->previewBackground.clear();
+    backgroundReferenceGeneration++;
 }
 
 
@@ -616,18 +828,30 @@ void Camera::clearBackgroundReference() {
 /// Writes a file with the reference image for later use
 /// </summary>
 /// <param name="image">the current background grayscale image</param>
-void Camera::saveBackgroundReference(ofxCvGrayscaleImage image) {
+void Camera::saveBackgroundReference(ofxCvGrayscaleImage& image) {
     ofLogNotice("Camera::saveBackgroundReference()") << "Saving background reference on data/" + BG_REFERENCE_FILENAME;
     if (ofFile::doesFileExist(BG_REFERENCE_FILENAME)) {
         ofLogNotice("Camera::saveBackgroundReference()") << "File already exist, will be overwriten";
     }
     ofSaveImage(image.getPixels(), BG_REFERENCE_FILENAME);
-    parameters->previewBackground.setFromPixels(backgroundReference.getPixels()); // updates the gui preview
+    publishBackgroundPreview(); // updates the gui preview
+}
+
+/// <summary>
+/// Camera thread: copy the background reference for the gui preview, that update sets on the main thread
+/// </summary>
+void Camera::publishBackgroundPreview() {
+    {
+        std::lock_guard<std::mutex> lock(backgroundPreviewMutex);
+        backgroundPreview = backgroundReference.getPixels();
+    }
+    backgroundPreviewGeneration++;
 }
 
 
 /// <summary>
 /// Reloads a previous reference from the disk
+/// Only while the camera thread is stopped (changeSource)
 /// </summary>
 /// <param name="imageObject"></param>
 /// <returns>True if loads the reference successfully</returns>
@@ -645,6 +869,7 @@ bool Camera::restoreBackgroundReference(ofxCvGrayscaleImage & outputImage) {
         }
         outputImage.allocate(pixels.getWidth(), pixels.getHeight());
         outputImage.setFromPixels(pixels);
+        backgroundReferenceGeneration++;
         backgroundReferenceTaken = true;
         parameters->previewBackground.setFromPixels(backgroundReference.getPixels()); // updates the gui preview // not perfect code, since this function should be agnostic and saving value to a pointer, but this param access is used directly
         ofLogNotice("Camera::restoreBackgroundReference") << "Load successfull";
@@ -662,25 +887,50 @@ bool Camera::restoreBackgroundReference(ofxCvGrayscaleImage & outputImage) {
 
 /// <summary>
 /// convert a grayscale image to a ofimage where black is full transparency, and shades of gray are white color but shades of transparency
+/// The ofimage is only allocated when the size changes, the pixels are written in place
 /// </summary>
 void convertToTransparent(ofxCvGrayscaleImage &grayImage, ofImage &rgbaImage) {
-    // use a mat(erial) for performance
-    cv::Mat cvGrayImage = cv::cvarrToMat(grayImage.getCvImage());
-    cv::Mat cvRgbaImage(cvGrayImage.rows, cvGrayImage.cols, CV_8UC4);
+    const IplImage* cvGrayImage = grayImage.getCvImage();
+    const int width = cvGrayImage->width;
+    const int height = cvGrayImage->height;
+
+    if (rgbaImage.getWidth() != width || rgbaImage.getHeight() != height || rgbaImage.getImageType() != OF_IMAGE_COLOR_ALPHA) {
+        rgbaImage.allocate(width, height, OF_IMAGE_COLOR_ALPHA);
+    }
 
     // grays to trnsparents
-    int totalPixels = cvGrayImage.rows * cvGrayImage.cols;
-    uchar* grayData = cvGrayImage.data;
-    cv::Vec4b* rgbaData = cvRgbaImage.ptr<cv::Vec4b>();
-    uchar grayValue;
-    for (int i = 0; i < totalPixels; ++i) {
-        grayValue = grayData[i];
-        rgbaData[i] = cv::Vec4b(255, 255, 255, grayValue);
+    unsigned char* rgbaData = rgbaImage.getPixels().getData();
+    for (int y = 0; y < height; y++) {
+        const unsigned char* grayRow = reinterpret_cast<const unsigned char*>(cvGrayImage->imageData) + y * cvGrayImage->widthStep;
+        unsigned char* rgbaRow = rgbaData + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; x++) {
+            rgbaRow[x * 4 + 0] = 255;
+            rgbaRow[x * 4 + 1] = 255;
+            rgbaRow[x * 4 + 2] = 255;
+            rgbaRow[x * 4 + 3] = grayRow[x];
+        }
     }
 
-    // regenerate the modified data to an image
-    rgbaImage.allocate(cvRgbaImage.cols, cvRgbaImage.rows, OF_IMAGE_COLOR_ALPHA);
-    rgbaImage.setFromPixels(cvRgbaImage.data, cvRgbaImage.cols, cvRgbaImage.rows, OF_IMAGE_COLOR_ALPHA);
+    // upload the modified pixels
+    rgbaImage.update();
+}
+
+/// <summary>
+/// copy a grayscale image to pixels, straight from its opencv image (ofxCvImage::getPixels keeps a copy of its own first)
+/// The pixels are only allocated when the size changes
+/// </summary>
+void copyToPixels(ofxCvGrayscaleImage& grayImage, ofPixels& pixels) {
+    const IplImage* cvGrayImage = grayImage.getCvImage();
+    const int width = cvGrayImage->width;
+    const int height = cvGrayImage->height;
+
+    if (pixels.getWidth() != width || pixels.getHeight() != height || pixels.getNumChannels() != 1) {
+        pixels.allocate(width, height, OF_PIXELS_GRAY);
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(pixels.getData() + static_cast<size_t>(y) * width, cvGrayImage->imageData + y * cvGrayImage->widthStep, width);
+    }
 }
 
 
@@ -690,18 +940,19 @@ void convertToTransparent(ofxCvGrayscaleImage &grayImage, ofImage &rgbaImage) {
 /// <param name="img">image</param>
 /// <param name="name">object name id (background, camera, cleared..)</param>
 /// <param name="step">additional id, i.e. sequence step</param>
-void Camera::saveDebugImage(ofxCvGrayscaleImage img, string name, string step) {
+void Camera::saveDebugImage(ofxCvGrayscaleImage& img, const char* name, const char* step) {
 #ifdef DEBUG_IMAGES
-    if (parameters->saveDebugImages) {
+    if (settings.saveDebugImages) {
         const string& filename = ofGetTimestampString() + "_" + name + "_" + step + ".png";
+        img.flagImageChanged(); // the stages write the opencv image directly
         ofSaveImage(img.getPixels(), filename);
     }
 #endif
 }
 
-void Camera::recordTestingFrames(ofxCvGrayscaleImage img) {
+void Camera::recordTestingFrames(ofxCvGrayscaleImage& img) {
     recordTestingFramesCounter++;
-    const string& filename = "raw_recording\\" + ofToString(recordTestingFramesCounter) + ".png";
+    const string& filename = "raw_recording\\" + ofToString(recordTestingFramesCounter.load()) + ".png";
     ofSaveImage(img.getPixels(), filename);
 }
 
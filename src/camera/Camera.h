@@ -4,8 +4,35 @@
 #include "ofxOrbbecCamera.h"
 #include "../gui/GuiApp.h"
 #include "ofxOpenCv.h"
+#include "../simulation/TripleBuffer.h"
+#include "SegmentationKernel.h"
+#include "StackedBoxBlur.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+/// <summary>
+/// A processed camera frame, from the camera thread to the main thread
+/// </summary>
+struct CameraFrame {
+    ofPixels source;            // the frame as captured, for the gui preview
+    ofPixels segment;           // final extraction, already blurred if blurred is set
+    vector<ofPolyline> polygons;
+    uint64_t captureTime = 0;   // microseconds since startup when the frame was acquired
+    uint64_t allocations = 0;   // heap allocations of the camera thread for this frame
+    bool blurred = false;       // blurred on the cpu, otherwise the main thread blurs it on the gpu
+    float blurTime = 0.0f;      // milliseconds of the cpu blur
+};
 
-
+/// <summary>
+/// Acquires the depth frames and extracts the segment on a thread of its own, so the sensor waits and the opencv passes
+/// stay out of the main loop. Only the newest processed frame is kept for the main thread (a triple buffer), the ones it
+/// did not pick in time are dropped instead of queued. The blur runs here too (StackedBoxBlur), unless the gpu blur is selected,
+/// which stays on the main thread with the rest of the gl work (preview textures). The video file is decoded there too (its
+/// players are tied to it); its frames reach the thread through a second triple buffer
+/// </summary>
 class Camera
 {
     enum class VideoSources : int {
@@ -16,6 +43,8 @@ class Camera
     };
 
     public:
+        ~Camera();
+
         void setup(CameraParameters* params);
         void update();
         void draw();
@@ -26,16 +55,16 @@ class Camera
         void stopCurrentSource();
 
         void processCameraFrame(ofxCvGrayscaleImage &cameraFrame, ofxCvGrayscaleImage &backgroundReference);
-        void addSampleToBackgroundReference(ofxCvGrayscaleImage newFrame, ofxCvGrayscaleImage& output, int samples);
+        void addSampleToBackgroundReference(ofxCvGrayscaleImage& newFrame, ofxCvGrayscaleImage& output, int samples);
         void startBackgroundReferenceSampling(int samples);
         void startBackgroundReferenceSampling();
         void clearBackgroundReference();
 
-        void getContourPolygonsFromImage(ofxCvGrayscaleImage image, vector<ofPolyline>* output);
+        void getContourPolygonsFromImage(ofxCvGrayscaleImage& image, vector<ofPolyline>* output);
 
-        void saveDebugImage(ofxCvGrayscaleImage img, string name, string step);
-        void recordTestingFrames(ofxCvGrayscaleImage frame);
-        uint64 recordTestingFramesCounter = 0;
+        void saveDebugImage(ofxCvGrayscaleImage& img, const char* name, const char* step);
+        void recordTestingFrames(ofxCvGrayscaleImage& frame);
+        std::atomic<uint64> recordTestingFramesCounter{ 0 };
         void saveMeshFrame();
 
         // parameters points to the mainApp's GUI. linked in main.cpp
@@ -52,7 +81,10 @@ class Camera
         ofTexture outputTexDepth;
 
         // used on gui preview
-        ofxCvGrayscaleImage segment;  // final segmented image
+        ofxCvGrayscaleImage segment;  // final segmented image, main thread
+
+        // microseconds since startup when the frame of the current segment was acquired
+        uint64_t getCaptureTime() const { return captureTime; }
 
         //void linkGui();
         //void linkGuiParams(GuiApp::CameraParameters* params);
@@ -64,26 +96,107 @@ class Camera
         ofShader blurVertical;
         ofFbo   fboBlurOnePass;
         ofFbo   fboBlurTwoPass;
+        ofPixels blurPixels; // read back of fboBlurTwoPass, allocated once
+        ofPixels blurGrayPixels;
 
         // We'll wrap the GPU blur in a helper method:
         void gpuBlur(ofxCvGrayscaleImage& input, float sigma);
 
     private:
+        /// <summary>
+        /// Everything the processing reads that the gui can change, copied for every frame
+        /// </summary>
+        struct ProcessingSettings {
+            bool enableClipping = true;
+            int clipFar = 0;
+            int clipNear = 0;
+            bool floodfillHoles = true;
+            bool useMask = false;
+            bool showPolygons = false;
+            float blobMinArea = 0.05f;
+            float blobMaxArea = 0.8f;
+            int nConsidered = 0;
+            bool fillHolesOnPolygons = false;
+            float polygonTolerance = 2.0f;
+            bool saveDebugImages = false;
+            bool recordTestingVideo = false;
+            int gaussianBlur = 0;
+            bool useCpuBlur = true;
+        };
+
+        /// <summary>
+        /// A decoded frame of the video file, for the camera thread
+        /// </summary>
+        struct VideoFrame {
+            ofPixels pixels;
+            uint64_t captureTime = 0;
+        };
+
+        void startThread();
+        void stopThread();
+        void threadLoop();
+        bool acquireFrame();
+        void shareSettings();
+        void publishBackgroundPreview();
+
+        // camera thread, from setup to exit; stopped while the source changes
+        std::thread cameraThread;
+        std::mutex threadMutex;
+        std::condition_variable threadWake;
+        bool threadStopping = false;
+        static constexpr float CAPTURE_POLL_INTERVAL = 0.002f; // seconds between sensor polls, a few per sensor frame
+
+        // settings shared by the main thread (under settingsMutex), and the ones of the frame in process
+        ProcessingSettings sharedSettings;
+        ProcessingSettings settings;
+        std::mutex settingsMutex;
+
+        // processed frames for the main thread, video frames for the camera thread
+        TripleBuffer<CameraFrame> frames;
+        TripleBuffer<VideoFrame> videoFrames;
+        uint64_t captureTime = 0;       // main thread, of the segment
+        uint64_t frameCaptureTime = 0;  // camera thread, of the frame in process
+        vector<ofPolyline> previewPolygons; // main thread, polygons of the segment
+
+        // background reference for the gui preview, copied by the camera thread when it changes
+        ofPixels backgroundPreview;
+        std::mutex backgroundPreviewMutex;
+        std::atomic<uint32_t> backgroundPreviewGeneration{ 0 };
+        uint32_t shownBackgroundPreviewGeneration = 0;
+
+        // samples asked for by the gui, the camera thread starts the sampling on its next frame
+        std::atomic<int> requestedBackgroundSamples{ 0 };
+        void beginBackgroundReferenceSampling(int samples);
+
+        // clipping, background subtraction and binarization in one pass (steps 1 to 3 of processCameraFrame)
+        SegmentationKernelFunction segmentationKernel = SegmentationKernel::select();
+        void segmentFrame(ofxCvGrayscaleImage& frame, ofxCvGrayscaleImage* background, const SegmentationKernelParameters& params);
+        void updateClippedBackground(const SegmentationKernelParameters& params);
+
+        // the clipped background (backgroundNewFrame) is only clipped again when the reference or the clipping range change
+        uint32_t backgroundReferenceGeneration = 0;
+        uint32_t clippedBackgroundGeneration = 0;
+        SegmentationKernelParameters clippedBackgroundParameters = {};
+        bool hasClippedBackground = false;
+
+        // gaussian blur of the segment on the camera thread, on a few threads of its own
+        static constexpr size_t CPU_BLUR_THREADS = 4; // a 640x576 frame is split in a few bands, the simulation has the other cores
+        StackedBoxBlur cpuBlur{ CPU_BLUR_THREADS };
+
+        // from here on, the images belong to the camera thread (no textures, so no gl calls off the main thread)
+        // they are all allocated by setFrameSize, every stage of the processing writes into one of them
         ofxCvColorImage colorFrame; // to store>transform from video file or webcam
         ofxCvGrayscaleImage source; // camera frame
         ofxCvGrayscaleImage cameraImage; // camera frame
         ofxCvGrayscaleImage backgroundReference;  // background reference frame
 
         ofxCvGrayscaleImage processedImage; // intermediate frame using during the processing
-        ofxCvGrayscaleImage backgroundNewFrame;  // temporary frame used for accumulating backgrounds
-        ofxCvGrayscaleImage maskImage; // used for the masking strategy
-        ofxCvGrayscaleImage fillMaskforHoles;
-
-        CvConnectedComp* comp; // used in hole filling floodfill
+        ofxCvGrayscaleImage backgroundNewFrame;  // the background reference, clipped like the frame (cached, see updateClippedBackground)
+        ofxCvGrayscaleImage frameSegment; // the segment while it is processed, and the final one
 
-        bool isTakingBackgroundReference = false;
+        std::atomic<bool> isTakingBackgroundReference{ false };
         bool backgroundReferenceTaken = false;
-        int backgroundReferenceLeftFrames;
+        std::atomic<int> backgroundReferenceLeftFrames{ 0 };
 
         ofxCvContourFinder contourFinder;
         vector<ofPolyline> polygons;
@@ -107,9 +220,10 @@ class Camera
         };
         int selectedOrbbecResolution = 0;
 
-        void saveBackgroundReference(ofxCvGrayscaleImage image);
+        void saveBackgroundReference(ofxCvGrayscaleImage& image);
         bool restoreBackgroundReference(ofxCvGrayscaleImage & outputImage);
         
+        const int SEGMENT_THRESHOLD = 5; // depth difference to the background that is still background
         const int BG_SAMPLE_FRAMES = 2; 
         const string BG_REFERENCE_FILENAME = "BACKGROUND_REFERENCE.png";
 
@@ -124,3 +238,4 @@ class Camera
 };
 
 void convertToTransparent(ofxCvGrayscaleImage &grayImage, ofImage &rgbaImage);
+void copyToPixels(ofxCvGrayscaleImage& grayImage, ofPixels& pixels);
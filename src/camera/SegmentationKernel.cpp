@@ -0,0 +1,104 @@
+#include "SegmentationKernel.h"
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef ESENCIA_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+SegmentationKernelFunction SegmentationKernel::select() {
+#ifdef ESENCIA_SIMD_X86
+    return &SegmentationKernel::sse2; // SSE2 is always there on x64
+#else
+    return &SegmentationKernel::scalar;
+#endif
+}
+
+std::string SegmentationKernel::getName() {
+#ifdef ESENCIA_SIMD_X86
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+SegmentationKernelParameters SegmentationKernel::getParameters(bool enableClipping, int clipNear, int clipFar, int threshold) {
+    // a near threshold below 0 keeps the depth 0 instead of clearing it, which makes no difference (it is 0 either way)
+    SegmentationKernelParameters params;
+    params.clipNear = enableClipping ? static_cast<uint8_t>(std::clamp(clipNear, 0, 255)) : 0;
+    params.clipFar = enableClipping ? static_cast<uint8_t>(std::clamp(clipFar, 0, 255)) : 255;
+    params.threshold = static_cast<uint8_t>(std::clamp(threshold, 0, 255));
+    return params;
+}
+
+static inline uint8_t clipDepth(uint8_t depth, const SegmentationKernelParameters& params) {
+    return (depth > params.clipNear && depth <= params.clipFar) ? depth : 0;
+}
+
+void SegmentationKernel::clip(const uint8_t* source, uint8_t* clipped, size_t count, const SegmentationKernelParameters& params) {
+    for (size_t i = 0; i < count; i++) {
+        clipped[i] = clipDepth(source[i], params);
+    }
+}
+
+void SegmentationKernel::scalar(const uint8_t* frame, const uint8_t* background, uint8_t* segment, size_t count, const SegmentationKernelParameters& params) {
+    for (size_t i = 0; i < count; i++) {
+        int difference = clipDepth(frame[i], params);
+        if (background) {
+            difference = std::abs(difference - background[i]);
+        }
+        segment[i] = difference > params.threshold ? 255 : 0;
+    }
+}
+
+#ifdef ESENCIA_SIMD_X86
+
+/// <summary>
+/// a <= b for unsigned bytes (SSE2 only compares signed ones)
+/// </summary>
+static inline __m128i lessOrEqual(__m128i a, __m128i b) {
+    return _mm_cmpeq_epi8(_mm_min_epu8(a, b), a);
+}
+
+/// <summary>
+/// 16 pixels at once: the clipping is a mask of the range, the absolute difference is the or of the two saturated differences,
+/// and the binarization is the saturated difference to the threshold being non zero
+/// </summary>
+static inline __m128i segmentPixels(__m128i depth, const __m128i* background, __m128i clipNear, __m128i clipFar, __m128i threshold) {
+    const __m128i inRange = _mm_andnot_si128(lessOrEqual(depth, clipNear), lessOrEqual(depth, clipFar));
+    __m128i difference = _mm_and_si128(depth, inRange);
+    if (background) {
+        const __m128i reference = _mm_loadu_si128(background);
+        difference = _mm_or_si128(_mm_subs_epu8(difference, reference), _mm_subs_epu8(reference, difference));
+    }
+    const __m128i inside = _mm_cmpeq_epi8(_mm_subs_epu8(difference, threshold), _mm_setzero_si128());
+    return _mm_andnot_si128(inside, _mm_set1_epi8(-1));
+}
+
+void SegmentationKernel::sse2(const uint8_t* frame, const uint8_t* background, uint8_t* segment, size_t count, const SegmentationKernelParameters& params) {
+    const __m128i clipNear = _mm_set1_epi8(static_cast<char>(params.clipNear));
+    const __m128i clipFar = _mm_set1_epi8(static_cast<char>(params.clipFar));
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(params.threshold));
+
+    size_t i = 0;
+    if (background) {
+        for (; i + 16 <= count; i += 16) {
+            const __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + i));
+            const __m128i result = segmentPixels(depth, reinterpret_cast<const __m128i*>(background + i), clipNear, clipFar, threshold);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(segment + i), result);
+        }
+    }
+    else {
+        for (; i + 16 <= count; i += 16) {
+            const __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + i));
+            const __m128i result = segmentPixels(depth, nullptr, clipNear, clipFar, threshold);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(segment + i), result);
+        }
+    }
+
+    if (i < count) {
+        scalar(frame + i, background ? background + i : nullptr, segment + i, count - i, params);
+    }
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// the vector version is only built for x86 (the macOS arm builds use the scalar one)
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ESENCIA_SIMD_X86
+#endif
+
+/// <summary>
+/// Constants of the segmentation of a frame, as bytes: the clipping range is clipNear < depth <= clipFar
+/// </summary>
+struct SegmentationKernelParameters {
+    uint8_t clipNear;
+    uint8_t clipFar;
+    uint8_t threshold;  // smallest difference to the background that is not part of it is threshold + 1
+};
+
+/// <summary>
+/// Segmentation of count pixels of a depth frame: clip far and near, absolute difference to the (already clipped) background
+/// reference, and binarize to 0 or 255. Without a background (nullptr) the clipped frame itself is binarized
+/// </summary>
+using SegmentationKernelFunction = void(*)(const uint8_t* frame, const uint8_t* background, uint8_t* segment, size_t count, const SegmentationKernelParameters& params);
+
+/// <summary>
+/// Steps 1 to 3 of Camera::processCameraFrame in a single read of the frame, in scalar and SSE2 (16 pixels) versions
+/// Same results as the cvThreshold (to zero inv, to zero), cvAbsDiff and threshold passes it replaces
+/// </summary>
+class SegmentationKernel {
+public:
+    static SegmentationKernelFunction select();
+    static std::string getName();
+
+    /// <summary>
+    /// The clipping range of the gui values, clamped to bytes the way cvThreshold does (no clipping keeps every depth)
+    /// </summary>
+    static SegmentationKernelParameters getParameters(bool enableClipping, int clipNear, int clipFar, int threshold);
+
+    /// <summary>
+    /// Only the clipping, for the background reference (done once for each reference and clipping range)
+    /// </summary>
+    static void clip(const uint8_t* source, uint8_t* clipped, size_t count, const SegmentationKernelParameters& params);
+
+    static void scalar(const uint8_t* frame, const uint8_t* background, uint8_t* segment, size_t count, const SegmentationKernelParameters& params);
+#ifdef ESENCIA_SIMD_X86
+    static void sse2(const uint8_t* frame, const uint8_t* background, uint8_t* segment, size_t count, const SegmentationKernelParameters& params);
+#endif
+};
@@ -0,0 +1,235 @@
+#include "StackedBoxBlur.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef ESENCIA_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// Average of a box of width pixels from their sum, rounded: ((sum + width / 2) * scale) >> 16, scale = 65536 / width
+/// (scale is rounded down, so a box of 255 never goes over 255; and for width >= 3 it fits in 16 bits for SSE2)
+/// </summary>
+struct BoxDivision {
+    uint32_t half;
+    uint32_t scale;
+
+    explicit BoxDivision(int radius) :
+        half(static_cast<uint32_t>(radius)),
+        scale(65536u / static_cast<uint32_t>(2 * radius + 1)) {}
+
+    uint8_t operator()(uint32_t sum) const { return static_cast<uint8_t>(((sum + half) * scale) >> 16); }
+};
+
+/// <param name="threadCount">threads splitting the rows and the columns, including the caller, 0 uses all the available cores</param>
+StackedBoxBlur::StackedBoxBlur(size_t threadCount) : pool(threadCount) {
+    rowScratch.resize(pool.size());
+    columnSums.resize(pool.size());
+}
+
+/// <summary>
+/// Widths of the boxes as in "Fast almost-gaussian filtering" (Kovesi): the two odd widths around the ideal one,
+/// as many of the narrower as give the closest variance to sigma²
+/// </summary>
+void StackedBoxBlur::getBoxRadiuses(float sigma, int radiuses[BOX_PASSES]) {
+    sigma = std::min(sigma, MAX_SIGMA);
+    if (sigma <= 0.0f) {
+        std::fill(radiuses, radiuses + BOX_PASSES, 0);
+        return;
+    }
+
+    const float n = static_cast<float>(BOX_PASSES);
+    const float variance = 12.0f * sigma * sigma;
+    int lower = static_cast<int>(std::floor(std::sqrt(variance / n + 1.0f)));
+    if (lower % 2 == 0) lower--;
+    const int upper = lower + 2;
+
+    const float lowerCount = (variance - n * lower * lower - 4.0f * n * lower - 3.0f * n) / (-4.0f * lower - 4.0f);
+    const int narrowBoxes = static_cast<int>(std::round(lowerCount));
+
+    for (int i = 0; i < BOX_PASSES; i++) {
+        radiuses[i] = ((i < narrowBoxes ? lower : upper) - 1) / 2;
+    }
+}
+
+void StackedBoxBlur::blur(uint8_t* pixels, int width, int height, size_t stride, float sigma) {
+    if (!pixels || width <= 0 || height <= 0) return;
+
+    // boxes of radius 0 leave the image as it is
+    int radiuses[BOX_PASSES];
+    getBoxRadiuses(sigma, radiuses);
+    int* lastBox = std::remove(radiuses, radiuses + BOX_PASSES, 0);
+    const int boxes = static_cast<int>(lastBox - radiuses);
+    if (boxes == 0) return;
+    std::fill(lastBox, radiuses + BOX_PASSES, 0);
+
+    // allocated once for a frame size, like the images of the camera
+    const size_t imageSize = static_cast<size_t>(width) * height;
+    if (horizontal.size() != 2 * imageSize || columnSums[0].size() != static_cast<size_t>(width)) {
+        horizontal.assign(2 * imageSize, 0);
+        for (auto& scratch : rowScratch) scratch.assign(2 * static_cast<size_t>(width), 0);
+        for (auto& sums : columnSums) sums.assign(width, 0);
+    }
+
+    // all the horizontal passes of a row at once, the vertical ones ping-pong between the two halves of horizontal
+    // and the last one writes the image
+    blurRows(pixels, stride, width, height, radiuses);
+
+    uint8_t* columnsSource = horizontal.data();
+    uint8_t* columnsTarget = horizontal.data() + imageSize;
+    for (int i = 0; i < boxes; i++) {
+        if (i == boxes - 1) {
+            blurColumns(columnsSource, width, pixels, stride, width, height, radiuses[i]);
+        }
+        else {
+            blurColumns(columnsSource, width, columnsTarget, width, width, height, radiuses[i]);
+            std::swap(columnsSource, columnsTarget);
+        }
+    }
+}
+
+#pragma region Rows
+
+/// <summary>
+/// A box along a row, as a running sum: the pixel entering the box is added and the one leaving it subtracted
+/// </summary>
+static void boxRow(const uint8_t* source, uint8_t* target, int width, int radius) {
+    const BoxDivision divide(radius);
+    const int last = width - 1;
+
+    uint32_t sum = 0;
+    for (int k = -radius; k <= radius; k++) {
+        sum += source[std::clamp(k, 0, last)];
+    }
+
+    for (int x = 0; x < width; x++) {
+        target[x] = divide(sum);
+        sum += source[std::min(x + radius + 1, last)];
+        sum -= source[std::max(x - radius, 0)];
+    }
+}
+
+/// <summary>
+/// The horizontal passes of every row, from the image into the first half of horizontal
+/// </summary>
+void StackedBoxBlur::blurRows(const uint8_t* source, size_t sourceStride, int width, int height, const int radiuses[BOX_PASSES]) {
+    // the job only captures this and the pass, small enough for std::function to keep it without allocating
+    struct RowsPass {
+        const uint8_t* source;
+        size_t sourceStride;
+        int width;
+        const int* radiuses;
+    } pass{ source, sourceStride, width, radiuses };
+
+    pool.parallelFor(height, [this, &pass](size_t begin, size_t end, size_t workerIndex) {
+        uint8_t* scratch[2] = { rowScratch[workerIndex].data(), rowScratch[workerIndex].data() + pass.width };
+        const int boxes = static_cast<int>(std::find(pass.radiuses, pass.radiuses + BOX_PASSES, 0) - pass.radiuses);
+
+        for (size_t y = begin; y < end; y++) {
+            const uint8_t* in = pass.source + y * pass.sourceStride;
+            uint8_t* rowTarget = horizontal.data() + y * pass.width;
+            for (int i = 0; i < boxes; i++) {
+                uint8_t* out = (i == boxes - 1) ? rowTarget : scratch[i % 2];
+                boxRow(in, out, pass.width, pass.radiuses[i]);
+                in = out;
+            }
+        }
+    }, MIN_ROWS_PER_JOB);
+}
+
+#pragma endregion
+
+#pragma region Columns
+
+// the column sums of a strip of columns, 16 columns per step with SSE2, the rest one by one
+
+static void addRow(uint16_t* sums, const uint8_t* row, int width) {
+    int x = 0;
+#ifdef ESENCIA_SIMD_X86
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i* sum = reinterpret_cast<__m128i*>(sums + x);
+        _mm_storeu_si128(sum, _mm_add_epi16(_mm_loadu_si128(sum), _mm_unpacklo_epi8(pixels, zero)));
+        _mm_storeu_si128(sum + 1, _mm_add_epi16(_mm_loadu_si128(sum + 1), _mm_unpackhi_epi8(pixels, zero)));
+    }
+#endif
+    for (; x < width; x++) {
+        sums[x] += row[x];
+    }
+}
+
+static void slideRow(uint16_t* sums, const uint8_t* entering, const uint8_t* leaving, int width) {
+    int x = 0;
+#ifdef ESENCIA_SIMD_X86
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(entering + x));
+        const __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(leaving + x));
+        __m128i* sum = reinterpret_cast<__m128i*>(sums + x);
+        // the sums wrap around in between, the result is exact (it always fits in 16 bits)
+        __m128i low = _mm_add_epi16(_mm_loadu_si128(sum), _mm_unpacklo_epi8(in, zero));
+        __m128i high = _mm_add_epi16(_mm_loadu_si128(sum + 1), _mm_unpackhi_epi8(in, zero));
+        _mm_storeu_si128(sum, _mm_sub_epi16(low, _mm_unpacklo_epi8(out, zero)));
+        _mm_storeu_si128(sum + 1, _mm_sub_epi16(high, _mm_unpackhi_epi8(out, zero)));
+    }
+#endif
+    for (; x < width; x++) {
+        sums[x] = static_cast<uint16_t>(sums[x] + entering[x] - leaving[x]);
+    }
+}
+
+static void divideRow(const uint16_t* sums, uint8_t* target, int width, const BoxDivision& divide) {
+    int x = 0;
+#ifdef ESENCIA_SIMD_X86
+    const __m128i half = _mm_set1_epi16(static_cast<short>(divide.half));
+    const __m128i scale = _mm_set1_epi16(static_cast<short>(divide.scale));
+    for (; x + 16 <= width; x += 16) {
+        const __m128i* sum = reinterpret_cast<const __m128i*>(sums + x);
+        const __m128i low = _mm_mulhi_epu16(_mm_add_epi16(_mm_loadu_si128(sum), half), scale);
+        const __m128i high = _mm_mulhi_epu16(_mm_add_epi16(_mm_loadu_si128(sum + 1), half), scale);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; x < width; x++) {
+        target[x] = divide(sums[x]);
+    }
+}
+
+/// <summary>
+/// A vertical box pass from source into target, in strips of STRIP_COLUMNS columns: the sums of a strip start from the
+/// box around the first row, then slide down the whole height one row at a time, so the box is only summed once per column
+/// </summary>
+void StackedBoxBlur::blurColumns(const uint8_t* source, size_t sourceStride, uint8_t* target, size_t targetStride, int width, int height, int radius) {
+    struct ColumnsPass {
+        const uint8_t* source;
+        size_t sourceStride;
+        uint8_t* target;
+        size_t targetStride;
+        int width;
+        int height;
+        int radius;
+    } pass{ source, sourceStride, target, targetStride, width, height, radius };
+
+    const size_t strips = (static_cast<size_t>(width) + STRIP_COLUMNS - 1) / STRIP_COLUMNS;
+    pool.parallelFor(strips, [this, &pass](size_t begin, size_t end, size_t workerIndex) {
+        const BoxDivision divide(pass.radius);
+        const int last = pass.height - 1;
+        const size_t x = begin * STRIP_COLUMNS;
+        const int columns = static_cast<int>(std::min(end * STRIP_COLUMNS, static_cast<size_t>(pass.width)) - x);
+        auto row = [&pass, last, x](int y) { return pass.source + std::clamp(y, 0, last) * pass.sourceStride + x; };
+
+        uint16_t* sums = columnSums[workerIndex].data() + x;
+        std::fill(sums, sums + columns, 0);
+        for (int k = -pass.radius; k <= pass.radius; k++) {
+            addRow(sums, row(k), columns);
+        }
+
+        for (int y = 0; y < pass.height; y++) {
+            divideRow(sums, pass.target + y * pass.targetStride + x, columns, divide);
+            slideRow(sums, row(y + pass.radius + 1), row(y - pass.radius), columns);
+        }
+    }, 1);
+}
+
+#pragma endregion
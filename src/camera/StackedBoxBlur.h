@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../simulation/WorkerPool.h"
+#include "SegmentationKernel.h" // ESENCIA_SIMD_X86
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/// <summary>
+/// Gaussian blur of an 8 bit image on the cpu, approximated by BOX_PASSES box blurs of widths picked for sigma
+/// (a box of any width is a running sum, so the cost per pixel is the same for every sigma)
+/// The horizontal passes run along the rows, in bands of rows per job; the vertical ones slide the column sums of a strip
+/// of columns per job down the whole image, 16 columns at a time with SSE2. The edges are clamped, like the textures of the gpu blur
+/// </summary>
+class StackedBoxBlur {
+public:
+    static constexpr int BOX_PASSES = 3;
+    static constexpr float MAX_SIGMA = 50.0f; // the column sums are 16 bits, boxes stay well under 257 pixels
+
+    explicit StackedBoxBlur(size_t threadCount = 0);
+
+    /// <summary>
+    /// Blur the image in place, rows are stride bytes apart. Nothing is done when sigma is too small to blur
+    /// </summary>
+    void blur(uint8_t* pixels, int width, int height, size_t stride, float sigma);
+
+    /// <summary>
+    /// Radiuses of the boxes whose stack has the variance of a gaussian of sigma, 0 for no box
+    /// </summary>
+    static void getBoxRadiuses(float sigma, int radiuses[BOX_PASSES]);
+
+private:
+    void blurRows(const uint8_t* source, size_t sourceStride, int width, int height, const int radiuses[BOX_PASSES]);
+    void blurColumns(const uint8_t* source, size_t sourceStride, uint8_t* target, size_t targetStride, int width, int height, int radius);
+
+    WorkerPool pool;
+
+    std::vector<uint8_t> horizontal;                // the output of the horizontal passes, width x height
+    std::vector<std::vector<uint8_t>> rowScratch;   // by worker, two rows for the passes in between
+    std::vector<std::vector<uint16_t>> columnSums;  // by worker, a sum per column
+
+    static constexpr size_t MIN_ROWS_PER_JOB = 32;
+    static constexpr size_t STRIP_COLUMNS = 64; // 4 SSE2 steps, and a cache line of the rows, no two jobs write the same one
+};
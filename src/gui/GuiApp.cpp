@@ -45,17 +45,23 @@ void GuiApp::setup()
     localSettingsValues.add(cameraParameters.clipFar.set("clip far", cameraParameters.clipFar.get()));
     localSettingsValues.add(cameraParameters.clipNear.set("clip near", cameraParameters.clipNear.get()));
     localSettingsValues.add(sonificationParameters.audioDeviceId.set("audio device id", sonificationParameters.audioDeviceId.get()));
+    localSettingsValues.add(simulationParameters.useCpuSimulation.set("simulate on cpu", simulationParameters.useCpuSimulation.get()));
     localSettings->add(localSettingsValues);
     localSettings->loadFromFile(LOCAL_SETTINGS_FILE);
     sonificationParameters.audioDeviceId.addListener(this, &GuiApp::onChangeLocalConfig);
     cameraParameters.clipFar.addListener(this, &GuiApp::onChangeLocalConfig);
     cameraParameters.clipNear.addListener(this, & GuiApp::onChangeLocalConfig);
+    simulationParameters.useCpuSimulation.addListener(this, &GuiApp::onChangeLocalToggle);
 }
 
 void GuiApp::onChangeLocalConfig(int& deviceId) {
     localSettings->saveToFile(LOCAL_SETTINGS_FILE);
 }
 
+void GuiApp::onChangeLocalToggle(bool& value) {
+    localSettings->saveToFile(LOCAL_SETTINGS_FILE);
+}
+
 
 void GuiApp::update() 
 {
@@ -67,6 +67,7 @@ public:
     ofParameterGroup& localSettingsValues = ofParameterGroup();
 
     void onChangeLocalConfig(int& deviceId);
+    void onChangeLocalToggle(bool& value);
 
 private:
     ParticlesPanel particlesPanel;
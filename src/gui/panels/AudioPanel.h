@@ -35,6 +35,7 @@ public:
 		ofxGuiGroup* simGroup = p->addGroup("sonification data");
 		simGroup->add<ofxGuiValuePlotter>(params->collisions.set("collisions", 0, 0, 100), ofJson({ {"precision", 0} }));
         simGroup->add<ofxGuiValuePlotter>(params->collisionRate.set("collision rate", 0, 0, 1), ofJson({ {"precision", 2} }));
+        simGroup->add<ofxGuiValuePlotter>(params->collisionImpactSpeed.set("collision impact speed", 0, 0, 100), ofJson({ {"precision", 1} }));
 		
 		simGroup->add<ofxGuiValuePlotter>(params->clusters.set("clusters", 0, 0, 100), ofJson({ {"precision", 0} }));
 		//simGroup->add<ofxGuiValuePlotter>(params->particlesInClusters.set("particles in clusters", 0, 0, 100), ofJson({ {"precision", 0} }));
@@ -6,7 +6,7 @@
 class ParticlesPanel : public EsenciaPanelBase {
 
 public:
-	const float PARTICLES_MAX = 5000.0;
+	const float PARTICLES_MAX = 50000.0;
 
 private:
 	// default initial values
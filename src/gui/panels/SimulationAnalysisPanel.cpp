@@ -26,14 +26,19 @@ void SonificationPanel::setup(ofxGui& gui, SimulationParameters& simParams, Soni
     clusterConnectionDistance.addListener(this, &SonificationPanel::onClusterConnectionDistanceChanged);
 
 
+    // adaptive timestep history
+    panel->add<ofxGuiValuePlotter>(this->simParams->deltaTime.set("timestep", 0.01f, 0.0f, 0.02f), ofJson({ {"precision", 4} }));
+
     vacGroup = panel->addGroup("velocity auto-correlation");
   
     // Add VAC control parameters sync with simulator state
     bool initialVACState = simulator ? simulator->isVACEnabled() : true;
-    int initialMaxLags = simulator ? static_cast<int>(simulator->vacData.maxTimeLags) : 120;
+    int initialMaxLags = simulator ? static_cast<int>(simulator->getVACMaxTimeLags()) : 120;
+    int initialVACMode = simulator ? static_cast<int>(simulator->getVACMode()) : static_cast<int>(VACMode::FFT);
     
     vacGroup->add(this->sonParams->enableVACCalculation.set("enable VAC", initialVACState));
     vacGroup->add(this->sonParams->maxTimeLags.set("max time lags", initialMaxLags, 10, 512));
+    vacGroup->add(this->sonParams->vacMode.set("VAC mode\ndirect, fft, multi-tau", initialVACMode, 0, static_cast<int>(VACMode::COUNT) - 1));
     
     // VAC plot area
     ofxGuiContainer* plotContainer = vacGroup->addContainer("VAC Plot",
@@ -41,6 +46,7 @@ void SonificationPanel::setup(ofxGui& gui, SimulationParameters& simParams, Soni
     
     this->sonParams->enableVACCalculation.addListener(this, &SonificationPanel::onVACToggleChanged);
     this->sonParams->maxTimeLags.addListener(this, &SonificationPanel::onMaxTimeLagsChanged);
+    this->sonParams->vacMode.addListener(this, &SonificationPanel::onVACModeChanged);
     
     // Subscribe to draw events to render the plot
     ofAddListener(ofEvents().draw, this, &SonificationPanel::drawVACPlot);
@@ -80,13 +86,15 @@ void SonificationPanel::onVACToggleChanged(bool& value) {
 
 void SonificationPanel::onMaxTimeLagsChanged(int& value) {
     if (simulator) {
-        simulator->vacData.maxTimeLags = std::min(static_cast<uint32_t>(value), simulator->getMaxVelocityFrames());
-        simulator->vacData.vacValues.resize(simulator->vacData.maxTimeLags, 0.0f);
-        simulator->vacData.timePoints.resize(simulator->vacData.maxTimeLags);
-        for (uint32_t i = 0; i < simulator->vacData.maxTimeLags; i++) {
-            simulator->vacData.timePoints[i] = static_cast<float>(i) * 0.01f;
-        }
-        //ofLogNotice("SonificationPanel") << "Max time lags changed to " << simulator->vacData.maxTimeLags;
+        // the analysis thread picks it up with the next particle snapshot
+        simulator->setVACMaxTimeLags(static_cast<uint32_t>(value));
+        //ofLogNotice("SonificationPanel") << "Max time lags changed to " << simulator->getVACMaxTimeLags();
+    }
+}
+
+void SonificationPanel::onVACModeChanged(int& value) {
+    if (simulator) {
+        simulator->setVACMode(static_cast<VACMode>(std::clamp(value, 0, static_cast<int>(VACMode::COUNT) - 1)));
     }
 }
 
@@ -102,7 +110,7 @@ void SonificationPanel::drawVACPlot(ofEventArgs& args) {
     ofRectangle plotArea(panelPos.x + 40, panelPos.y + 140, panelWidth - 50, panelHeight/3);
     
     // Get VAC data from simulator
-    const VACData& vacData = simulator->vacData;
+    const VACData& vacData = simulator->getVACData();
     
     if (vacData.vacValues.empty() || vacData.currentFrame < 2) return;
     sonParams->vacValues = vacData.vacValues;
@@ -167,7 +175,7 @@ void SonificationPanel::drawVACPlot(ofEventArgs& args) {
     ofDrawBitmapString("Velocity Autocorrelation Fn", plotArea.x-15, plotArea.y - 10);
     
     // X-axis 
-    ofDrawBitmapString("Z(t)   /   Time (frames)", plotArea.x + 5, plotArea.getBottom() + 30);
+    ofDrawBitmapString("Z(t)   /   Time (samples)", plotArea.x + 5, plotArea.getBottom() + 30);
     
     ofSetColor(255); // to-do: change for panel style text color
     
@@ -176,7 +184,11 @@ void SonificationPanel::drawVACPlot(ofEventArgs& args) {
         float x = plotArea.x + (i * plotArea.width / 4.0f);
         ofDrawLine(x, plotArea.getBottom() - 3, x, plotArea.getBottom() + 3);
         
-        int timeValue = (this->sonParams->maxTimeLags.get() * i / 4);
+        // the lag under the tick, the multi-tau lags are not evenly spaced (time points are in simulated seconds)
+        uint32_t plottedPoints = std::min(static_cast<uint32_t>(vacData.timePoints.size()),
+                                          static_cast<uint32_t>(this->sonParams->maxTimeLags.get()));
+        uint32_t index = (std::max(plottedPoints, 1u) - 1) * i / 4;
+        int timeValue = index < vacData.timePoints.size() ? static_cast<int>(std::round(vacData.timePoints[index] / VelocityAutocorrelation::SAMPLE_INTERVAL)) : 0;
         ofDrawBitmapString(ofToString(timeValue), x - 10, plotArea.getBottom() + 15);
     }
     
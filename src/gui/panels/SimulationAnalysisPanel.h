@@ -35,6 +35,7 @@ public:
     void setup(ofxGui& gui, SimulationParameters& simParams, SonificationParameters& sonParams, Simulator* sim);
     void onVACToggleChanged(bool& value);
     void onMaxTimeLagsChanged(int& value);
+    void onVACModeChanged(int& value);
     void drawVACPlot(ofEventArgs& args);
 
     void onCollisionLoggingChanged(bool& value);
@@ -20,6 +20,9 @@ class SimulationPanel : public EsenciaPanelBase {
 	const float DEPTH_MIN = -150000.0;
 	const float DEPTH_MAX = 150000.0;
 
+	const int PAIR_POTENTIAL_INIT = 0; // lennard-jones
+	const int PAIR_POTENTIAL_MAX = 3;
+
 	const float SLIDERS_WIDTH = 10;
 	const float SLIDERS_HEIGHT = 70;
 
@@ -34,6 +37,12 @@ public:
 		panel->add(params.applyThermostat.set("apply thermostat", 
 			APPLY_THERMOSTAT));
 
+		panel->add(params.pairPotential.set("pair potential\nlj, wca, soft, gauss",
+			PAIR_POTENTIAL_INIT, 0, PAIR_POTENTIAL_MAX));
+
+		panel->add(params.useCpuSimulation.set("simulate on cpu",
+			params.useCpuSimulation.get()));
+
 		ofxGuiContainer* p = panel->addContainer("" 
 #ifndef DEBUG
 			,ofJson({ {"direction", "vertical"} }) // do not work on debug mode 
@@ -25,10 +25,12 @@ public:
 
 		p->addFpsPlotter(ofJson({ {"width", WIDTH}, {"height", HEIGHT} } ));
 
-		ofSetFrameRate(90);
-
 		systemUsage.setup();
 		p->add<ofxGuiValuePlotter>(cpuUsage.set("% CPU", 0, 0, 100), ofJson({ {"precision", 0} }));
+		p->add<ofxGuiValuePlotter>(params.readbackWaitTime.set("sim wait ms", 0, 0, 20), ofJson({ {"precision", 2} }));
+		p->add<ofxGuiValuePlotter>(params.simulationSteps.set("sim steps/frame", 0, 0, 8), ofJson({ {"precision", 0} }));
+		p->add<ofxGuiValuePlotter>(params.neighbourListRebuildRate.set("nlist rebuilds %", 0, 0, 100), ofJson({ {"precision", 0} }));
+		p->add<ofxGuiValuePlotter>(params.cameraLatency.set("camera latency ms", 0, 0, 100), ofJson({ {"precision", 1} }));
 		ofAddListener(ofEvents().update, this, &SystemstatsPanel::update);
 
 		configVisuals(PANEL_RECT, BG_COLOR);
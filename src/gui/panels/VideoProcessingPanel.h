@@ -47,6 +47,12 @@ public:
 
         params.gaussianBlur.addListener(this, &VideoProcessingPanel::onGaussianblurUpdate);
 
+        cameraProcessingPanel->add(params.useCpuBlur.set("blur on cpu",
+            params.useCpuBlur.get()));
+
+        cameraProcessingPanel->add<ofxGuiValuePlotter>(params.blurTime.set("blur ms", 0, 0, 10),
+            ofJson({ {"precision", 2} }));
+
 
         cameraProcessingPanel->add(params.floodfillHoles.set("floodfill holes", 
             FLOODFILL_HOLES));
@@ -54,6 +60,9 @@ public:
         cameraProcessingPanel->add(params.useMask.set("preserve depth", 
             PRESERVE_DEPTH));
 
+        cameraProcessingPanel->add<ofxGuiValuePlotter>(params.frameAllocations.set("allocations/frame", 0, 0, 50),
+            ofJson({ {"precision", 0} }));
+
 
         // PREVIEW
         ofxGuiGroup* cameraSourcePreview = panel->addGroup("preview");
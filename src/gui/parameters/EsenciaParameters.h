@@ -18,6 +18,7 @@ public:
     ofParameter<float> blobMinArea = 0.05f;
     ofParameter<float> blobMaxArea = 0.8f;
     ofParameter<int> gaussianBlur = 0;
+    ofParameter<bool> useCpuBlur = true; // blur on the camera thread, instead of the gpu on the main thread
     ofParameter<int> nConsidered = 0;
     ofParameter<bool> fillHolesOnPolygons = false;
     ofParameter<bool> floodfillHoles = true;
@@ -41,6 +42,13 @@ public:
     ofImage previewSource;
     ofImage previewBackground;
 
+    // increased by the camera for every new processed frame (segment and previews)
+    // consumers keep the last generation they used and skip their work while it does not change
+    uint64_t frameGeneration = 0;
+
+    ofParameter<float> frameAllocations; // stat, heap allocations of the camera (both threads) for the last frame
+    ofParameter<float> blurTime; // stat, milliseconds of the blur of the last frame (cpu or gpu)
+
 
     CameraParameters() {
         groupName = "camera";
@@ -169,9 +177,16 @@ struct SimulationParameters : public ofxPresetsParametersBase {
     ofParameter<float> coupling;
     ofParameter<float> depthFieldScale;
     ofParameter<bool> applyThermostat;
+    ofParameter<int> pairPotential; // PairPotential: lennard-jones, wca, soft-core, gaussian-core
     ofParameter<glm::vec2> worldSize;
     ofParameter<bool> lowFps;
     ofParameter<bool> enableCollisionLogging = true;
+    ofParameter<bool> useCpuSimulation = false; // local setting, machines without compute shaders
+    ofParameter<float> readbackWaitTime; // stat, milliseconds the step waited for the simulation results
+    ofParameter<float> neighbourListRebuildRate; // stat, % of the steps that rebuilt the cpu neighbour lists
+    ofParameter<float> cameraLatency; // stat, milliseconds from the camera capture of a frame to the simulation taking it
+    ofParameter<float> simulationSteps; // stat, simulation steps run in the last frame
+    ofParameter<float> deltaTime; // stat, length of the last simulation step (adaptive)
 
     SimulationParameters() {
         groupName = "simulation";
@@ -182,6 +197,7 @@ struct SimulationParameters : public ofxPresetsParametersBase {
         parameterMap["coupling"] = &coupling;
         parameterMap["applyThermostat"] = &applyThermostat;
         parameterMap["depthFieldScale"] = &depthFieldScale;
+        parameterMap["pairPotential"] = &pairPotential;
         parameterMap["enableCollisionLogging"] = &enableCollisionLogging;
         //parameterMap["worldSize"] = &worldSize;
         //parameterMap["lowFps"] = &lowFps;
@@ -222,9 +238,14 @@ struct SonificationParameters : public ofxPresetsParametersBase {
     ofParameter<float> collisions;
 
     /// <summary>
-    /// the rate of particles that collided from the maximum amount of collisions beign evaluated. value from 0 to 1
+    /// colliding pairs of the step per particle, over the whole population. value from 0 to 1
     /// </summary>
     ofParameter<float> collisionRate;
+
+    /// <summary>
+    /// average impact speed of the collision events the audio took since its last update
+    /// </summary>
+    ofParameter<float> collisionImpactSpeed;
     
     ofParameter<float> clusters;
 
@@ -256,6 +277,7 @@ struct SonificationParameters : public ofxPresetsParametersBase {
     ofParameter<std::vector<float>> vacValues;
     ofParameter<bool> enableVACCalculation;
     ofParameter<int> maxTimeLags;
+    ofParameter<int> vacMode; // VACMode: direct (newest frame as time origin), fft (all the time origins), multi-tau (streaming, logarithmic lags)
 
 
     // Parameters to save in presets
@@ -270,6 +292,7 @@ struct SonificationParameters : public ofxPresetsParametersBase {
         parameterMap["backgroundVolume"] = &backgroundVolume;
         parameterMap["enableVACCalculation"] = &enableVACCalculation;
         parameterMap["maxTimeLags"] = &maxTimeLags;
+        parameterMap["vacMode"] = &vacMode;
     }
 };
 
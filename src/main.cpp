@@ -39,11 +39,12 @@ int main()
     // ofAddListener(renderApp->viewportResizeEvent, mainApp.get(), &ofApp::onViewportResizeEvent);
 
     // this is the connection between the simulator and the render
-    renderApp->particles = &(mainApp->simulator.particles.active);
+    renderApp->particles = &(mainApp->simulator.getParticles());
     renderApp->simulator = &(mainApp->simulator);
 
     // this is the connection between the simulator and the audio app
-    mainApp->audioApp.collisionData = &(mainApp->simulator.collisionData);
+    mainApp->audioApp.collisionData = &(mainApp->simulator.collisionSummary);
+    mainApp->audioApp.collisionEvents = &(mainApp->simulator.collisionEvents);
 
     // ** note that parameters are not defined and exposed by its system (class) as the oF common way
     //    all params are defined on the GUI class in GUI ofApp, then linked to each system
@@ -5,8 +5,9 @@ void ofApp::setup(){
 
     ofSetWindowTitle("esencia");
 
+    // the simulation has its own fixed step clock (Simulator::simulationSpeed), the frame rate only changes how smooth it looks
     ofSetVerticalSync(false);
-    ofSetFrameRate(30);
+    ofSetFrameRate(90);
 
     gui.setup();
     
@@ -18,8 +19,6 @@ void ofApp::setup(){
     simulator.setup(&gui.simulationParameters, &gui);
     
     gui.setupSonificationAnalysisPanel(&simulator);
-    
-    audioApp.clusterData = &simulator.clusterData;
 }
 //--------------------------------------------------------------
 void ofApp::update(){
@@ -27,10 +26,12 @@ void ofApp::update(){
 
     camera.update();
 
-    simulator.recieveFrame(camera.segment);
+    simulator.recieveFrame(camera.segment, gui.cameraParameters.frameGeneration, camera.getCaptureTime());
 
     simulator.update();
-    
+
+    // the latest analysis results change buffer on every simulator update
+    audioApp.clusterData = &simulator.getClusterData();
     audioApp.update();
 }
 
@@ -17,8 +17,7 @@ ofFbo compositeFbo;
 ofFbo trailFbo;
 
 
-std::vector<glm::vec3> particlePositions;
-std::vector<float> particleSizes;
+std::vector<glm::vec2> particlePositions;
 
 const bool INVEASTERNEGG = false;
 
@@ -79,7 +78,6 @@ void RenderApp::setup()
     
     // allocate memory for particle data
     particlePositions.reserve(10000);
-    particleSizes.reserve(10000);
 
     localSettings = fakeGui.addPanel("local settings for the render app");
     localSettings->setHidden(true);
@@ -148,8 +146,12 @@ void RenderApp::clearFBO(ofFbo& fbo) {
 void RenderApp::update()
 {
     if (parameters->showVideoPreview) {
-        // update the segment image from the camera
-        video.setFromPixels(globalParameters->cameraParameters.previewSegment.getPixels());
+        // update the segment image from the camera, only when it has a new one
+        const uint64_t frameGeneration = globalParameters->cameraParameters.frameGeneration;
+        if (frameGeneration != videoFrameGeneration || !video.isAllocated()) {
+            video.setFromPixels(globalParameters->cameraParameters.previewSegment.getPixels());
+            videoFrameGeneration = frameGeneration;
+        }
         videoRectangle.x = 0;
         videoRectangle.y = ((ofGetWidth() * video.getHeight() / video.getWidth()) - ofGetHeight()) / -2;
         videoRectangle.width = ofGetWidth();
@@ -158,26 +160,27 @@ void RenderApp::update()
         simulator->updateVideoRect(videoRectangle);
     }
 
+    // the published particles change buffer on every simulator update
+    particles = &simulator->getParticles();
     updateParticleSystem();
 }
 
 //--------------------------------------------------------------
 void RenderApp::updateParticleSystem() {
-    if (particles->empty()) return;
+    if (particles->active.empty()) return;
 
-    particlePositions.clear();
-    particleSizes.clear();
+    const ParticleArrays& active = particles->active;
+    particlePositions.resize(active.size());
 
-    // fill with current particle data
-    for (const auto& particle : *particles) {
-        particlePositions.push_back(glm::vec3(particle.position.x, particle.position.y, 0));
-        particleSizes.push_back(particle.radius * 2.0f);
+    // fill with current particle data, the size is the same for all of them (particleSize uniform)
+    // positions are interpolated between the last two simulation steps, as the simulation runs at its own rate
+    for (size_t i = 0; i < active.size(); i++) {
+        particlePositions[i] = particles->getInterpolatedPosition(i);
     }
 
     // update VBO with new data
     particleVbo.clear();
-    particleVbo.setVertexData(&particlePositions[0].x, 3, particlePositions.size(), GL_DYNAMIC_DRAW);
-    particleVbo.setAttributeData(1, &particleSizes[0], 1, particleSizes.size(), GL_DYNAMIC_DRAW);
+    particleVbo.setVertexData(&particlePositions[0].x, 2, particlePositions.size(), GL_DYNAMIC_DRAW);
 }
 
 //--------------------------------------------------------------
@@ -228,7 +231,7 @@ void RenderApp::renderVideoPass() {
 
 //--------------------------------------------------------------
 void RenderApp::renderParticlesPass() {
-    if (particles->empty()) return;
+    if (particles->active.empty()) return;
 
     particlesFbo.begin();
     ofClear(0, 0, 0, 0);
@@ -249,7 +252,7 @@ void RenderApp::renderCompositePass() {
         videoFbo.draw(0, 0);
     }
 
-    if (!particles->empty()) {
+    if (!particles->active.empty()) {
         ofEnableBlendMode(OF_BLENDMODE_ADD);
         ofSetColor(255, 255, 255, 255);
         particlesFbo.draw(0, 0);
@@ -294,7 +297,7 @@ void RenderApp::renderVideoStandard() {
 }
 //--------------------------------------------------------------
 void RenderApp::renderParticlesGPU() {
-    if (particles->empty()) return;
+    if (particles->active.empty()) return;
 
     ofEnableBlendMode(OF_BLENDMODE_ADD);
 
@@ -307,6 +310,7 @@ void RenderApp::renderParticlesGPU() {
         parameters->color.get().g / 255.0f,
         parameters->color.get().b / 255.0f,
         parameters->color.get().a / 255.0f);
+    particleShader.setUniform1f("particleSize", particles->radius * 2.0f);
 
     glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
     glEnable(GL_POINT_SPRITE);
@@ -354,6 +358,7 @@ void RenderApp::updateTrails() {
         parameters->color.get().b / 255.0f,
         parameters->color.get().a / 255.0f);
     trailShader.setUniform1f("fadeFactor", 1.0f);
+    trailShader.setUniform1f("particleSize", particles->radius * 2.0f);
 
     particleVbo.draw(GL_POINTS, 0, particlePositions.size());
 
@@ -401,5 +406,4 @@ void RenderApp::keyReleased(ofKeyEventArgs& e)
 //--------------------------------------------------------------
 void RenderApp::setupParticleBuffers() {
     particlePositions.reserve(10000);
-    particleSizes.reserve(10000);
 }
@@ -43,8 +43,8 @@ class RenderApp : public ofBaseApp
         RenderParameters * parameters;
         GuiApp* globalParameters;
         
-        // This points directly to the simulator particles (through mainapp->simulator.particles in main.cpp)
-        vector<Particle> * particles;
+        // The particles the simulator published last, picked on every update (simulator->getParticles())
+        const ParticleSystem * particles;
 
         Simulator* simulator; 
     
@@ -65,8 +65,10 @@ class RenderApp : public ofBaseApp
         ofShader particleShader;
         ofShader trailShader;
         
-        std::vector<glm::vec3> particlePositions;
-        std::vector<float> particleSizes;
+        std::vector<glm::vec2> particlePositions;
+
+        // camera frame generation of the video image
+        uint64_t videoFrameGeneration = 0;
 
         ofColor particleColor;
         int particleSize;
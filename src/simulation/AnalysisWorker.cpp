@@ -0,0 +1,165 @@
+#include "AnalysisWorker.h"
+
+AnalysisWorker::~AnalysisWorker() {
+    stop();
+}
+
+/// <summary>
+/// Reset the analysis state and start the thread
+/// </summary>
+void AnalysisWorker::setup(uint32_t minClusterSize, uint32_t maxClusters) {
+    stop();
+
+    clusterData.clusterCount = 0;
+    clusterData.frameNumber = 0;
+    clusterData.particleCount = 0;
+    clusterData.minClusterSize = minClusterSize;
+    clusterData.maxClusters = maxClusters;
+    clusterData.clusters.resize(maxClusters);
+
+    velocityAutocorrelation.setup();
+    vacData = VACData(); // Reset VAC data
+
+    AnalysisResults initial;
+    initial.clusterData = clusterData;
+    initial.vacData = vacData;
+    results.reset(initial);
+
+    stopping = false;
+    hasInput = false;
+    velocityFrames.clear();
+    thread = std::thread(&AnalysisWorker::threadLoop, this);
+
+    ofLogNotice("AnalysisWorker::setup") << "Analysis thread started, cluster min size: " << minClusterSize
+        << ", VAC history: " << VelocityAutocorrelation::MAX_FRAMES << " samples";
+}
+
+void AnalysisWorker::stop() {
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    inputReady.notify_one();
+    thread.join();
+}
+
+/// <summary>
+/// Hand the filled input over to the worker, it replaces any cluster input the worker did not start yet
+/// </summary>
+void AnalysisWorker::submit() {
+    inputs.publish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hasInput = true;
+    }
+    inputReady.notify_one();
+}
+
+void AnalysisWorker::submitVelocities(const ParticleArrays& particles, double simulatedTime, VACMode mode, uint32_t calculationInterval, uint32_t maxTimeLags) {
+    VelocityFrame frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!spareVelocities.empty()) {
+            frame.velocities.swap(spareVelocities.back());
+            spareVelocities.pop_back();
+        }
+    }
+
+    // copied outside the lock, the worker only waits for the queue itself
+    frame.velocities.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); i++) {
+        frame.velocities[i] = particles.getVelocity(i);
+    }
+    frame.simulatedTime = simulatedTime;
+    frame.mode = mode;
+    frame.calculationInterval = calculationInterval;
+    frame.maxTimeLags = maxTimeLags;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        velocityFrames.push_back(std::move(frame));
+    }
+    inputReady.notify_one();
+}
+
+void AnalysisWorker::threadLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            inputReady.wait(lock, [this] { return stopping || hasInput || !velocityFrames.empty(); });
+            if (stopping) return;
+            hasInput = false;
+            analyzedFrames.swap(velocityFrames);
+        }
+
+        // every VAC frame in order, then the newest cluster input if there is one
+        for (const VelocityFrame& frame : analyzedFrames) {
+            calculateVAC(frame);
+        }
+        const bool newClusters = inputs.update();
+        if (newClusters) {
+            analyzeParticleClusters(inputs.getReadBuffer());
+        }
+
+        if (!analyzedFrames.empty()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (VelocityFrame& frame : analyzedFrames) {
+                spareVelocities.push_back(std::move(frame.velocities));
+            }
+        }
+        const bool newVAC = !analyzedFrames.empty();
+        analyzedFrames.clear();
+
+        if (newClusters || newVAC) {
+            publishResults();
+        }
+    }
+}
+
+void AnalysisWorker::publishResults() {
+    AnalysisResults& output = results.getWriteBuffer();
+    output.clusterData = clusterData;
+    output.vacData = vacData;
+    results.publish();
+}
+
+/// <summary>
+/// Clusters over all the particles, the largest maxClusters are reported (biggest first)
+/// </summary>
+void AnalysisWorker::analyzeParticleClusters(const AnalysisInput& input) {
+    const uint32_t reported = clusterAnalysis.analyze(input.particles, input.worldSize, input.clusterConnectionDistance,
+        clusterData.minClusterSize, clusterData.maxClusters, clusterData.clusters);
+
+    clusterData.frameNumber = input.frameNumber;
+    clusterData.particleCount = static_cast<uint32_t>(input.particles.size());
+
+    // normalize cluster data
+    for (uint32_t i = 0; i < reported; i++) {
+        ClusterStats& stats = clusterData.clusters[i];
+        stats.frameNumber = input.frameNumber;
+        stats.centerPosition = normalizePosition(stats.centerPosition, input.frameSize);
+        stats.spatialSpread = normalizeDistance(stats.spatialSpread, input.frameSize);
+    }
+
+    clusterData.clusterCount = reported;
+}
+
+void AnalysisWorker::calculateVAC(const VelocityFrame& frame) {
+    // time lags set from the gui
+    vacData.maxTimeLags = std::min(frame.maxTimeLags, VelocityAutocorrelation::MAX_FRAMES);
+    velocityAutocorrelation.add(frame.velocities, frame.simulatedTime, vacData, frame.mode, frame.calculationInterval);
+}
+
+glm::vec2 AnalysisWorker::normalizePosition(const glm::vec2& position, const glm::vec2& size) {
+    // convert world coordinates to normalized -1 to 1 range
+    float normalizedX = (2.0f * position.x / size.x) - 1.0f;
+    float normalizedY = (2.0f * position.y / size.y) - 1.0f;
+    return glm::vec2(normalizedX, normalizedY);
+}
+
+float AnalysisWorker::normalizeDistance(float distance, const glm::vec2& size) {
+    // normalize distance relative to the diagonal of the world space
+    float worldDiagonal = std::sqrt(size.x * size.x + size.y * size.y);
+    return (2.0f * distance / worldDiagonal);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include "ClusterAnalysis.h"
+#include "VelocityAutocorrelation.h"
+#include "TripleBuffer.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// <summary>
+/// What the cluster analysis of a frame needs: a copy of the particles taken at the end of the frame, and the settings at that time
+/// </summary>
+struct AnalysisInput {
+    ParticleArrays particles;
+    glm::vec2 worldSize;
+    glm::vec2 frameSize;    // the normalized positions are relative to it
+    uint32_t frameNumber = 0;
+
+    float clusterConnectionDistance = 50.0f;
+};
+
+/// <summary>
+/// The velocities of a state of the simulation for the VAC, with its simulated time and the settings at that time
+/// </summary>
+struct VelocityFrame {
+    std::vector<glm::vec2> velocities;
+    double simulatedTime = 0.0; // seconds since startup
+    VACMode mode = VACMode::FFT;
+    uint32_t calculationInterval = 5;
+    uint32_t maxTimeLags = 60;
+};
+
+/// <summary>
+/// Latest finished analysis
+/// </summary>
+struct AnalysisResults {
+    ClusterAnalysisData clusterData;
+    VACData vacData;
+};
+
+/// <summary>
+/// Runs the cluster analysis and the velocity auto-correlation on its own thread, off the frame time of the app
+/// The simulator submits a particle snapshot per frame for the clusters and reads the latest results, both through
+/// triple buffers: neither side waits for the other, a slow cluster analysis skips frames instead of slowing the app down
+/// The VAC needs every state in order (a skipped one would be a hole in the velocity series), its frames go through
+/// a queue instead, drained on every wake of the worker; their velocity buffers come back to be reused
+/// </summary>
+class AnalysisWorker {
+public:
+    ~AnalysisWorker();
+
+    void setup(uint32_t minClusterSize, uint32_t maxClusters);
+    void stop();
+
+    // simulation thread (the one running the simulator ticks)
+
+    /// <summary>
+    /// The input to fill for the next cluster analysis, then submit
+    /// </summary>
+    AnalysisInput& getInput() { return inputs.getWriteBuffer(); }
+    void submit();
+
+    /// <summary>
+    /// Queue the velocities of a new state for the VAC, none is ever dropped
+    /// </summary>
+    void submitVelocities(const ParticleArrays& particles, double simulatedTime, VACMode mode, uint32_t calculationInterval, uint32_t maxTimeLags);
+
+    // main thread
+
+    /// <summary>
+    /// Pick the newest results, if the worker finished any since the last call; once per frame, before reading them
+    /// </summary>
+    bool collect() { return results.update(); }
+    const AnalysisResults& getResults() const { return results.getReadBuffer(); }
+
+    // world coordinates to the normalized -1 to 1 range of the audio
+    static glm::vec2 normalizePosition(const glm::vec2& position, const glm::vec2& size);
+    static float normalizeDistance(float distance, const glm::vec2& size);
+
+private:
+    void threadLoop();
+    void analyzeParticleClusters(const AnalysisInput& input);
+    void calculateVAC(const VelocityFrame& frame);
+    void publishResults();
+
+    TripleBuffer<AnalysisInput> inputs;
+    TripleBuffer<AnalysisResults> results;
+
+    // worker thread state, published as a copy on every analysis
+    ClusterAnalysis clusterAnalysis;
+    ClusterAnalysisData clusterData;
+    VACData vacData;
+    VelocityAutocorrelation velocityAutocorrelation;
+
+    // the queue of the VAC frames and the triple buffers' wake up, under mutex
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable inputReady;
+    bool hasInput = false;
+    bool stopping = false;
+    std::vector<VelocityFrame> velocityFrames;          // submitted, oldest first
+    std::vector<std::vector<glm::vec2>> spareVelocities; // buffers of the analyzed frames, for the next ones
+
+    std::vector<VelocityFrame> analyzedFrames; // worker thread, the frames taken from the queue
+};
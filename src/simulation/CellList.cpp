@@ -0,0 +1,47 @@
+#include "CellList.h"
+
+/// <summary>
+/// Size the grid so the cells are at least as large as the cutoff
+/// The gpu binning passes use the same grid
+/// </summary>
+void CellList::setupGrid(glm::vec2 worldSize, float cutoff) {
+    cellSize = std::max({ cutoff, worldSize.x / MAX_GRID_DIMENSION, worldSize.y / MAX_GRID_DIMENSION, 1.0f });
+    invCellSize = 1.0f / cellSize;
+    gridWidth = std::max(1, static_cast<int>(std::ceil(worldSize.x * invCellSize)));
+    gridHeight = std::max(1, static_cast<int>(std::ceil(worldSize.y * invCellSize)));
+}
+
+/// <summary>
+/// Bin the particles into cells with a counting sort: count per cell, prefix sum, scatter
+/// </summary>
+/// <param name="particles">particles to bin</param>
+/// <param name="worldSize">simulation bounds, particles outside are binned on the border cells</param>
+/// <param name="cutoff">interaction distance, the minimum cell size</param>
+void CellList::build(const ParticleArrays& particles, glm::vec2 worldSize, float cutoff) {
+    setupGrid(worldSize, cutoff);
+
+    const size_t count = particles.size();
+    const int cells = getCellCount();
+
+    cellStart.assign(cells + 1, 0);
+    particleCell.resize(count);
+    particleIndices.resize(count);
+
+    // 1. histogram
+    for (size_t i = 0; i < count; i++) {
+        uint32_t cell = cellY(particles.y[i]) * gridWidth + cellX(particles.x[i]);
+        particleCell[i] = cell;
+        cellStart[cell + 1]++;
+    }
+
+    // 2. prefix sum
+    for (int c = 0; c < cells; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+
+    // 3. scatter, using the end of the previous cell as the write cursor
+    scatterCursor.assign(cellStart.begin(), cellStart.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        particleIndices[scatterCursor[particleCell[i]]++] = static_cast<uint32_t>(i);
+    }
+}
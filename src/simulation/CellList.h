@@ -0,0 +1,78 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include <vector>
+
+/// <summary>
+/// Uniform grid binning of the particles (a.k.a. cell list) for the neighbour search
+/// Cells are at least as large as the interaction cutoff, so all the neighbours of a particle are in the 3x3 cells around it
+/// Rebuilt every step with a counting sort; the flat arrays can be uploaded as they are to the gpu
+/// </summary>
+class CellList {
+public:
+    void build(const ParticleArrays& particles, glm::vec2 worldSize, float cutoff);
+    void setupGrid(glm::vec2 worldSize, float cutoff);
+
+    inline int cellX(float x) const { return std::clamp(static_cast<int>(x * invCellSize), 0, gridWidth - 1); }
+    inline int cellY(float y) const { return std::clamp(static_cast<int>(y * invCellSize), 0, gridHeight - 1); }
+
+    int getCellCount() const { return gridWidth * gridHeight; }
+
+    /// <summary>
+    /// Calls fn(begin, end) for the ranges of particleIndices covering the 3x3 cells around the position,
+    /// one range per row, as the cells of a row are contiguous
+    /// </summary>
+    template<typename Function>
+    inline void forEachNeighbourRange(glm::vec2 position, Function fn) const {
+        int cx = cellX(position.x);
+        int cy = cellY(position.y);
+        int y0 = std::max(cy - 1, 0);
+        int y1 = std::min(cy + 1, gridHeight - 1);
+        int x0 = std::max(cx - 1, 0);
+        int x1 = std::min(cx + 1, gridWidth - 1);
+
+        for (int y = y0; y <= y1; y++) {
+            fn(cellStart[y * gridWidth + x0], cellStart[y * gridWidth + x1 + 1]);
+        }
+    }
+
+    /// <summary>
+    /// Calls fn(neighbourIndex) for every particle in the 3x3 cells around the position (including the particle itself)
+    /// </summary>
+    template<typename Function>
+    inline void forEachNeighbour(glm::vec2 position, Function fn) const {
+        forEachNeighbourRange(position, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t k = begin; k < end; k++) {
+                fn(particleIndices[k]);
+            }
+        });
+    }
+
+    int gridWidth = 1;
+    int gridHeight = 1;
+    float cellSize = 1.0f;
+    float invCellSize = 1.0f;
+
+    /// <summary>
+    /// prefix sum of the particle count per cell (cells + 1 items), particles of cell c are [cellStart[c], cellStart[c + 1])
+    /// </summary>
+    std::vector<uint32_t> cellStart;
+
+    /// <summary>
+    /// particle indices sorted by cell
+    /// </summary>
+    std::vector<uint32_t> particleIndices;
+
+    /// <summary>
+    /// cell of each particle, by particle index
+    /// </summary>
+    std::vector<uint32_t> particleCell;
+
+    // keeps the grid small when the cutoff is tiny compared to the world
+    static const int MAX_GRID_DIMENSION = 512;
+
+private:
+    // write position per cell during the scatter, kept to avoid reallocating every step
+    std::vector<uint32_t> scatterCursor;
+};
@@ -0,0 +1,192 @@
+#include "ClusterAnalysis.h"
+
+uint32_t ClusterAnalysis::analyze(const ParticleArrays& particles, glm::vec2 worldSize, float connectionDistance,
+    uint32_t minClusterSize, uint32_t maxClusters, std::vector<ClusterStats>& largest) {
+    const uint32_t count = static_cast<uint32_t>(particles.size());
+    clusterCount = 0;
+    if (count < minClusterSize || count == 0) return 0;
+
+    // cells with a diagonal of the connection distance: all the particles in a cell are connected to each other
+    // (unless the grid had to be coarser, on tiny distances)
+    cells.build(particles, worldSize, connectionDistance * INV_SQRT2);
+    const bool cellsAreConnected = cells.cellSize <= connectionDistance * INV_SQRT2;
+    const int reach = static_cast<int>(std::ceil(connectionDistance * cells.invCellSize));
+
+    sortedX.resize(count);
+    sortedY.resize(count);
+    parent.resize(count);
+    setSize.assign(count, 1);
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t i = cells.particleIndices[k];
+        sortedX[k] = particles.x[i];
+        sortedY[k] = particles.y[i];
+        parent[k] = k;
+    }
+
+    // neighbour cells that can hold a connected pair, only the ones after the cell (each pair of cells once)
+    // nearest first: the far cells of a dense group are usually joined through the near ones by the time they come up
+    neighbourOffsets.clear();
+    const float connectionDistanceSq = connectionDistance * connectionDistance;
+    for (int dy = 0; dy <= reach; dy++) {
+        for (int dx = -reach; dx <= reach; dx++) {
+            if (dy == 0 && dx <= 0) continue;
+            if (getCellGapSq(dx, dy) <= connectionDistanceSq) neighbourOffsets.emplace_back(dx, dy);
+        }
+    }
+    std::stable_sort(neighbourOffsets.begin(), neighbourOffsets.end(), [&](const glm::ivec2& a, const glm::ivec2& b) {
+        return getCellGapSq(a.x, a.y) < getCellGapSq(b.x, b.y);
+    });
+
+    // 1. union of the connected pairs, first within the cells
+    occupiedCells.clear();
+    for (int cy = 0; cy < cells.gridHeight; cy++) {
+        for (int cx = 0; cx < cells.gridWidth; cx++) {
+            const int cell = cy * cells.gridWidth + cx;
+            const uint32_t begin = cells.cellStart[cell];
+            const uint32_t end = cells.cellStart[cell + 1];
+            if (begin == end) continue;
+            occupiedCells.emplace_back(cx, cy);
+
+            if (cellsAreConnected) {
+                for (uint32_t k = begin + 1; k < end; k++) unite(begin, k);
+            }
+            else {
+                for (uint32_t k = begin; k < end; k++) {
+                    for (uint32_t m = k + 1; m < end; m++) {
+                        if (isConnected(k, m, connectionDistanceSq)) unite(k, m);
+                    }
+                }
+            }
+        }
+    }
+
+    // then between the cells, one offset at a time over all the occupied cells
+    for (const glm::ivec2& offset : neighbourOffsets) {
+        for (const glm::ivec2& position : occupiedCells) {
+            const int nx = position.x + offset.x;
+            const int ny = position.y + offset.y;
+            if (nx < 0 || nx >= cells.gridWidth || ny >= cells.gridHeight) continue;
+
+            const int neighbourCell = ny * cells.gridWidth + nx;
+            const uint32_t neighbourBegin = cells.cellStart[neighbourCell];
+            const uint32_t neighbourEnd = cells.cellStart[neighbourCell + 1];
+            if (neighbourBegin == neighbourEnd) continue;
+
+            const int cell = position.y * cells.gridWidth + position.x;
+            const uint32_t begin = cells.cellStart[cell];
+            const uint32_t end = cells.cellStart[cell + 1];
+
+            // whole cells are single sets: once joined, the rest of their pairs cannot change anything
+            if (cellsAreConnected && findRoot(begin) == findRoot(neighbourBegin)) continue;
+
+            bool joined = false;
+            for (uint32_t k = begin; k < end && !joined; k++) {
+                for (uint32_t m = neighbourBegin; m < neighbourEnd; m++) {
+                    if (isConnected(k, m, connectionDistanceSq)) {
+                        unite(k, m);
+                        if (cellsAreConnected) {
+                            joined = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // 2. the sets large enough, the biggest ones are reported
+    rootSlot.resize(count);
+    candidates.clear();
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t root = findRoot(k);
+        rootSlot[k] = root;
+        if (root == k && setSize[k] >= minClusterSize) {
+            candidates.emplace_back(setSize[k], k);
+        }
+    }
+    clusterCount = static_cast<uint32_t>(candidates.size());
+
+    const uint32_t reported = std::min(clusterCount, maxClusters);
+    std::partial_sort(candidates.begin(), candidates.begin() + reported, candidates.end(),
+        [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+
+    clusterOfRoot.assign(count, NO_CLUSTER);
+    if (largest.size() < reported) largest.resize(reported);
+    for (uint32_t c = 0; c < reported; c++) {
+        clusterOfRoot[candidates[c].second] = c;
+        ClusterStats& stats = largest[c];
+        stats.groupIndex = c;
+        stats.particleCount = candidates[c].first;
+        stats.centerPosition = glm::vec2(0.0f);
+        stats.averageVelocity = glm::vec2(0.0f);
+        stats.spatialSpread = 0.0f;
+        stats.velocitySpread = 0.0f;
+    }
+    if (reported == 0) return 0;
+
+    // 3. center and average velocity
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t c = clusterOfRoot[rootSlot[k]];
+        if (c == NO_CLUSTER) continue;
+        uint32_t i = cells.particleIndices[k];
+        largest[c].centerPosition += glm::vec2(sortedX[k], sortedY[k]);
+        largest[c].averageVelocity += particles.getVelocity(i);
+    }
+    for (uint32_t c = 0; c < reported; c++) {
+        largest[c].centerPosition /= static_cast<float>(largest[c].particleCount);
+        largest[c].averageVelocity /= static_cast<float>(largest[c].particleCount);
+    }
+
+    // 4. spreads around them (standard deviations)
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t c = clusterOfRoot[rootSlot[k]];
+        if (c == NO_CLUSTER) continue;
+        uint32_t i = cells.particleIndices[k];
+        glm::vec2 positionDiff = glm::vec2(sortedX[k], sortedY[k]) - largest[c].centerPosition;
+        glm::vec2 velocityDiff = particles.getVelocity(i) - largest[c].averageVelocity;
+        largest[c].spatialSpread += glm::dot(positionDiff, positionDiff);
+        largest[c].velocitySpread += glm::dot(velocityDiff, velocityDiff);
+    }
+    for (uint32_t c = 0; c < reported; c++) {
+        largest[c].spatialSpread = std::sqrt(largest[c].spatialSpread / static_cast<float>(largest[c].particleCount));
+        largest[c].velocitySpread = std::sqrt(largest[c].velocitySpread / static_cast<float>(largest[c].particleCount));
+    }
+
+    return reported;
+}
+
+/// <summary>
+/// Squared shortest distance between the points of two cells dx, dy cells apart
+/// </summary>
+float ClusterAnalysis::getCellGapSq(int dx, int dy) const {
+    float gapX = std::max(std::abs(dx) - 1, 0) * cells.cellSize;
+    float gapY = std::max(std::abs(dy) - 1, 0) * cells.cellSize;
+    return gapX * gapX + gapY * gapY;
+}
+
+bool ClusterAnalysis::isConnected(uint32_t a, uint32_t b, float connectionDistanceSq) const {
+    float dx = sortedX[b] - sortedX[a];
+    float dy = sortedY[b] - sortedY[a];
+    return dx * dx + dy * dy <= connectionDistanceSq;
+}
+
+uint32_t ClusterAnalysis::findRoot(uint32_t slot) {
+    while (parent[slot] != slot) {
+        parent[slot] = parent[parent[slot]]; // path halving
+        slot = parent[slot];
+    }
+    return slot;
+}
+
+void ClusterAnalysis::unite(uint32_t a, uint32_t b) {
+    uint32_t rootA = findRoot(a);
+    uint32_t rootB = findRoot(b);
+    if (rootA == rootB) return;
+
+    // the smaller set goes under the larger one, the trees stay shallow
+    if (setSize[rootA] < setSize[rootB]) std::swap(rootA, rootB);
+    parent[rootB] = rootA;
+    setSize[rootA] += setSize[rootB];
+}
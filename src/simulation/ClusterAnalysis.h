@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include "CellList.h"
+#include <vector>
+
+// Cluster analysis structures
+struct ClusterStats {
+    uint32_t groupIndex;           // Unique cluster ID
+    uint32_t particleCount;        // Number of particles in cluster
+    glm::vec2 centerPosition;      // Spatial center of cluster
+    float spatialSpread;           // Standard deviation of particle positions
+    glm::vec2 averageVelocity;     // Average velocity of cluster
+    float velocitySpread;          // Standard deviation of velocities
+    uint32_t frameNumber;          // Frame when this cluster was detected
+};
+
+struct ClusterAnalysisData {
+    uint32_t clusterCount;         // Number of clusters found
+    uint32_t frameNumber;          // Current frame number
+    uint32_t minClusterSize;       // Minimum particles to consider a cluster
+    uint32_t maxClusters;          // Maximum number of clusters we can store
+    uint32_t particleCount;        // Particles the analysis ran over (all the active ones)
+    std::vector<ClusterStats> clusters;
+};
+
+/// <summary>
+/// Groups of particles chained by pairs closer than a connection distance, over all the active particles
+/// The particles are binned on a grid with cells of a connection distance diagonal, so the particles of a cell are all
+/// connected and only the cells around it have to be compared; the sets are kept by a union-find (by size, with path halving)
+/// on flat arrays in the cell order. Two neighbour cells already in the same set are skipped without looking at their pairs,
+/// which makes the dense groups, the costly ones for a pairwise search, the cheapest
+/// </summary>
+class ClusterAnalysis {
+public:
+    /// <summary>
+    /// Find the clusters of at least minClusterSize particles and write the statistics of the largest ones, biggest first
+    /// Positions and spreads are in world units
+    /// </summary>
+    /// <returns>number of stats written, at most maxClusters</returns>
+    uint32_t analyze(const ParticleArrays& particles, glm::vec2 worldSize, float connectionDistance,
+        uint32_t minClusterSize, uint32_t maxClusters, std::vector<ClusterStats>& largest);
+
+    /// <summary>
+    /// Clusters of the minimum size found by the last analysis, including the ones beyond maxClusters
+    /// </summary>
+    uint32_t getClusterCount() const { return clusterCount; }
+
+private:
+    float getCellGapSq(int dx, int dy) const;
+    bool isConnected(uint32_t a, uint32_t b, float connectionDistanceSq) const;
+    uint32_t findRoot(uint32_t slot);
+    void unite(uint32_t a, uint32_t b);
+
+    CellList cells;
+    std::vector<glm::ivec2> neighbourOffsets;
+    std::vector<glm::ivec2> occupiedCells;
+
+    // by slot of the cell order (CellList::particleIndices)
+    std::vector<float> sortedX;
+    std::vector<float> sortedY;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> setSize; // particles in the set, valid at the roots
+    std::vector<uint32_t> rootSlot;
+
+    // output index of each root, NO_CLUSTER for the sets not reported
+    std::vector<uint32_t> clusterOfRoot;
+    std::vector<std::pair<uint32_t, uint32_t>> candidates; // (size, root)
+
+    uint32_t clusterCount = 0;
+
+    static constexpr uint32_t NO_CLUSTER = UINT32_MAX;
+    static constexpr float INV_SQRT2 = 0.70710678f;
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "ofMain.h"
+#include "EventRing.h"
+
+/// <summary>
+/// A single collision, as handed from the simulator to the audio: one per sampled collision record of a step
+/// </summary>
+struct CollisionEvent {
+    uint32_t particleA;
+    uint32_t particleB;
+    glm::vec2 position;     // middle point of the pair, normalized to the frame like the other analysis positions
+    float impactSpeed;      // relative speed of the two particles
+    uint32_t frameNumber;   // simulator frame that published it
+    float time;             // seconds since startup when it was published
+};
+
+/// <summary>
+/// Collision events from the simulator (writer) to the audio (reader)
+/// A few frames of sampled records (Simulator::MAX_COLLISIONS_PER_FRAME per frame) fit before events get dropped
+/// </summary>
+using CollisionEventRing = EventRing<CollisionEvent, 1024>;
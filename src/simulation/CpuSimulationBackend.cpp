@@ -0,0 +1,256 @@
+#include "CpuSimulationBackend.h"
+
+bool CpuSimulationBackend::setup(const ParticleSystem& particles, size_t maxCollisions) {
+    this->maxCollisions = maxCollisions;
+    threadCollisions.resize(workers.size());
+    threadStats.resize(workers.size());
+    pairKernel = PairForceKernel::select();
+    pairGatherKernel = PairForceKernel::selectGather();
+
+    ofLogNotice("CpuSimulationBackend::setup") << "CPU simulation running on " << workers.size() << " threads, " << PairForceKernel::getName() << " force kernel";
+    return true;
+}
+
+void CpuSimulationBackend::uploadParticles(const ParticleSystem& particles) {
+    // the step reads directly from the particle system, only the neighbour lists are out of date
+    neighbourList.invalidate();
+}
+
+void CpuSimulationBackend::updateDepthField(const unsigned char* pixels, int frameWidth, int frameHeight) {
+    depthField.update(pixels, frameWidth, frameHeight);
+}
+
+void CpuSimulationBackend::step(ParticleSystem& particles, const SimulationStepParameters& params, CollisionBuffer& collisions) {
+    // ping-pong: the last state becomes the read only input and particles.active is fully rewritten,
+    // so every particle sees the same neighbours no matter which thread runs first
+    particles.keepPreviousPositions();
+    particles.stateTime += params.deltaTime;
+    previous.swap(particles.active);
+    particles.active.resize(previous.size());
+    output = &particles.active;
+    radius = particles.radius;
+    mass = particles.mass;
+    worldSize = params.worldSize;
+
+    // with neighbour lists the cells (and so the particle order) are only rebuilt with the lists
+    useNeighbourList = params.neighbourSkin > 0.0f;
+    bool rebuildCells = !useNeighbourList || !neighbourList.matches(previous.size(), params.cutoff, params.neighbourSkin);
+    if (!rebuildCells) {
+        gatherSortedPositions();
+        rebuildCells = neighbourList.hasMovedTooFar(sortedX, sortedY, params.neighbourSkin);
+    }
+
+    if (rebuildCells) {
+        float range = useNeighbourList ? params.cutoff + params.neighbourSkin : params.cutoff;
+        cells.build(previous, params.worldSize, range);
+        gatherSortedPositions();
+
+        if (useNeighbourList) {
+            neighbourList.build(sortedX, sortedY, cells, params.cutoff, params.neighbourSkin, workers);
+        }
+        else {
+            neighbourList.invalidate();
+        }
+    }
+
+    for (auto& c : threadCollisions) {
+        c.summary = {};
+        c.samples.clear();
+    }
+    if (params.enableCollisionLogging) {
+        const size_t blocks = (previous.size() + COLLISION_SAMPLE_BLOCK - 1) / COLLISION_SAMPLE_BLOCK;
+        if (blockSamples.size() != blocks) {
+            blockSamples = std::vector<std::atomic<uint32_t>>(blocks);
+        }
+        for (auto& samples : blockSamples) {
+            samples.store(0, std::memory_order_relaxed);
+        }
+    }
+    for (auto& s : threadStats) {
+        s = SimulationStepStats();
+    }
+
+    workers.parallelFor(previous.size(), [&](size_t begin, size_t end, size_t workerIndex) {
+        stepRange(begin, end, workerIndex, params);
+    });
+
+    stepStats = SimulationStepStats();
+    for (const auto& s : threadStats) {
+        stepStats.maxAcceleration = std::max(stepStats.maxAcceleration, s.maxAcceleration);
+        stepStats.maxVelocity = std::max(stepStats.maxVelocity, s.maxVelocity);
+    }
+
+    if (params.enableCollisionLogging) {
+        // same summary as the gpu buffer: sampleCount counts all the sampled records, even the ones that didnt fit
+        CollisionSummary& summary = collisions;
+        summary = {};
+        summary.maxCollisions = static_cast<uint32_t>(maxCollisions);
+        summary.frameNumber = params.frameNumber;
+        for (const auto& thread : threadCollisions) {
+            summary.collisionCount += thread.summary.collisionCount;
+            for (uint32_t b = 0; b < COLLISION_SPEED_BINS; b++) {
+                summary.speedHistogram[b] += thread.summary.speedHistogram[b];
+            }
+            for (uint32_t r = 0; r < COLLISION_REGIONS * COLLISION_REGIONS; r++) {
+                summary.regionCounts[r] += thread.summary.regionCounts[r];
+            }
+            for (const auto& c : thread.samples) {
+                if (summary.sampleCount < collisions.collisions.size()) {
+                    collisions.collisions[summary.sampleCount] = c;
+                }
+                summary.sampleCount++;
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Copy the positions of the previous state in cell order
+/// </summary>
+void CpuSimulationBackend::gatherSortedPositions() {
+    sortedX.resize(previous.size());
+    sortedY.resize(previous.size());
+    for (size_t k = 0; k < previous.size(); k++) {
+        uint32_t i = cells.particleIndices[k];
+        sortedX[k] = previous.x[i];
+        sortedY[k] = previous.y[i];
+    }
+}
+
+/// <summary>
+/// Count the collisions of a particle with the neighbours at later slots (so each pair once, as the shader does),
+/// given as the entries begin..end of a list of slots, or as the slots begin..end when neighbours is null
+/// The first COLLISION_SAMPLES_PER_GROUP of every block of slots are also kept as records
+/// </summary>
+void CpuSimulationBackend::countCollisions(size_t slot, glm::vec2 position, glm::vec2 velocity, const uint32_t* neighbours, size_t begin, size_t end, float collisionDistSq, size_t workerIndex) {
+    ThreadCollisions& thread = threadCollisions[workerIndex];
+
+    for (size_t k = begin; k < end; k++) {
+        const size_t neighbourSlot = neighbours ? neighbours[k] : k;
+        if (neighbourSlot <= slot) continue;
+
+        const glm::vec2 otherPosition(sortedX[neighbourSlot], sortedY[neighbourSlot]);
+        const glm::vec2 diff = position - otherPosition;
+        const float distSq = glm::dot(diff, diff);
+        if (distSq <= 0.0f || distSq > collisionDistSq) continue;
+
+        const uint32_t other = cells.particleIndices[neighbourSlot];
+        const float impactSpeed = glm::length(velocity - previous.getVelocity(other));
+        thread.summary.collisionCount++;
+        thread.summary.speedHistogram[getCollisionSpeedBin(impactSpeed)]++;
+        thread.summary.regionCounts[getCollisionRegion((position + otherPosition) * 0.5f, worldSize)]++;
+
+        // the count only goes past the limit by the threads that lost the race, none of them keeps a record
+        std::atomic<uint32_t>& samples = blockSamples[slot / COLLISION_SAMPLE_BLOCK];
+        if (samples.load(std::memory_order_relaxed) < COLLISION_SAMPLES_PER_GROUP &&
+            samples.fetch_add(1, std::memory_order_relaxed) < COLLISION_SAMPLES_PER_GROUP) {
+
+            CollisionData c;
+            c.particleA = cells.particleIndices[slot];
+            c.particleB = other;
+            c.positionA = position;
+            c.positionB = otherPosition;
+            c.distance = std::sqrt(distSq);
+            c.velocityMagnitude = glm::length(velocity);
+            c.valid = 1;
+            c.impactSpeed = impactSpeed;
+            thread.samples.push_back(c);
+        }
+    }
+}
+
+void CpuSimulationBackend::stepRange(size_t begin, size_t end, size_t workerIndex, const SimulationStepParameters& params) {
+    const float cutoff = params.cutoff;
+    const float collisionDist = (radius + radius) * 1.1f; // Allow a small margin for numerical stability
+    const float collisionDistSq = std::min(collisionDist, cutoff) * std::min(collisionDist, cutoff);
+    const PairForceKernelParameters kernelParams = { params.pairPotential->getForceTable(), params.pairPotential->getScale(), cutoff };
+    const float damping = std::pow(0.99f, params.stepScale);
+    float maxAccelerationSq = 0.0f;
+    float maxVelocitySq = 0.0f;
+
+    // particles are visited in cell order, so consecutive particles share most of their neighbours in cache
+    for (size_t slot = begin; slot < end; slot++) {
+        size_t index = cells.particleIndices[slot];
+        glm::vec2 position = previous.getPosition(index);
+        glm::vec2 velocity = previous.getVelocity(index);
+        glm::vec2 totalPairForce(0.0f);
+
+        // Interaction loop, over the neighbour list of the particle, or else the 3x3 cells around it,
+        // one contiguous range per cell row (the particle itself is in the range, at distance 0 it adds no force)
+        if (useNeighbourList) {
+            const uint32_t* neighbours = neighbourList.getNeighbours(slot);
+            size_t neighbourCount = neighbourList.getNeighbourCount(slot);
+            totalPairForce = pairGatherKernel(position.x, position.y, sortedX.data(), sortedY.data(), neighbours, neighbourCount, kernelParams);
+        }
+        else {
+            cells.forEachNeighbourRange(position, [&](uint32_t rangeBegin, uint32_t rangeEnd) {
+                totalPairForce += pairKernel(position.x, position.y, &sortedX[rangeBegin], &sortedY[rangeBegin], rangeEnd - rangeBegin, kernelParams);
+            });
+        }
+
+        // Collisions of all the particles, each pair once
+        if (params.enableCollisionLogging) {
+            if (useNeighbourList) {
+                countCollisions(slot, position, velocity, neighbourList.getNeighbours(slot), 0, neighbourList.getNeighbourCount(slot), collisionDistSq, workerIndex);
+            }
+            else {
+                cells.forEachNeighbourRange(position, [&](uint32_t rangeBegin, uint32_t rangeEnd) {
+                    countCollisions(slot, position, velocity, nullptr, std::max<size_t>(rangeBegin, slot + 1), rangeEnd, collisionDistSq, workerIndex);
+                });
+            }
+        }
+
+        // Apply pair forces to acceleration
+        glm::vec2 acceleration = totalPairForce / mass;
+
+        // Depth-based gradient, precomputed once per camera frame
+        glm::vec2 depthForce(0.0f);
+        if (params.depthFieldScale != 0.0f) {
+            glm::vec2 adjustedPos = (position - params.videoOffset) / params.videoScale;
+            glm::vec2 texCoord = glm::clamp(adjustedPos / params.sourceSize, glm::vec2(0.0f), glm::vec2(1.0f));
+
+            depthForce = (params.depthFieldScale * 3.0f) * depthField.sampleGradient(texCoord) * params.videoScale;
+        }
+
+        // Combine all forces (the pair term is added twice, as in the shader)
+        glm::vec2 totalForce = depthForce + totalPairForce;
+        acceleration += totalForce / mass;
+
+        // Update velocity with damping
+        velocity = velocity * damping + acceleration * params.deltaTime;
+
+        // Apply thermostat
+        if (params.applyThermostat) {
+            float kineticEnergy = 0.5f * mass * glm::dot(velocity, velocity);
+            float currentTemperature = kineticEnergy / 3.0f;
+            float scaleFactor = std::sqrt(params.targetTemperature / (params.coupling * currentTemperature));
+            scaleFactor = std::pow(ofClamp(scaleFactor, 0.95f, 1.05f), params.stepScale);
+            velocity *= scaleFactor;
+        }
+
+        // Update position
+        position += velocity * params.deltaTime;
+
+        // Boundary conditions
+        if (position.x < 0.0f || position.x > params.worldSize.x) {
+            velocity.x *= -0.9f;
+            position.x = ofClamp(position.x, 0.0f, params.worldSize.x);
+        }
+        if (position.y < 0.0f || position.y > params.worldSize.y) {
+            velocity.y *= -0.9f;
+            position.y = ofClamp(position.y, 0.0f, params.worldSize.y);
+        }
+
+        maxAccelerationSq = std::max(maxAccelerationSq, glm::dot(acceleration, acceleration));
+        maxVelocitySq = std::max(maxVelocitySq, glm::dot(velocity, velocity));
+
+        output->x[index] = position.x;
+        output->y[index] = position.y;
+        output->vx[index] = velocity.x;
+        output->vy[index] = velocity.y;
+    }
+
+    SimulationStepStats& stats = threadStats[workerIndex];
+    stats.maxAcceleration = std::max(stats.maxAcceleration, std::sqrt(maxAccelerationSq));
+    stats.maxVelocity = std::max(stats.maxVelocity, std::sqrt(maxVelocitySq));
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ofMain.h"
+#include "SimulationBackend.h"
+#include "WorkerPool.h"
+#include "CellList.h"
+#include "PairForceKernel.h"
+#include "NeighbourList.h"
+#include "DepthField.h"
+#include <atomic>
+
+/// <summary>
+/// Physics step on the CPU, spread over all the cores
+/// Mirrors particlesComputeShader.glsl (pair potential + depth gradient + thermostat + boundaries) without any GL call,
+/// so it can run on machines without a GPU able to run compute shaders
+/// </summary>
+class CpuSimulationBackend : public SimulationBackend {
+public:
+    bool setup(const ParticleSystem& particles, size_t maxCollisions) override;
+    void uploadParticles(const ParticleSystem& particles) override;
+    void updateDepthField(const unsigned char* pixels, int width, int height) override;
+    void step(ParticleSystem& particles, const SimulationStepParameters& params, CollisionBuffer& collisions) override;
+    std::string getName() const override { return "cpu"; }
+    uint32_t getNeighbourListRebuilds() const override { return neighbourList.getRebuildCount(); }
+    SimulationStepStats getStepStats() const override { return stepStats; }
+
+private:
+    void stepRange(size_t begin, size_t end, size_t workerIndex, const SimulationStepParameters& params);
+    void gatherSortedPositions();
+    void countCollisions(size_t slot, glm::vec2 position, glm::vec2 velocity, const uint32_t* neighbours, size_t begin, size_t end, float collisionDistSq, size_t workerIndex);
+
+    WorkerPool workers;
+
+    // the state before the step; neighbours are read from here while the new state is written on particles.active
+    ParticleArrays previous;
+    ParticleArrays* output = nullptr;
+    float radius = 2.0f;
+    float mass = 5.0f;
+    glm::vec2 worldSize;
+
+    // neighbour search grid, built from the previous state
+    // (with the neighbour lists, only when the lists are rebuilt, with cells of cutoff + skin)
+    CellList cells;
+
+    // verlet lists, used while params.neighbourSkin > 0
+    NeighbourList neighbourList;
+    bool useNeighbourList = false;
+
+    // positions of the previous state in cell order, so the neighbours of a cell row are contiguous for the SIMD kernel
+    // (and close in memory for the neighbour lists)
+    ParticleArray sortedX;
+    ParticleArray sortedY;
+
+    // widest pair force kernel the cpu supports
+    PairForceKernelFunction pairKernel = &PairForceKernel::scalar;
+    PairForceGatherKernelFunction pairGatherKernel = &PairForceKernel::scalarGather;
+
+    // per thread collision summary and sampled records, merged after the step
+    struct ThreadCollisions {
+        CollisionSummary summary;
+        std::vector<CollisionData> samples;
+    };
+    std::vector<ThreadCollisions> threadCollisions;
+
+    // records taken from each block of slots in this step, shared by the threads: the chunks of parallelFor do not
+    // follow the blocks, a block split between two chunks still keeps COLLISION_SAMPLES_PER_GROUP at most
+    std::vector<std::atomic<uint32_t>> blockSamples;
+
+    // slots per sampled block, the workgroup size of particlesComputeShader.glsl
+    static constexpr size_t COLLISION_SAMPLE_BLOCK = 512;
+
+    // per thread extremes, merged after the step
+    std::vector<SimulationStepStats> threadStats;
+    SimulationStepStats stepStats;
+    size_t maxCollisions = 0;
+
+    // gradient of the depth field, updated at camera rate
+    DepthField depthField;
+};
@@ -0,0 +1,77 @@
+#include "DepthField.h"
+
+void DepthField::update(const unsigned char* pixels, int frameWidth, int frameHeight) {
+    width = frameWidth;
+    height = frameHeight;
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    gradient.resize(width * height);
+    occupiedTiles.assign(tilesX * tilesY, 0);
+
+    // depth is 1 - p / 255, so its differences are the pixel differences negated and scaled
+    const float scale = 0.5f * INV255;
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* row = pixels + y * width;
+        const unsigned char* up = pixels + std::max(y - 1, 0) * width;
+        const unsigned char* down = pixels + std::min(y + 1, height - 1) * width;
+        glm::vec2* out = &gradient[y * width];
+
+        for (int x = 0; x < width; x++) {
+            int left = row[std::max(x - 1, 0)];
+            int right = row[std::min(x + 1, width - 1)];
+            out[x] = glm::vec2(left - right, up[x] - down[x]) * scale;
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        const glm::vec2* row = &gradient[y * width];
+        for (int x = 0; x < width; x++) {
+            if (row[x].x != 0.0f || row[x].y != 0.0f) markTiles(x, y);
+        }
+    }
+}
+
+/// <summary>
+/// The bilinear samples up to one texel away read this texel too, so the tiles of its neighbours are flagged as well
+/// (the tiles of the four diagonal neighbours cover the whole 3x3)
+/// </summary>
+void DepthField::markTiles(int x, int y) {
+    int x0 = std::max(x - 1, 0) / TILE_SIZE;
+    int x1 = std::min(x + 1, width - 1) / TILE_SIZE;
+    int y0 = std::max(y - 1, 0) / TILE_SIZE;
+    int y1 = std::min(y + 1, height - 1) / TILE_SIZE;
+
+    occupiedTiles[y0 * tilesX + x0] = 1;
+    occupiedTiles[y0 * tilesX + x1] = 1;
+    occupiedTiles[y1 * tilesX + x0] = 1;
+    occupiedTiles[y1 * tilesX + x1] = 1;
+}
+
+glm::vec2 DepthField::sampleGradient(glm::vec2 texCoord) const {
+    if (gradient.empty()) return glm::vec2(0.0f);
+
+    // the texel under the sample decides, the four texels the sample mixes are its neighbours
+    int cx = std::clamp(static_cast<int>(texCoord.x * width), 0, width - 1);
+    int cy = std::clamp(static_cast<int>(texCoord.y * height), 0, height - 1);
+    if (!occupiedTiles[(cy / TILE_SIZE) * tilesX + cx / TILE_SIZE]) return glm::vec2(0.0f);
+
+    float x = texCoord.x * width - 0.5f;
+    float y = texCoord.y * height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    int x0 = std::clamp((int)fx, 0, width - 1);
+    int x1 = std::clamp((int)fx + 1, 0, width - 1);
+    int y0 = std::clamp((int)fy, 0, height - 1);
+    int y1 = std::clamp((int)fy + 1, 0, height - 1);
+
+    const glm::vec2* row0 = &gradient[y0 * width];
+    const glm::vec2* row1 = &gradient[y1 * width];
+
+    glm::vec2 top = row0[x0] + (row0[x1] - row0[x0]) * tx;
+    glm::vec2 bottom = row1[x0] + (row1[x1] - row1[x0]) * tx;
+    return top + (bottom - top) * ty;
+}
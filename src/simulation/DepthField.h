@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ofMain.h"
+#include <vector>
+
+/// <summary>
+/// Gradient of the depth field for the cpu simulation, computed once per camera frame instead of on every particle step
+/// Same values the gpu keeps in its gradient texture (depthGradientShader.glsl): central differences of the
+/// normalized and inverted depth, where white is near
+/// A coarse bitmap of tiles tells where the gradient is zero, particles over those tiles skip the sampling
+/// </summary>
+class DepthField {
+public:
+    /// <summary>
+    /// Receive a new camera frame, 8 bits per pixel
+    /// </summary>
+    void update(const unsigned char* pixels, int width, int height);
+
+    /// <summary>
+    /// Bilinear sample with clamp to edge, as the GL_LINEAR / GL_CLAMP_TO_EDGE texture on the gpu path
+    /// </summary>
+    /// <param name="texCoord">normalized texture coordinates [0..1]</param>
+    glm::vec2 sampleGradient(glm::vec2 texCoord) const;
+
+    // texels per side of the occupancy tiles, the workgroup size of the gpu gradient pass
+    static const int TILE_SIZE = 16;
+
+private:
+    void markTiles(int x, int y);
+
+    std::vector<glm::vec2> gradient;
+    std::vector<uint8_t> occupiedTiles;
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+
+    const float INV255 = 1.0f / 255.0f;
+};
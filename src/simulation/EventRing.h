@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// Lock-free queue of events from one writer thread to one reader thread, on a fixed ring of Capacity slots
+/// The writer pushes events as they happen and the reader drains them at its own pace; neither ever waits for the other
+/// Each side only writes its own index, so a push and a pop never touch the same slot at the same time
+/// When the reader falls behind and the ring is full, new events are dropped (and counted) instead of overwriting unread ones
+/// </summary>
+template<typename T, size_t Capacity>
+class EventRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "EventRing capacity must be a power of two");
+
+public:
+    // writer side
+
+    /// <summary>
+    /// Add an event
+    /// </summary>
+    /// <returns>false if the ring is full and the event was dropped</returns>
+    bool push(const T& event) {
+        const size_t write = writeIndex.load(std::memory_order_relaxed);
+        if (write - readIndex.load(std::memory_order_acquire) == Capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[write & MASK] = event;
+        writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // reader side
+
+    /// <summary>
+    /// Take the oldest event not read yet
+    /// </summary>
+    /// <returns>false if there is none</returns>
+    bool pop(T& event) {
+        const size_t read = readIndex.load(std::memory_order_relaxed);
+        if (read == writeIndex.load(std::memory_order_acquire)) return false;
+        event = slots[read & MASK];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// <summary>
+    /// Events waiting to be read, only exact on the reader thread
+    /// </summary>
+    size_t size() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Events the writer dropped because the ring was full, since startup
+    /// </summary>
+    uint64_t getDroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+    static constexpr size_t getCapacity() { return Capacity; }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+
+    T slots[Capacity];
+
+    // free running counters, the slot is the counter modulo Capacity
+    // (on their own cache lines, so the two threads do not invalidate each other on every event)
+    alignas(64) std::atomic<size_t> writeIndex{ 0 };
+    alignas(64) std::atomic<size_t> readIndex{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+};
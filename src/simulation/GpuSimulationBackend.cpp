@@ -0,0 +1,660 @@
+#include "GpuSimulationBackend.h"
+
+GpuSimulationBackend::~GpuSimulationBackend() {
+    if (computeShaderProgram != 0) glDeleteProgram(computeShaderProgram);
+    if (ssboParticles[0] != 0) glDeleteBuffers(2, ssboParticles);
+    if (ssboCollisions != 0) glDeleteBuffers(1, &ssboCollisions);
+    if (depthFieldTexture != 0) glDeleteTextures(1, &depthFieldTexture);
+    if (depthGradientTexture != 0) glDeleteTextures(1, &depthGradientTexture);
+    if (ssboDepthOccupancy != 0) glDeleteBuffers(1, &ssboDepthOccupancy);
+    if (depthUploadBuffer != 0) glDeleteBuffers(1, &depthUploadBuffer);
+    if (depthGradientShaderProgram != 0) glDeleteProgram(depthGradientShaderProgram);
+    if (ssboCellStart != 0) glDeleteBuffers(1, &ssboCellStart);
+    if (ssboCellParticles != 0) glDeleteBuffers(1, &ssboCellParticles);
+    if (ssboSortedParticles != 0) glDeleteBuffers(1, &ssboSortedParticles);
+    if (ssboParticleBins != 0) glDeleteBuffers(1, &ssboParticleBins);
+    if (ssboStepStats != 0) glDeleteBuffers(1, &ssboStepStats);
+    if (ssboPairForceTable != 0) glDeleteBuffers(1, &ssboPairForceTable);
+    if (histogramShaderProgram != 0) glDeleteProgram(histogramShaderProgram);
+    if (scanShaderProgram != 0) glDeleteProgram(scanShaderProgram);
+    if (scatterShaderProgram != 0) glDeleteProgram(scatterShaderProgram);
+
+    for (auto& slot : readbackSlots) {
+        if (slot.fence != nullptr) glDeleteSync(slot.fence);
+        if (slot.buffer != 0) glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+bool GpuSimulationBackend::setup(const ParticleSystem& particles, size_t maxCollisions) {
+    if (!GLEW_ARB_compute_shader) {
+        ofLogWarning("GpuSimulationBackend::setup") << "Compute shaders are not supported by the current GL context";
+        return false;
+    }
+
+    this->maxCollisions = maxCollisions;
+    dispatchedTime = particles.stateTime; // the clock goes on from the backend before
+
+    if (!setupComputeShader()) return false;
+    if (!setupBinningShaders()) return false;
+
+    depthGradientShaderProgram = loadComputeShader("shaders/depthGradientShader.glsl");
+    if (depthGradientShaderProgram == 0) return false;
+
+    setupCollisionBuffer();
+
+    // without persistent mapping (GL 4.4) the results are read back synchronously
+    useAsyncReadback = GLEW_ARB_buffer_storage;
+    if (!useAsyncReadback) {
+        ofLogNotice("GpuSimulationBackend::setup") << "Persistent buffer mapping not supported, particles are read back synchronously";
+    }
+    setupDepthFieldTexture();
+
+    // Create the cell list buffers, sized on upload and on binning
+    glGenBuffers(1, &ssboCellStart);
+    glGenBuffers(1, &ssboCellParticles);
+    glGenBuffers(1, &ssboSortedParticles);
+    glGenBuffers(1, &ssboParticleBins);
+
+    // two uints, the float bits of the max acceleration and velocity of the step
+    glGenBuffers(1, &ssboStepStats);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboStepStats);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // filled on the first step, and again whenever the simulator rebuilds the table
+    glGenBuffers(1, &ssboPairForceTable);
+
+    // Create and initialize the SSBOs
+    glGenBuffers(2, ssboParticles);
+    uploadParticles(particles);
+
+    return true;
+}
+
+/// <summary>
+/// Compile and link a compute shader from the data folder
+/// </summary>
+/// <returns>the program, or 0 if it failed</returns>
+GLuint GpuSimulationBackend::loadComputeShader(const std::string& path) {
+    GLuint program = glCreateProgram();
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+
+    std::string shaderCode = ofBufferFromFile(path).getText();
+    const char* shaderSource = shaderCode.c_str();
+    glShaderSource(computeShader, 1, &shaderSource, nullptr);
+    glCompileShader(computeShader);
+
+    GLint compileStatus;
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &compileStatus);
+    if (compileStatus != GL_TRUE) {
+        char buffer[512];
+        glGetShaderInfoLog(computeShader, 512, nullptr, buffer);
+        ofLogError() << "Shader compilation failed (" << path << "): " << buffer;
+    }
+
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+
+    GLint linkStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus != GL_TRUE) {
+        char buffer[512];
+        glGetProgramInfoLog(program, 512, nullptr, buffer);
+        ofLogError() << "Program linking failed (" << path << "): " << buffer;
+    }
+
+    glDeleteShader(computeShader);
+
+    if (compileStatus != GL_TRUE || linkStatus != GL_TRUE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool GpuSimulationBackend::setupComputeShader() {
+    computeShaderProgram = loadComputeShader("shaders/particlesComputeShader.glsl");
+    if (computeShaderProgram == 0) return false;
+
+    // Set uniforms only once
+    deltaTimeLocation = glGetUniformLocation(computeShaderProgram, "deltaTime");
+    stepScaleLocation = glGetUniformLocation(computeShaderProgram, "stepScale");
+    worldSizeLocation = glGetUniformLocation(computeShaderProgram, "worldSize");
+    targetTemperatureLocation = glGetUniformLocation(computeShaderProgram, "targetTemperature");
+    couplingLocation = glGetUniformLocation(computeShaderProgram, "coupling");
+    applyThermostatLocation = glGetUniformLocation(computeShaderProgram, "applyThermostat");
+    depthFieldScaleLocation = glGetUniformLocation(computeShaderProgram, "depthFieldScale");
+    videoOffsetLocation = glGetUniformLocation(computeShaderProgram, "videoOffset");
+    videoScaleLocation = glGetUniformLocation(computeShaderProgram, "videoScale");
+    sourceSizeLocation = glGetUniformLocation(computeShaderProgram, "sourceSize");
+    cutoffLocation = glGetUniformLocation(computeShaderProgram, "cutoff");
+    pairTableScaleLocation = glGetUniformLocation(computeShaderProgram, "pairTableScale");
+    depthGradientLocation = glGetUniformLocation(computeShaderProgram, "depthGradient");
+    enableCollisionLoggingLocation = glGetUniformLocation(computeShaderProgram, "enableCollisionLogging");
+    gridSizeLocation = glGetUniformLocation(computeShaderProgram, "gridSize");
+    invCellSizeLocation = glGetUniformLocation(computeShaderProgram, "invCellSize");
+    particleRadiusLocation = glGetUniformLocation(computeShaderProgram, "particleRadius");
+    particleMassLocation = glGetUniformLocation(computeShaderProgram, "particleMass");
+
+    return true;
+}
+
+bool GpuSimulationBackend::setupBinningShaders() {
+    histogramShaderProgram = loadComputeShader("shaders/binningHistogramShader.glsl");
+    scanShaderProgram = loadComputeShader("shaders/binningScanShader.glsl");
+    scatterShaderProgram = loadComputeShader("shaders/binningScatterShader.glsl");
+    if (histogramShaderProgram == 0 || scanShaderProgram == 0 || scatterShaderProgram == 0) return false;
+
+    histogramGridSizeLocation = glGetUniformLocation(histogramShaderProgram, "gridSize");
+    histogramInvCellSizeLocation = glGetUniformLocation(histogramShaderProgram, "invCellSize");
+    scanCellCountLocation = glGetUniformLocation(scanShaderProgram, "cellCount");
+
+    return true;
+}
+
+void GpuSimulationBackend::setupCollisionBuffer() {
+    glGenBuffers(1, &ssboCollisions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
+
+    // Calculate total buffer size: summary header + sampled collision records
+    size_t headerSize = sizeof(CollisionSummary);
+    size_t collisionArraySize = maxCollisions * sizeof(CollisionData);
+    size_t totalBufferSize = headerSize + collisionArraySize;
+
+    glBufferData(GL_SHADER_STORAGE_BUFFER, totalBufferSize, nullptr, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCollisions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    ofLogNotice("GpuSimulationBackend::setupCollisionBuffer") << "Collision buffer created with " << maxCollisions << " max collisions";
+}
+
+void GpuSimulationBackend::setupDepthFieldTexture() {
+    glGenTextures(1, &depthFieldTexture);
+    glGenTextures(1, &depthGradientTexture);
+    glGenBuffers(1, &ssboDepthOccupancy);
+    glGenBuffers(1, &depthUploadBuffer);
+
+    for (GLuint texture : { depthFieldTexture, depthGradientTexture }) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    allocateDepthTextures();
+}
+
+/// <summary>
+/// Size the depth texture, its gradient and the occupancy tiles to depthWidth x depthHeight
+/// Everything starts flat: no gradient anywhere until the first frame arrives
+/// </summary>
+void GpuSimulationBackend::allocateDepthTextures() {
+    // both start from zeros uploaded from the cpu (glClearTexImage is GL 4.4, the compute shaders only need 4.3),
+    // one buffer of the size of the gradient serves both; only on a size change
+    const std::vector<float> zeros(static_cast<size_t>(depthWidth) * depthHeight * 2, 0.0f);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // the camera bytes as they are, the gradient pass does the normalization and inversion
+    glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, depthWidth, depthHeight, 0, GL_RED, GL_UNSIGNED_BYTE, zeros.data());
+
+    glBindTexture(GL_TEXTURE_2D, depthGradientTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, depthWidth, depthHeight, 0, GL_RG, GL_FLOAT, zeros.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    const size_t tiles = getDepthTileCount();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboDepthOccupancy);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, tiles * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+size_t GpuSimulationBackend::getDepthTileCount() const {
+    return ((depthWidth + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE) * ((depthHeight + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE);
+}
+
+/// <summary>
+/// Gradient of the new depth frame into depthGradientTexture, and its occupied tiles, one thread per texel
+/// </summary>
+void GpuSimulationBackend::computeDepthGradient() {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboDepthOccupancy);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(depthGradientShaderProgram);
+    glBindImageTexture(0, depthFieldTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
+    glBindImageTexture(1, depthGradientTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssboDepthOccupancy);
+
+    glDispatchCompute((depthWidth + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE, (depthHeight + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/// <summary>
+/// Resize the particle buffers to the active set. The particles the gpu already has keep their newest state there
+/// (particles.active can be up to READBACK_SLOTS steps behind it), only the new ones are uploaded
+/// </summary>
+void GpuSimulationBackend::uploadParticles(const ParticleSystem& particles) {
+    const size_t count = particles.active.size();
+    const size_t kept = std::min(count, gpuParticleCount);
+    const int nextParticleBuffer = 1 - currentParticleBuffer;
+
+    // the resized state goes to the other buffer: the kept particles copied on the gpu, then the new ones from the cpu
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles[nextParticleBuffer]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(GpuParticle), nullptr, GL_DYNAMIC_COPY);
+    if (kept > 0) {
+        // make the shader writes of the last step visible to the copy
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, ssboParticles[currentParticleBuffer]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, kept * sizeof(GpuParticle));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    if (count > kept) {
+        packParticles(particles.active, kept);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, kept * sizeof(GpuParticle), (count - kept) * sizeof(GpuParticle), staging.data());
+    }
+    currentParticleBuffer = nextParticleBuffer;
+    gpuParticleCount = count;
+
+    // the previous state buffer only needs the room for the next step
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles[1 - currentParticleBuffer]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(GpuParticle), nullptr, GL_DYNAMIC_COPY);
+
+    // per particle binning buffers follow the particle count
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboSortedParticles);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(GpuParticle), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCellParticles);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticleBins);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/// <summary>
+/// Interleave the particle arrays from begin on into the gpu layout
+/// </summary>
+void GpuSimulationBackend::packParticles(const ParticleArrays& particles, size_t begin) {
+    staging.resize(particles.size() - begin);
+    for (size_t i = begin; i < particles.size(); i++) {
+        staging[i - begin].position = particles.getPosition(i);
+        staging[i - begin].velocity = particles.getVelocity(i);
+    }
+}
+
+/// <summary>
+/// Split the first count gpu particle records back into the particle arrays
+/// </summary>
+void GpuSimulationBackend::unpackParticles(const GpuParticle* source, size_t count, ParticleArrays& particles) {
+    for (size_t i = 0; i < count; i++) {
+        particles.x[i] = source[i].position.x;
+        particles.y[i] = source[i].position.y;
+        particles.vx[i] = source[i].velocity.x;
+        particles.vy[i] = source[i].velocity.y;
+    }
+}
+
+/// <summary>
+/// Upload a camera frame, one byte per pixel, through a pixel unpack buffer
+/// The buffer is orphaned on every frame, so the copy never waits for the previous upload to finish
+/// </summary>
+void GpuSimulationBackend::updateDepthField(const unsigned char* pixels, int frameWidth, int frameHeight) {
+    // Update texture dimensions if changed
+    if (frameWidth != depthWidth || frameHeight != depthHeight) {
+        depthWidth = frameWidth;
+        depthHeight = frameHeight;
+        allocateDepthTextures();
+    }
+
+    const size_t frameBytes = static_cast<size_t>(depthWidth) * depthHeight;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, depthUploadBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, frameBytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, frameBytes, pixels);
+
+    // rows of 8 bit pixels are not 4 byte aligned for every width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, depthWidth, depthHeight, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // the particles sample the gradient on every step, it is only computed when the frame changes
+    computeDepthGradient();
+}
+
+/// <summary>
+/// Copy the pair force table to its buffer (binding 7), only when the simulator built a new one
+/// </summary>
+void GpuSimulationBackend::uploadPairPotential(const PairPotentialTable& table) {
+    if (table.getVersion() == pairForceTableVersion) return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPairForceTable);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, table.getForceTableBytes(), table.getForceTable(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    pairForceTableVersion = table.getVersion();
+}
+
+/// <summary>
+/// Build the cell list on the gpu with a counting sort: histogram, prefix sum, scatter
+/// Leaves cellStart (binding 2), cellParticles (binding 3) and sortedParticles (binding 4) ready for the force kernel
+/// </summary>
+void GpuSimulationBackend::binParticles(size_t particleCount, const SimulationStepParameters& params) {
+    cells.setupGrid(params.worldSize, params.cutoff);
+    const size_t cellCount = cells.getCellCount();
+    const GLuint particleGroups = (particleCount + BINNING_WORKGROUP_SIZE - 1) / BINNING_WORKGROUP_SIZE;
+
+    // Grow the cell buffer when the grid gets larger (window resize, smaller cutoff)
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCellStart);
+    if (cellCount + 1 > cellStartCapacity) {
+        cellStartCapacity = cellCount + 1;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, cellStartCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+    }
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles[currentParticleBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboCellStart);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboCellParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboSortedParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboParticleBins);
+
+    // 1. count particles per cell
+    glUseProgram(histogramShaderProgram);
+    glUniform2i(histogramGridSizeLocation, cells.gridWidth, cells.gridHeight);
+    glUniform1f(histogramInvCellSizeLocation, cells.invCellSize);
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // 2. counts to offsets, a single workgroup
+    glUseProgram(scanShaderProgram);
+    glUniform1ui(scanCellCountLocation, static_cast<GLuint>(cellCount));
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // 3. sort
+    glUseProgram(scatterShaderProgram);
+    glDispatchCompute(particleGroups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+#ifdef DEBUG_SIMULATION_BINNING
+/// <summary>
+/// Compare the gpu cell list with the cpu one: same offsets, and the same particles in every cell
+/// The order inside a cell depends on the atomics, so cells are compared as sets
+/// </summary>
+void GpuSimulationBackend::verifyBinning(const ParticleSystem& particles, const SimulationStepParameters& params) {
+    CellList reference;
+    reference.build(particles.active, params.worldSize, params.cutoff);
+    const size_t cellCount = reference.getCellCount();
+
+    std::vector<uint32_t> gpuCellStart(cellCount + 1);
+    std::vector<uint32_t> gpuCellParticles(particles.active.size());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCellStart);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuCellStart.size() * sizeof(uint32_t), gpuCellStart.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCellParticles);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuCellParticles.size() * sizeof(uint32_t), gpuCellParticles.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    size_t wrongCells = 0;
+    for (size_t c = 0; c < cellCount; c++) {
+        if (gpuCellStart[c] != reference.cellStart[c] || gpuCellStart[c + 1] != reference.cellStart[c + 1]) {
+            wrongCells++;
+            continue;
+        }
+        std::vector<uint32_t> gpuCell(gpuCellParticles.begin() + gpuCellStart[c], gpuCellParticles.begin() + gpuCellStart[c + 1]);
+        std::vector<uint32_t> cpuCell(reference.particleIndices.begin() + reference.cellStart[c], reference.particleIndices.begin() + reference.cellStart[c + 1]);
+        std::sort(gpuCell.begin(), gpuCell.end());
+        std::sort(cpuCell.begin(), cpuCell.end());
+        if (gpuCell != cpuCell) wrongCells++;
+    }
+
+    if (wrongCells > 0) {
+        ofLogError("GpuSimulationBackend::verifyBinning") << wrongCells << " of " << cellCount << " cells differ from the cpu cell list";
+    }
+}
+#endif
+
+void GpuSimulationBackend::step(ParticleSystem& particles, const SimulationStepParameters& params, CollisionBuffer& collisions) {
+    // Reset the collision summary for this frame
+    // (the cpu side buffer is left alone, it still holds the last frame read back)
+    if (params.enableCollisionLogging) {
+        CollisionSummary header = {};
+        header.maxCollisions = static_cast<uint32_t>(maxCollisions);
+        header.frameNumber = params.frameNumber;
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    const uint32_t zeroStats[2] = { 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboStepStats);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeroStats), zeroStats);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    uploadPairPotential(*params.pairPotential);
+    binParticles(particles.active.size(), params);
+
+#ifdef DEBUG_SIMULATION_BINNING
+    verifyBinning(particles, params);
+#endif
+
+    glUseProgram(computeShaderProgram);
+
+    glUniform1f(deltaTimeLocation, params.deltaTime);
+    glUniform1f(stepScaleLocation, params.stepScale);
+    glUniform2f(worldSizeLocation, params.worldSize.x, params.worldSize.y);
+    glUniform1f(targetTemperatureLocation, params.targetTemperature);
+    glUniform1f(couplingLocation, params.coupling);
+    glUniform1i(applyThermostatLocation, params.applyThermostat ? 1 : 0);
+    glUniform1f(depthFieldScaleLocation, params.depthFieldScale);
+    glUniform2f(videoOffsetLocation, params.videoOffset.x, params.videoOffset.y);
+    glUniform2f(videoScaleLocation, params.videoScale.x, params.videoScale.y);
+    glUniform2f(sourceSizeLocation, params.sourceSize.x, params.sourceSize.y);
+    glUniform1f(cutoffLocation, params.cutoff);
+    glUniform1f(pairTableScaleLocation, params.pairPotential->getScale());
+    glUniform1i(enableCollisionLoggingLocation, params.enableCollisionLogging ? 1 : 0);
+    glUniform2i(gridSizeLocation, cells.gridWidth, cells.gridHeight);
+    glUniform1f(invCellSizeLocation, cells.invCellSize);
+    glUniform1f(particleRadiusLocation, particles.radius);
+    glUniform1f(particleMassLocation, particles.mass);
+
+    // Bind the depth gradient texture
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthGradientTexture);
+    glUniform1i(depthGradientLocation, 0);
+
+    // Bind the next particle buffer as output, collision buffer and cell list
+    // (the previous state is only read through the sorted copy)
+    const int nextParticleBuffer = 1 - currentParticleBuffer;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles[nextParticleBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCollisions);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboCellStart);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboCellParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboSortedParticles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboStepStats);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssboPairForceTable);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssboDepthOccupancy);
+
+    glDispatchCompute((particles.active.size() + FORCE_WORKGROUP_SIZE - 1) / FORCE_WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    currentParticleBuffer = nextParticleBuffer;
+    dispatchedTime += params.deltaTime;
+
+    if (useAsyncReadback) {
+        queueReadback(particles.active.size(), params.enableCollisionLogging);
+        collectReadback(particles, collisions);
+        return;
+    }
+
+    // Read back particle data, blocking until the gpu is done
+    uint64_t waitStart = ofGetElapsedTimeMicros();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles[currentParticleBuffer]);
+    GpuParticle* ptr = (GpuParticle*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+    readbackWaitTime = (ofGetElapsedTimeMicros() - waitStart) * 0.001f;
+    particles.keepPreviousPositions();
+    particles.stateTime = dispatchedTime;
+    unpackParticles(ptr, particles.active.size(), particles.active);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (params.enableCollisionLogging) {
+        readCollisionData(collisions);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboStepStats);
+    const uint32_t* statsPtr = (const uint32_t*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 2 * sizeof(uint32_t), GL_MAP_READ_BIT);
+    if (statsPtr) {
+        readStepStats(statsPtr);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/// <summary>
+/// Decode the step stats buffer, the shader keeps the float bits as uints for atomicMax
+/// </summary>
+void GpuSimulationBackend::readStepStats(const uint32_t* bits) {
+    memcpy(&stepStats.maxAcceleration, &bits[0], sizeof(float));
+    memcpy(&stepStats.maxVelocity, &bits[1], sizeof(float));
+}
+
+/// <summary>
+/// Make sure the slot can hold the particles and the collision buffer, recreating its persistent mapping if it grows
+/// </summary>
+void GpuSimulationBackend::reserveReadbackSlot(ReadbackSlot& slot, size_t size) {
+    if (slot.capacity >= size) return;
+
+    if (slot.buffer != 0) glDeleteBuffers(1, &slot.buffer);
+
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &slot.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+    slot.mapped = static_cast<const unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    slot.capacity = size;
+}
+
+/// <summary>
+/// Copy the results of the step to the next readback slot on the gpu timeline and fence it
+/// If that slot is still in flight (the cpu is 3 steps ahead) this is the only place that waits
+/// </summary>
+void GpuSimulationBackend::queueReadback(size_t particleCount, bool withCollisions) {
+    ReadbackSlot& slot = readbackSlots[nextReadbackSlot];
+    nextReadbackSlot = (nextReadbackSlot + 1) % READBACK_SLOTS;
+
+    readbackWaitTime = 0.0f;
+    if (slot.fence != nullptr) {
+        uint64_t waitStart = ofGetElapsedTimeMicros();
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, READBACK_TIMEOUT_NS);
+        readbackWaitTime = (ofGetElapsedTimeMicros() - waitStart) * 0.001f;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+
+    const size_t particleBytes = particleCount * sizeof(GpuParticle);
+    const size_t collisionBytes = sizeof(CollisionSummary) + maxCollisions * sizeof(CollisionData);
+    const size_t statsBytes = 2 * sizeof(uint32_t);
+    reserveReadbackSlot(slot, particleBytes + collisionBytes + statsBytes);
+
+    // make the shader writes visible to the copies
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, ssboParticles[currentParticleBuffer]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, particleBytes);
+    if (withCollisions) {
+        glBindBuffer(GL_COPY_READ_BUFFER, ssboCollisions);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, particleBytes, collisionBytes);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, ssboStepStats);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, particleBytes + collisionBytes, statsBytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.particleCount = particleCount;
+    slot.hasCollisions = withCollisions;
+    slot.stepNumber = ++stepCounter;
+    slot.simulatedTime = dispatchedTime;
+}
+
+/// <summary>
+/// Copy the newest finished slot to the cpu side without blocking, and release it together with the older ones
+/// When nothing finished yet, particles and collisions keep the previous results (and the previous positions too)
+/// </summary>
+void GpuSimulationBackend::collectReadback(ParticleSystem& particles, CollisionBuffer& collisions) {
+    ReadbackSlot* newest = nullptr;
+    for (auto& slot : readbackSlots) {
+        if (slot.fence == nullptr) continue;
+        GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+        if (newest == nullptr || slot.stepNumber > newest->stepNumber) newest = &slot;
+    }
+    if (newest == nullptr) return;
+
+    // the render interpolates over all the steps since the last collected one, not only the last step
+    const uint64_t steps = collectedStepNumber == 0 ? 1 : newest->stepNumber - collectedStepNumber;
+    particles.keepPreviousPositions(static_cast<uint32_t>(steps));
+    particles.stateTime = newest->simulatedTime;
+    collectedStepNumber = newest->stepNumber;
+
+    // slots from before a resize hold the same particles up to the smaller count (uploadParticles keeps them on the gpu),
+    // the added ones keep the state they were uploaded with until a slot that has them arrives
+    const size_t count = std::min(newest->particleCount, particles.active.size());
+    unpackParticles(reinterpret_cast<const GpuParticle*>(newest->mapped), count, particles.active);
+
+    const size_t collisionBytes = sizeof(CollisionSummary) + maxCollisions * sizeof(CollisionData);
+    readStepStats(reinterpret_cast<const uint32_t*>(newest->mapped + newest->particleCount * sizeof(GpuParticle) + collisionBytes));
+
+    if (newest->hasCollisions) {
+        const unsigned char* header = newest->mapped + newest->particleCount * sizeof(GpuParticle);
+        memcpy(static_cast<CollisionSummary*>(&collisions), header, sizeof(CollisionSummary));
+        memcpy(collisions.collisions.data(), header + sizeof(CollisionSummary), collisions.getSampleCount() * sizeof(CollisionData));
+    }
+
+    for (auto& slot : readbackSlots) {
+        if (slot.fence != nullptr && slot.stepNumber <= collectedStepNumber) {
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+    }
+}
+
+void GpuSimulationBackend::readCollisionData(CollisionBuffer& collisions) {
+    // Read back collision data from GPU
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
+
+    // First read the summary to get the sample count
+    CollisionSummary* headerPtr = (CollisionSummary*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(CollisionSummary), GL_MAP_READ_BIT);
+    if (headerPtr) {
+        memcpy(static_cast<CollisionSummary*>(&collisions), headerPtr, sizeof(CollisionSummary));
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+        // If there are sampled records, read them
+        if (collisions.getSampleCount() > 0) {
+            size_t headerSize = sizeof(CollisionSummary);
+            size_t collisionDataSize = collisions.getSampleCount() * sizeof(CollisionData);
+
+            CollisionData* collisionPtr = (CollisionData*)glMapBufferRange(
+                GL_SHADER_STORAGE_BUFFER,
+                headerSize,
+                collisionDataSize,
+                GL_MAP_READ_BIT
+            );
+
+            if (collisionPtr) {
+                memcpy(collisions.collisions.data(), collisionPtr, collisionDataSize);
+                glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+            }
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "ofMain.h"
+#include <GL/glew.h>
+#include "SimulationBackend.h"
+#include "CellList.h"
+
+// Reads back the gpu cell list every step and checks it against the one built on the cpu
+//#define DEBUG_SIMULATION_BINNING
+
+/// <summary>
+/// Particle record in the gpu buffers (std430 layout), radius and mass are uniforms
+/// </summary>
+struct GpuParticle {
+    glm::vec2 position;
+    glm::vec2 velocity;
+};
+
+/// <summary>
+/// Physics step on the GPU: the particles are binned into cells by three passes
+/// (binningHistogramShader, binningScanShader, binningScatterShader) and then
+/// particlesComputeShader.glsl computes the forces over the 3x3 neighbour cells
+/// The depth field gradient is computed once per camera frame by depthGradientShader.glsl
+/// Needs a GL 4.3 context (compute shaders)
+/// </summary>
+class GpuSimulationBackend : public SimulationBackend {
+public:
+    ~GpuSimulationBackend() override;
+
+    bool setup(const ParticleSystem& particles, size_t maxCollisions) override;
+    void uploadParticles(const ParticleSystem& particles) override;
+    void updateDepthField(const unsigned char* pixels, int width, int height) override;
+    void step(ParticleSystem& particles, const SimulationStepParameters& params, CollisionBuffer& collisions) override;
+    std::string getName() const override { return "gpu"; }
+    bool needsMainThread() const override { return true; }
+    float getReadbackWaitTime() const override { return readbackWaitTime; }
+    SimulationStepStats getStepStats() const override { return stepStats; }
+
+private:
+    GLuint loadComputeShader(const std::string& path);
+    bool setupComputeShader();
+    bool setupBinningShaders();
+    void setupCollisionBuffer();
+    void setupDepthFieldTexture();
+    void allocateDepthTextures();
+    void computeDepthGradient();
+    size_t getDepthTileCount() const;
+    void readCollisionData(CollisionBuffer& collisions);
+    void readStepStats(const uint32_t* bits);
+    void uploadPairPotential(const PairPotentialTable& table);
+    void binParticles(size_t particleCount, const SimulationStepParameters& params);
+    void packParticles(const ParticleArrays& particles, size_t begin);
+    void unpackParticles(const GpuParticle* source, size_t count, ParticleArrays& particles);
+
+    /// <summary>
+    /// Persistently mapped buffer the results of a step are copied to, read on the cpu once its fence is signaled
+    /// Layout: the particles, the collision buffer (header + records), then the step stats
+    /// </summary>
+    struct ReadbackSlot {
+        GLuint buffer = 0;
+        const unsigned char* mapped = nullptr;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+        size_t particleCount = 0;
+        bool hasCollisions = false;
+        uint64_t stepNumber = 0;
+        double simulatedTime = 0.0; // of the state in the slot
+    };
+
+    void reserveReadbackSlot(ReadbackSlot& slot, size_t size);
+    void queueReadback(size_t particleCount, bool withCollisions);
+    void collectReadback(ParticleSystem& particles, CollisionBuffer& collisions);
+#ifdef DEBUG_SIMULATION_BINNING
+    void verifyBinning(const ParticleSystem& particles, const SimulationStepParameters& params);
+#endif
+
+    // ping-pong particle buffers: a step reads ssboParticles[currentParticleBuffer] and writes the other one
+    GLuint ssboParticles[2] = { 0, 0 };
+    int currentParticleBuffer = 0;
+    size_t gpuParticleCount = 0; // particles in the buffers, the newest state of each is there
+    GLuint ssboCollisions = 0;
+    GLuint computeShaderProgram = 0;
+    GLuint depthFieldTexture = 0;
+    GLuint depthGradientTexture = 0;
+    GLuint ssboDepthOccupancy = 0;
+    GLuint depthUploadBuffer = 0;
+    GLuint ssboCellStart = 0;
+    GLuint ssboCellParticles = 0;
+    GLuint ssboSortedParticles = 0;
+    GLuint ssboParticleBins = 0;
+    GLuint ssboStepStats = 0;
+    GLuint ssboPairForceTable = 0;
+    uint32_t pairForceTableVersion = 0;
+
+    GLuint histogramShaderProgram = 0;
+    GLuint scanShaderProgram = 0;
+    GLuint scatterShaderProgram = 0;
+    GLuint depthGradientShaderProgram = 0;
+
+    GLint deltaTimeLocation;
+    GLint stepScaleLocation;
+    GLint worldSizeLocation;
+    GLint targetTemperatureLocation;
+    GLint couplingLocation;
+    GLint applyThermostatLocation;
+    GLint depthFieldScaleLocation;
+    GLint videoOffsetLocation;
+    GLint videoScaleLocation;
+    GLint sourceSizeLocation;
+    GLint cutoffLocation;
+    GLint pairTableScaleLocation;
+    GLint depthGradientLocation;
+    GLint enableCollisionLoggingLocation;
+    GLint histogramGridSizeLocation;
+    GLint histogramInvCellSizeLocation;
+    GLint scanCellCountLocation;
+    GLint gridSizeLocation;
+    GLint invCellSizeLocation;
+    GLint particleRadiusLocation;
+    GLint particleMassLocation;
+
+    // grid dimensions of the neighbour search, the cell list itself lives on the gpu
+    CellList cells;
+    size_t cellStartCapacity = 0;
+
+    // asynchronous readback: the cpu gets the newest finished step, usually one frame behind, without stalling
+    static const int READBACK_SLOTS = 3;
+    static const GLuint64 READBACK_TIMEOUT_NS = 1000000000;
+    ReadbackSlot readbackSlots[READBACK_SLOTS];
+    int nextReadbackSlot = 0;
+    uint64_t stepCounter = 0;
+    uint64_t collectedStepNumber = 0; // step of the state in particles.active, 0 before the first one
+    double dispatchedTime = 0.0;      // simulated seconds at the end of the last dispatched step
+    bool useAsyncReadback = false;
+    float readbackWaitTime = 0.0f;
+    SimulationStepStats stepStats;
+
+    static const GLuint BINNING_WORKGROUP_SIZE = 256;
+    static const GLuint FORCE_WORKGROUP_SIZE = 512;
+    static const int DEPTH_TILE_SIZE = 16; // workgroup side of depthGradientShader.glsl, DEPTH_TILE in particlesComputeShader.glsl
+
+    size_t maxCollisions = 0;
+
+    int depthWidth = 640;
+    int depthHeight = 576;
+
+    // interleaved copy of the particle arrays for uploads
+    std::vector<GpuParticle> staging;
+};
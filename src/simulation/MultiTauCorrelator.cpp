@@ -0,0 +1,97 @@
+#include "MultiTauCorrelator.h"
+
+void MultiTauCorrelator::add(const std::vector<glm::vec2>& velocities) {
+    if (velocities.size() != particleCount || levels[0].values.empty()) reset(velocities.size());
+    if (particleCount == 0) return;
+
+    Level& first = levels[0];
+    first.head = (first.head + 1) % POINTS_PER_LEVEL;
+    glm::vec2* newest = getSlot(first, first.head);
+    for (size_t i = 0; i < particleCount; i++) {
+        newest[i] = velocities[i];
+    }
+
+    correlate(0);
+}
+
+void MultiTauCorrelator::release() {
+    for (Level& level : levels) {
+        level = Level();
+    }
+    particleCount = 0;
+}
+
+uint32_t MultiTauCorrelator::getLag(uint32_t index) const {
+    if (index < POINTS_PER_LEVEL) return index;
+
+    const uint32_t half = POINTS_PER_LEVEL / 2;
+    const uint32_t level = 1 + (index - POINTS_PER_LEVEL) / half;
+    const uint32_t point = half + (index - POINTS_PER_LEVEL) % half;
+    return point << level;
+}
+
+double MultiTauCorrelator::getCorrelation(uint32_t index) const {
+    uint32_t level = 0;
+    uint32_t point = index;
+    if (index >= POINTS_PER_LEVEL) {
+        const uint32_t half = POINTS_PER_LEVEL / 2;
+        level = 1 + (index - POINTS_PER_LEVEL) / half;
+        point = half + (index - POINTS_PER_LEVEL) % half;
+    }
+    if (level >= LEVELS || levels[level].weight.empty()) return 0.0;
+
+    const double weight = levels[level].weight[point];
+    return weight > 0.0 ? levels[level].correlation[point] / weight : 0.0;
+}
+
+void MultiTauCorrelator::reset(size_t count) {
+    particleCount = count;
+    for (Level& level : levels) {
+        level.values.assign(POINTS_PER_LEVEL * count, glm::vec2(0.0f));
+        level.correlation.assign(POINTS_PER_LEVEL, 0.0);
+        level.weight.assign(POINTS_PER_LEVEL, 0.0);
+        level.head = 0;
+        level.filled = 0;
+        level.blockCount = 0;
+    }
+}
+
+/// <summary>
+/// The newest value of a level is in: correlate it with the ones before it, and pass the average of every two to the next level
+/// </summary>
+void MultiTauCorrelator::correlate(uint32_t levelIndex) {
+    Level& level = levels[levelIndex];
+    level.filled = std::min(level.filled + 1, POINTS_PER_LEVEL);
+
+    const double decay = 1.0 - 1.0 / DECAY_UPDATES;
+    const glm::vec2* newest = getSlot(level, level.head);
+
+    // the lower half of the points of a level is covered by the level before it, at a finer spacing
+    const uint32_t firstPoint = (levelIndex == 0) ? 0 : POINTS_PER_LEVEL / 2;
+    for (uint32_t point = firstPoint; point < level.filled; point++) {
+        const glm::vec2* past = getSlot(level, (level.head + POINTS_PER_LEVEL - point) % POINTS_PER_LEVEL);
+
+        double sum = 0.0;
+        for (size_t i = 0; i < particleCount; i++) {
+            sum += newest[i].x * past[i].x + newest[i].y * past[i].y;
+        }
+
+        level.correlation[point] = level.correlation[point] * decay + sum;
+        level.weight[point] = level.weight[point] * decay + static_cast<double>(particleCount);
+    }
+
+    if (levelIndex + 1 == LEVELS) return;
+    if (++level.blockCount < 2) return;
+    level.blockCount = 0;
+
+    // block average of the last two values
+    const glm::vec2* previous = getSlot(level, (level.head + POINTS_PER_LEVEL - 1) % POINTS_PER_LEVEL);
+    Level& next = levels[levelIndex + 1];
+    next.head = (next.head + 1) % POINTS_PER_LEVEL;
+    glm::vec2* average = getSlot(next, next.head);
+    for (size_t i = 0; i < particleCount; i++) {
+        average[i] = (newest[i] + previous[i]) * 0.5f;
+    }
+
+    correlate(levelIndex + 1);
+}
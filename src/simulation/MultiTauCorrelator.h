@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include <vector>
+
+/// <summary>
+/// Streaming velocity auto-correlation on logarithmically spaced lags (multi-tau)
+/// Each level keeps the last POINTS_PER_LEVEL values of every particle, level k holding averages of blocks of 2^k samples:
+/// the first level gives the lags 0 to POINTS_PER_LEVEL - 1 samples, every next one the upper half of its points at twice
+/// the spacing. Every sample costs about as much per particle whatever the longest lag, and the memory grows with its log
+/// The sums forget their old values over DECAY_UPDATES updates of their level, so the correlation follows the current
+/// dynamics, each level at its own time scale
+/// </summary>
+class MultiTauCorrelator {
+public:
+    static constexpr uint32_t POINTS_PER_LEVEL = 16;
+    static constexpr uint32_t LEVELS = 12; // lags up to 15 * 2^11 samples, minutes of simulated time
+
+    /// <summary>
+    /// Add the velocities of a sample, a different amount of particles than the last sample starts over
+    /// </summary>
+    void add(const std::vector<glm::vec2>& velocities);
+
+    /// <summary>
+    /// Forget everything and free the memory
+    /// </summary>
+    void release();
+
+    uint32_t getLagCount() const { return POINTS_PER_LEVEL + (LEVELS - 1) * (POINTS_PER_LEVEL / 2); }
+
+    /// <summary>
+    /// Lag in samples of the correlation at index, increasing with the index
+    /// </summary>
+    uint32_t getLag(uint32_t index) const;
+
+    /// <summary>
+    /// Average v(t).v(t + lag) per particle, 0 while the lag has no samples
+    /// </summary>
+    double getCorrelation(uint32_t index) const;
+
+private:
+    struct Level {
+        std::vector<glm::vec2> values;    // POINTS_PER_LEVEL slots of all the particles
+        std::vector<double> correlation;  // by point, summed over particles and time origins
+        std::vector<double> weight;       // samples in the correlation sums
+        uint32_t head = 0;                // slot of the newest value
+        uint32_t filled = 0;              // slots holding values
+        uint32_t blockCount = 0;          // values since the last one passed to the next level
+    };
+
+    void reset(size_t count);
+    void correlate(uint32_t levelIndex);
+    glm::vec2* getSlot(Level& level, uint32_t slot) { return level.values.data() + slot * particleCount; }
+
+    Level levels[LEVELS];
+    size_t particleCount = 0;
+
+    static constexpr double DECAY_UPDATES = 128.0;
+};
@@ -0,0 +1,115 @@
+#include "NeighbourList.h"
+#include "PairForceKernel.h"
+
+#ifdef ESENCIA_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/// <summary>
+/// True when the list was built for this amount of particles and interaction range
+/// </summary>
+bool NeighbourList::matches(size_t count, float cutoff, float skin) const {
+    return valid && count == referenceX.size() && cutoff == builtCutoff && skin == builtSkin;
+}
+
+/// <summary>
+/// True when some particle moved more than half the skin since the last build
+/// </summary>
+/// <param name="sortedX">current positions, in the cell order of the last build</param>
+/// <param name="sortedY">current positions, in the cell order of the last build</param>
+bool NeighbourList::hasMovedTooFar(const ParticleArray& sortedX, const ParticleArray& sortedY, float skin) const {
+    const float maxDisplacementSq = 0.25f * skin * skin;
+    for (size_t k = 0; k < sortedX.size(); k++) {
+        float dx = sortedX[k] - referenceX[k];
+        float dy = sortedY[k] - referenceY[k];
+        if (dx * dx + dy * dy > maxDisplacementSq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// Build the lists from a cell list binned with cells of at least cutoff + skin
+/// Two parallel passes over the slots: count the neighbours, then (after a prefix sum) write them
+/// </summary>
+/// <param name="sortedX">positions in the cell order of cells</param>
+/// <param name="sortedY">positions in the cell order of cells</param>
+void NeighbourList::build(const ParticleArray& sortedX, const ParticleArray& sortedY, const CellList& cells, float cutoff, float skin, WorkerPool& workers) {
+    const size_t count = sortedX.size();
+    const float rangeSq = (cutoff + skin) * (cutoff + skin);
+
+    // calls fn(k, mask) for the slots around the particle in groups of up to 4, bit i of mask set when slot k + i is in range
+    auto forEachInRange = [&](size_t slot, auto fn) {
+        const float px = sortedX[slot];
+        const float py = sortedY[slot];
+        cells.forEachNeighbourRange(glm::vec2(px, py), [&](uint32_t begin, uint32_t end) {
+            uint32_t k = begin;
+#ifdef ESENCIA_SIMD_X86
+            const __m128 vpx = _mm_set1_ps(px);
+            const __m128 vpy = _mm_set1_ps(py);
+            const __m128 vrangeSq = _mm_set1_ps(rangeSq);
+            for (; k + 4 <= end; k += 4) {
+                __m128 dx = _mm_sub_ps(vpx, _mm_loadu_ps(&sortedX[k]));
+                __m128 dy = _mm_sub_ps(vpy, _mm_loadu_ps(&sortedY[k]));
+                __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                int mask = _mm_movemask_ps(_mm_cmplt_ps(distSq, vrangeSq));
+                if (slot - k < 4) mask &= ~(1 << (slot - k));
+                fn(k, mask);
+            }
+#endif
+            for (; k < end; k++) {
+                float dx = px - sortedX[k];
+                float dy = py - sortedY[k];
+                if (k != slot && dx * dx + dy * dy < rangeSq) {
+                    fn(k, 1);
+                }
+            }
+        });
+    };
+
+    static const uint8_t BIT_COUNT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    // 1. count
+    neighbourCount.resize(count);
+    workers.parallelFor(count, [&](size_t begin, size_t end, size_t workerIndex) {
+        for (size_t slot = begin; slot < end; slot++) {
+            uint32_t n = 0;
+            forEachInRange(slot, [&](uint32_t, int mask) { n += BIT_COUNT[mask]; });
+            neighbourCount[slot] = n;
+        }
+    });
+
+    // 2. prefix sum, each list followed by one spare item for the branchless writes below
+    neighbourStart.resize(count + 1);
+    neighbourStart[0] = 0;
+    for (size_t k = 0; k < count; k++) {
+        neighbourStart[k + 1] = neighbourStart[k] + neighbourCount[k] + 1;
+    }
+
+    // 3. fill, same traversal as the count; every lane is written and the cursor only advances on the ones in range
+    // (so the writes never go further than the spare item of the list)
+    neighbours.resize(neighbourStart[count]);
+    workers.parallelFor(count, [&](size_t begin, size_t end, size_t workerIndex) {
+        for (size_t slot = begin; slot < end; slot++) {
+            uint32_t* cursor = neighbours.data() + neighbourStart[slot];
+            forEachInRange(slot, [&](uint32_t k, int mask) {
+                cursor[0] = k;
+                cursor += mask & 1;
+                cursor[0] = k + 1;
+                cursor += (mask >> 1) & 1;
+                cursor[0] = k + 2;
+                cursor += (mask >> 2) & 1;
+                cursor[0] = k + 3;
+                cursor += (mask >> 3) & 1;
+            });
+        }
+    });
+
+    referenceX.assign(sortedX.begin(), sortedX.end());
+    referenceY.assign(sortedY.begin(), sortedY.end());
+    builtCutoff = cutoff;
+    builtSkin = skin;
+    valid = true;
+    rebuilds++;
+}
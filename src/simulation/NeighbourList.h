@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include "CellList.h"
+#include "WorkerPool.h"
+#include <vector>
+
+/// <summary>
+/// Verlet neighbour list: for every particle, the particles closer than cutoff + skin when the list was built
+/// While no particle has moved more than skin / 2 since then, no pair can have come from beyond cutoff + skin
+/// into the cutoff, so the same list stays valid for several steps and the cell list is only rebuilt with it
+/// Works on the cell order of the particles (slots of CellList::particleIndices), so the neighbours of a particle
+/// are close in memory; that order is kept until the next build
+/// Stored as one flat array (CSR): the neighbours of slot k are neighbourCount[k] items from neighbours[neighbourStart[k]]
+/// </summary>
+class NeighbourList {
+public:
+    bool matches(size_t count, float cutoff, float skin) const;
+    bool hasMovedTooFar(const ParticleArray& sortedX, const ParticleArray& sortedY, float skin) const;
+    void build(const ParticleArray& sortedX, const ParticleArray& sortedY, const CellList& cells, float cutoff, float skin, WorkerPool& workers);
+
+    /// <summary>
+    /// Forces a rebuild on the next step, after the particles or their cell order changed outside the list
+    /// </summary>
+    void invalidate() { valid = false; }
+
+    const uint32_t* getNeighbours(size_t slot) const { return neighbours.data() + neighbourStart[slot]; }
+    size_t getNeighbourCount(size_t slot) const { return neighbourCount[slot]; }
+
+    /// <summary>
+    /// Number of builds since startup, for the stats
+    /// </summary>
+    uint32_t getRebuildCount() const { return rebuilds; }
+
+private:
+    std::vector<uint32_t> neighbourStart;
+    std::vector<uint32_t> neighbourCount;
+    std::vector<uint32_t> neighbours;
+
+    // positions at the last build, in cell order, to measure the displacements
+    ParticleArray referenceX;
+    ParticleArray referenceY;
+
+    float builtCutoff = 0.0f;
+    float builtSkin = 0.0f;
+    bool valid = false;
+    uint32_t rebuilds = 0;
+};
@@ -0,0 +1,311 @@
+#include "PairForceKernel.h"
+
+#ifdef ESENCIA_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles any intrinsic without extra flags
+#define ESENCIA_TARGET_AVX2
+#else
+// gcc and clang need the instruction set enabled per function, the rest of the build stays generic
+#define ESENCIA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+PairForceKernelFunction PairForceKernel::select() {
+#ifdef ESENCIA_SIMD_X86
+    if (hasAvx2()) return &PairForceKernel::avx2;
+    return &PairForceKernel::sse; // SSE2 is always there on x64
+#else
+    return &PairForceKernel::scalar;
+#endif
+}
+
+PairForceGatherKernelFunction PairForceKernel::selectGather() {
+#ifdef ESENCIA_SIMD_X86
+    if (hasAvx2()) return &PairForceKernel::avx2Gather;
+    return &PairForceKernel::sseGather;
+#else
+    return &PairForceKernel::scalarGather;
+#endif
+}
+
+std::string PairForceKernel::getName() {
+#ifdef ESENCIA_SIMD_X86
+    return hasAvx2() ? "avx2" : "sse";
+#else
+    return "scalar";
+#endif
+}
+
+/// <summary>
+/// AVX2 needs the cpu flag and the OS saving the ymm registers (OSXSAVE + XCR0)
+/// </summary>
+bool PairForceKernel::hasAvx2() {
+#if defined(ESENCIA_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(ESENCIA_SIMD_X86)
+    // checks the OS support as well
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+/// <summary>
+/// Force of a single pair, dx, dy from the neighbour to the particle
+/// </summary>
+static inline void addPairForce(float dx, float dy, float cutoffSq, const PairForceKernelParameters& params, float& fx, float& fy) {
+    float distSq = dx * dx + dy * dy;
+    if (distSq <= 0.0f || distSq >= cutoffSq) return;
+
+    // force over r, interpolated between the two table entries around distSq
+    float t = distSq * params.tableScale;
+    int i = static_cast<int>(t);
+    const float* entry = params.forceTable + 2 * i;
+    float scale = entry[0] + entry[1] * (t - i);
+
+    // Direction from other -> p
+    fx += dx * scale;
+    fy += dy * scale;
+}
+
+glm::vec2 PairForceKernel::scalar(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params) {
+    const float cutoffSq = params.cutoff * params.cutoff;
+    float fx = 0.0f;
+    float fy = 0.0f;
+
+    for (size_t i = 0; i < count; i++) {
+        addPairForce(px - x[i], py - y[i], cutoffSq, params, fx, fy);
+    }
+
+    return glm::vec2(fx, fy);
+}
+
+glm::vec2 PairForceKernel::scalarGather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params) {
+    const float cutoffSq = params.cutoff * params.cutoff;
+    float fx = 0.0f;
+    float fy = 0.0f;
+
+    for (size_t i = 0; i < count; i++) {
+        addPairForce(px - x[indices[i]], py - y[indices[i]], cutoffSq, params, fx, fy);
+    }
+
+    return glm::vec2(fx, fy);
+}
+
+#ifdef ESENCIA_SIMD_X86
+
+/// <summary>
+/// Step constants broadcast to every lane, shared by the contiguous and the gather versions
+/// </summary>
+struct SseConstants {
+    __m128 cutoffSq, tableScale, zero;
+    const float* table;
+
+    explicit SseConstants(const PairForceKernelParameters& params)
+        : cutoffSq(_mm_set1_ps(params.cutoff * params.cutoff)),
+          tableScale(_mm_set1_ps(params.tableScale)),
+          zero(_mm_setzero_ps()),
+          table(params.forceTable) {}
+};
+
+/// <summary>
+/// Force of 4 pairs at once, accumulated on fx, fy
+/// </summary>
+static inline void addPairForces(__m128 dx, __m128 dy, const SseConstants& c, __m128& fx, __m128& fy) {
+    __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    __m128 inRange = _mm_and_ps(_mm_cmpgt_ps(distSq, c.zero), _mm_cmplt_ps(distSq, c.cutoffSq));
+    if (_mm_movemask_ps(inRange) == 0) return;
+
+    // lanes out of range read the first entry to stay inside the table, their force is masked out
+    __m128 t = _mm_mul_ps(_mm_and_ps(inRange, distSq), c.tableScale);
+    __m128i index = _mm_cvttps_epi32(t);
+    __m128 fraction = _mm_sub_ps(t, _mm_cvtepi32_ps(index));
+
+    // one 8 byte load per lane brings the entry and its slope, then they are split in two vectors
+    alignas(16) int32_t idx[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(idx), index);
+    __m128 entries01 = _mm_loadh_pi(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(c.table + 2 * idx[0]))), reinterpret_cast<const __m64*>(c.table + 2 * idx[1]));
+    __m128 entries23 = _mm_loadh_pi(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(c.table + 2 * idx[2]))), reinterpret_cast<const __m64*>(c.table + 2 * idx[3]));
+    __m128 value = _mm_shuffle_ps(entries01, entries23, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 slope = _mm_shuffle_ps(entries01, entries23, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m128 scale = _mm_and_ps(inRange, _mm_add_ps(value, _mm_mul_ps(slope, fraction)));
+    fx = _mm_add_ps(fx, _mm_mul_ps(dx, scale));
+    fy = _mm_add_ps(fy, _mm_mul_ps(dy, scale));
+}
+
+static inline glm::vec2 sumLanes(__m128 fx, __m128 fy) {
+    alignas(16) float lanesX[4];
+    alignas(16) float lanesY[4];
+    _mm_store_ps(lanesX, fx);
+    _mm_store_ps(lanesY, fy);
+    return glm::vec2(lanesX[0] + lanesX[1] + lanesX[2] + lanesX[3], lanesY[0] + lanesY[1] + lanesY[2] + lanesY[3]);
+}
+
+glm::vec2 PairForceKernel::sse(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params) {
+    const SseConstants constants(params);
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+
+    __m128 fx = constants.zero;
+    __m128 fy = constants.zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        addPairForces(_mm_sub_ps(vpx, _mm_loadu_ps(x + i)), _mm_sub_ps(vpy, _mm_loadu_ps(y + i)), constants, fx, fy);
+    }
+
+    glm::vec2 force = sumLanes(fx, fy);
+    if (i < count) {
+        force += scalar(px, py, x + i, y + i, count - i, params);
+    }
+    return force;
+}
+
+/// <summary>
+/// SSE has no gather instruction, the lanes are filled with scalar loads
+/// </summary>
+glm::vec2 PairForceKernel::sseGather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params) {
+    const SseConstants constants(params);
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+
+    __m128 fx = constants.zero;
+    __m128 fy = constants.zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const uint32_t* idx = indices + i;
+        __m128 nx = _mm_set_ps(x[idx[3]], x[idx[2]], x[idx[1]], x[idx[0]]);
+        __m128 ny = _mm_set_ps(y[idx[3]], y[idx[2]], y[idx[1]], y[idx[0]]);
+        addPairForces(_mm_sub_ps(vpx, nx), _mm_sub_ps(vpy, ny), constants, fx, fy);
+    }
+
+    glm::vec2 force = sumLanes(fx, fy);
+    if (i < count) {
+        force += scalarGather(px, py, x, y, indices + i, count - i, params);
+    }
+    return force;
+}
+
+/// <summary>
+/// Step constants broadcast to the 8 lanes
+/// </summary>
+struct Avx2Constants {
+    __m256 cutoffSq, tableScale, zero;
+    const float* table;
+
+    ESENCIA_TARGET_AVX2
+    explicit Avx2Constants(const PairForceKernelParameters& params)
+        : cutoffSq(_mm256_set1_ps(params.cutoff * params.cutoff)),
+          tableScale(_mm256_set1_ps(params.tableScale)),
+          zero(_mm256_setzero_ps()),
+          table(params.forceTable) {}
+};
+
+/// <summary>
+/// Force of 8 pairs at once, accumulated on fx, fy
+/// </summary>
+ESENCIA_TARGET_AVX2
+static inline void addPairForces(__m256 dx, __m256 dy, const Avx2Constants& c, __m256& fx, __m256& fy) {
+    __m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 inRange = _mm256_and_ps(_mm256_cmp_ps(distSq, c.zero, _CMP_GT_OQ), _mm256_cmp_ps(distSq, c.cutoffSq, _CMP_LT_OQ));
+    if (_mm256_movemask_ps(inRange) == 0) return;
+
+    // lanes out of range read the first entry to stay inside the table, their force is masked out
+    __m256 t = _mm256_mul_ps(_mm256_and_ps(inRange, distSq), c.tableScale);
+    __m256i index = _mm256_cvttps_epi32(t);
+    __m256 fraction = _mm256_sub_ps(t, _mm256_cvtepi32_ps(index));
+
+    // the table stays in L1, where vgatherdps beats the lane by lane loads (unlike the neighbour positions)
+    __m256 value = _mm256_i32gather_ps(c.table, index, 8);
+    __m256 slope = _mm256_i32gather_ps(c.table + 1, index, 8);
+
+    __m256 scale = _mm256_and_ps(inRange, _mm256_add_ps(value, _mm256_mul_ps(slope, fraction)));
+    fx = _mm256_add_ps(fx, _mm256_mul_ps(dx, scale));
+    fy = _mm256_add_ps(fy, _mm256_mul_ps(dy, scale));
+}
+
+ESENCIA_TARGET_AVX2
+static inline glm::vec2 sumLanes(__m256 fx, __m256 fy) {
+    alignas(32) float lanesX[8];
+    alignas(32) float lanesY[8];
+    _mm256_store_ps(lanesX, fx);
+    _mm256_store_ps(lanesY, fy);
+    glm::vec2 force(0.0f);
+    for (int lane = 0; lane < 8; lane++) {
+        force.x += lanesX[lane];
+        force.y += lanesY[lane];
+    }
+    return force;
+}
+
+ESENCIA_TARGET_AVX2
+glm::vec2 PairForceKernel::avx2(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params) {
+    const Avx2Constants constants(params);
+    const __m256 vpx = _mm256_set1_ps(px);
+    const __m256 vpy = _mm256_set1_ps(py);
+
+    __m256 fx = constants.zero;
+    __m256 fy = constants.zero;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        addPairForces(_mm256_sub_ps(vpx, _mm256_loadu_ps(x + i)), _mm256_sub_ps(vpy, _mm256_loadu_ps(y + i)), constants, fx, fy);
+    }
+
+    glm::vec2 force = sumLanes(fx, fy);
+    // the tail runs the scalar version, built without AVX: its SSE instructions stall on the dirty upper halves
+    // of the ymm registers unless they are cleared first
+    _mm256_zeroupper();
+    if (i < count) {
+        force += scalar(px, py, x + i, y + i, count - i, params);
+    }
+    return force;
+}
+
+/// <summary>
+/// Lanes filled with scalar loads too: vgatherdps measured ~3x slower than that on the test machines
+/// </summary>
+ESENCIA_TARGET_AVX2
+glm::vec2 PairForceKernel::avx2Gather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params) {
+    const Avx2Constants constants(params);
+    const __m256 vpx = _mm256_set1_ps(px);
+    const __m256 vpy = _mm256_set1_ps(py);
+
+    __m256 fx = constants.zero;
+    __m256 fy = constants.zero;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const uint32_t* idx = indices + i;
+        __m256 nx = _mm256_set_ps(x[idx[7]], x[idx[6]], x[idx[5]], x[idx[4]], x[idx[3]], x[idx[2]], x[idx[1]], x[idx[0]]);
+        __m256 ny = _mm256_set_ps(y[idx[7]], y[idx[6]], y[idx[5]], y[idx[4]], y[idx[3]], y[idx[2]], y[idx[1]], y[idx[0]]);
+        addPairForces(_mm256_sub_ps(vpx, nx), _mm256_sub_ps(vpy, ny), constants, fx, fy);
+    }
+
+    glm::vec2 force = sumLanes(fx, fy);
+    // the tail runs the scalar version, built without AVX: its SSE instructions stall on the dirty upper halves
+    // of the ymm registers unless they are cleared first
+    _mm256_zeroupper();
+    if (i < count) {
+        force += scalarGather(px, py, x, y, indices + i, count - i, params);
+    }
+    return force;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ofMain.h"
+#include <string>
+
+// the vector versions are only built for x86 (the macOS arm builds use the scalar one)
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ESENCIA_SIMD_X86
+#endif
+
+/// <summary>
+/// Constants of the pair force, the same for every pair of the step
+/// </summary>
+struct PairForceKernelParameters {
+    const float* forceTable;    // PairPotentialTable (force over r, slope) pairs, by r²
+    float tableScale;           // table entries per unit of r²
+    float cutoff;               // range of the table
+};
+
+/// <summary>
+/// Pair force on the particle at (px, py) from a contiguous range of neighbours (x[i], y[i])
+/// Neighbours at distance 0 (the particle itself) or beyond the cutoff do not contribute
+/// </summary>
+using PairForceKernelFunction = glm::vec2(*)(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params);
+
+/// <summary>
+/// Same force, from the neighbours listed by index (x[indices[i]], y[indices[i]]), for neighbour lists
+/// </summary>
+using PairForceGatherKernelFunction = glm::vec2(*)(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params);
+
+/// <summary>
+/// Pair force inner loop of the CPU simulation, in scalar, SSE (4 wide) and AVX2 (8 wide) versions
+/// The widest version the processor supports is chosen once at startup from CPUID
+/// The potential itself comes from a PairPotentialTable, the kernels only interpolate it
+/// </summary>
+class PairForceKernel {
+public:
+    static PairForceKernelFunction select();
+    static PairForceGatherKernelFunction selectGather();
+    static std::string getName();
+
+    static glm::vec2 scalar(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params);
+    static glm::vec2 scalarGather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params);
+#ifdef ESENCIA_SIMD_X86
+    static glm::vec2 sse(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params);
+    static glm::vec2 sseGather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params);
+    static glm::vec2 avx2(float px, float py, const float* x, const float* y, size_t count, const PairForceKernelParameters& params);
+    static glm::vec2 avx2Gather(float px, float py, const float* x, const float* y, const uint32_t* indices, size_t count, const PairForceKernelParameters& params);
+#endif
+
+private:
+    static bool hasAvx2();
+};
@@ -0,0 +1,126 @@
+#include "PairPotential.h"
+
+// the bounded potentials need a core about as high as the kinetic energy of the particles
+// at the usual temperatures, or they would go through each other without noticing
+static const float SOFT_CORE_ALPHA = 0.02f;          // core height 4 * epsilon * (1 / alpha² - 1 / alpha), ~10000 epsilon
+static const float GAUSSIAN_CORE_HEIGHT = 10000.0f;  // in epsilons
+
+// distances, in sigmas, beyond which the forces are negligible (below 1e-5 of the contact force)
+static const float LENNARD_JONES_RANGE = 5.0f;
+static const float GAUSSIAN_CORE_RANGE = 4.0f;
+
+/// <summary>
+/// Force magnitude (positive pushes apart) and energy of a pair at distance r
+/// </summary>
+static void evaluate(PairPotential potential, float epsilon, float sigma, double r, double& force, double& energy) {
+    switch (potential) {
+    case PairPotential::LENNARD_JONES:
+    case PairPotential::WCA: {
+        double invDist6 = std::pow(sigma / r, 6.0);
+        double invDist12 = invDist6 * invDist6;
+        force = 24.0 * epsilon * (2.0 * invDist12 - invDist6) / r;
+        energy = 4.0 * epsilon * (invDist12 - invDist6);
+        if (potential == PairPotential::WCA) energy += epsilon; // 0 at the cutoff, the bottom of the well
+        break;
+    }
+    case PairPotential::SOFT_CORE: {
+        // r^6 replaced by alpha sigma^6 + r^6, stays finite at r = 0
+        double s = std::pow(r / sigma, 6.0);
+        double d = SOFT_CORE_ALPHA + s;
+        force = 24.0 * epsilon * s * (2.0 / (d * d * d) - 1.0 / (d * d)) / r;
+        energy = 4.0 * epsilon * (1.0 / (d * d) - 1.0 / d);
+        break;
+    }
+    case PairPotential::GAUSSIAN_CORE: {
+        double height = GAUSSIAN_CORE_HEIGHT * epsilon;
+        double gaussian = std::exp(-(r * r) / (sigma * sigma));
+        force = 2.0 * height * r / (sigma * sigma) * gaussian;
+        energy = height * gaussian;
+        break;
+    }
+    default:
+        force = 0.0;
+        energy = 0.0;
+    }
+}
+
+/// <summary>
+/// Distance where the potential stops mattering, the table (and the neighbour search) ends there
+/// </summary>
+static float naturalRange(PairPotential potential, float sigma) {
+    switch (potential) {
+    case PairPotential::WCA: return std::pow(2.0f, 1.0f / 6.0f) * sigma; // the minimum of Lennard-Jones
+    case PairPotential::GAUSSIAN_CORE: return GAUSSIAN_CORE_RANGE * sigma;
+    default: return LENNARD_JONES_RANGE * sigma;
+    }
+}
+
+void PairPotentialTable::build(PairPotential potential, float epsilon, float sigma, float cutoff, float maxForce) {
+    range = std::min(cutoff, naturalRange(potential, sigma));
+    scale = TABLE_SIZE / (range * range);
+
+    std::vector<float> forceOverR(TABLE_SIZE + 1);
+    energy.resize(TABLE_SIZE + 1);
+
+    for (size_t k = 0; k <= TABLE_SIZE; k++) {
+        // the first entry is sampled half a bin out, the force over r of Lennard-Jones has no value at 0
+        double distSq = std::max(static_cast<double>(k), 0.5) / scale;
+        double r = std::sqrt(distSq);
+        double force, pairEnergy;
+        evaluate(potential, epsilon, sigma, r, force, pairEnergy);
+
+        force = std::min(std::max(force, -static_cast<double>(maxForce)), static_cast<double>(maxForce));
+        forceOverR[k] = static_cast<float>(force / r);
+        energy[k] = static_cast<float>(pairEnergy);
+    }
+
+    // interleave the slopes, the last entry (at the range) has none, the lookups never go past it
+    forceTable.resize(2 * (TABLE_SIZE + 1));
+    for (size_t k = 0; k <= TABLE_SIZE; k++) {
+        forceTable[2 * k] = forceOverR[k];
+        forceTable[2 * k + 1] = k < TABLE_SIZE ? forceOverR[k + 1] - forceOverR[k] : 0.0f;
+    }
+
+    builtPotential = potential;
+    builtEpsilon = epsilon;
+    builtSigma = sigma;
+    builtCutoff = cutoff;
+    builtMaxForce = maxForce;
+    version++;
+
+    ofLogNotice("PairPotentialTable::build") << getName(potential) << ", sigma " << sigma << ", range " << range;
+}
+
+bool PairPotentialTable::matches(PairPotential potential, float epsilon, float sigma, float cutoff, float maxForce) const {
+    return version > 0 && builtPotential == potential && builtEpsilon == epsilon && builtSigma == sigma
+        && builtCutoff == cutoff && builtMaxForce == maxForce;
+}
+
+/// <summary>
+/// Linear interpolation between the two entries around distSq, 0 out of range
+/// </summary>
+float PairPotentialTable::getForce(float distSq) const {
+    float t = distSq * scale;
+    if (forceTable.empty() || t < 0.0f || t > TABLE_SIZE) return 0.0f;
+
+    size_t i = static_cast<size_t>(t);
+    return forceTable[2 * i] + forceTable[2 * i + 1] * (t - i);
+}
+
+float PairPotentialTable::getEnergy(float distSq) const {
+    float t = distSq * scale;
+    if (energy.empty() || t < 0.0f || t > TABLE_SIZE) return 0.0f;
+
+    size_t i = std::min(static_cast<size_t>(t), TABLE_SIZE - 1);
+    return energy[i] + (energy[i + 1] - energy[i]) * (t - i);
+}
+
+std::string PairPotentialTable::getName(PairPotential potential) {
+    switch (potential) {
+    case PairPotential::LENNARD_JONES: return "lennard-jones";
+    case PairPotential::WCA: return "wca";
+    case PairPotential::SOFT_CORE: return "soft-core";
+    case PairPotential::GAUSSIAN_CORE: return "gaussian-core";
+    default: return "none";
+    }
+}
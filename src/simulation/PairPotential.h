@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ofMain.h"
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Pair potentials the simulation can run, selected by SimulationParameters::pairPotential
+/// </summary>
+enum class PairPotential : int {
+    LENNARD_JONES,  // 12-6, the original esencia potential
+    WCA,            // Weeks-Chandler-Andersen, the repulsive part of Lennard-Jones only
+    SOFT_CORE,      // Lennard-Jones with a finite core, particles can overlap under pressure
+    GAUSSIAN_CORE,  // bounded gaussian repulsion, no attraction
+    COUNT
+};
+
+/// <summary>
+/// Force and energy of a pair potential sampled at evenly spaced r², shared by the cpu kernels and the compute shader
+/// Looking values up by r² needs neither the square root nor the divisions of the analytic force
+/// The force is stored divided by r, so the force vector of a pair is just diff * value
+/// Every force entry is followed by the difference to the next one, one 8 byte load gets both ends of an interpolation
+/// </summary>
+class PairPotentialTable {
+public:
+    /// <summary>
+    /// Sample the potential, sigma is the contact distance (sum of both radiuses)
+    /// The table ends at the cutoff or where the potential becomes negligible, whatever comes first
+    /// </summary>
+    void build(PairPotential potential, float epsilon, float sigma, float cutoff, float maxForce);
+
+    /// <summary>
+    /// Whether a build with these values would give the same table
+    /// </summary>
+    bool matches(PairPotential potential, float epsilon, float sigma, float cutoff, float maxForce) const;
+
+    float getForce(float distSq) const;
+    float getEnergy(float distSq) const;
+
+    /// <summary>
+    /// Distance beyond which the pairs do not interact, the cell size of the neighbour search
+    /// </summary>
+    float getRange() const { return range; }
+    float getScale() const { return scale; }
+
+    /// <summary>
+    /// (force over r, difference to the next entry) pairs, TABLE_SIZE + 1 of them, the last one at the range
+    /// </summary>
+    const float* getForceTable() const { return forceTable.data(); }
+    size_t getForceTableBytes() const { return forceTable.size() * sizeof(float); }
+
+    /// <summary>
+    /// Increased on every build, so the backends know when to upload it again
+    /// </summary>
+    uint32_t getVersion() const { return version; }
+
+    static std::string getName(PairPotential potential);
+
+    // intervals over [0, range²]
+    static const size_t TABLE_SIZE = 4096; // 32 KB of force entries, the whole table fits in L1
+
+private:
+    std::vector<float> forceTable;
+    std::vector<float> energy;
+    float range = 0.0f;
+    float scale = 0.0f; // table entries per unit of r²
+    uint32_t version = 0;
+
+    PairPotential builtPotential = PairPotential::COUNT;
+    float builtEpsilon = 0.0f;
+    float builtSigma = 0.0f;
+    float builtCutoff = 0.0f;
+    float builtMaxForce = 0.0f;
+};
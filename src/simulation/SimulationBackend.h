@@ -0,0 +1,153 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include "PairPotential.h"
+#include <string>
+#include <algorithm>
+
+struct CollisionData {
+    uint32_t particleA;
+    uint32_t particleB;
+    glm::vec2 positionA;
+    glm::vec2 positionB;
+    float distance;
+    float velocityMagnitude;
+    uint32_t valid;
+    float impactSpeed;  // relative speed of the two particles
+};
+
+// collision summary bins, the same values are defined in particlesComputeShader.glsl
+constexpr uint32_t COLLISION_SPEED_BINS = 8;        // impact speed bin k starts at COLLISION_SPEED_BASE * 2^k (bin 0 at 0)
+constexpr float COLLISION_SPEED_BASE = 8.0f;
+constexpr uint32_t COLLISION_REGIONS = 8;           // regions per side of the world, for the counts by position
+constexpr uint32_t COLLISION_SAMPLES_PER_GROUP = 4; // records kept per block of FORCE_WORKGROUP_SIZE particles (in cell order)
+
+/// <summary>
+/// Collisions of a step over all the particles: the colliding pairs counted by impact speed and by region of the world,
+/// reduced per workgroup before they reach the global counters, plus a sample of individual records
+/// Same layout as the head of the Collisions buffer of particlesComputeShader.glsl
+/// </summary>
+struct CollisionSummary {
+    uint32_t collisionCount;    // all the colliding pairs of the step
+    uint32_t maxCollisions;     // records the sample can hold
+    uint32_t frameNumber;
+    uint32_t sampleCount;       // records the step tried to sample, the ones past maxCollisions are dropped
+    uint32_t speedHistogram[COLLISION_SPEED_BINS];
+    uint32_t regionCounts[COLLISION_REGIONS * COLLISION_REGIONS]; // row major, by the middle point of the pair
+};
+
+struct CollisionBuffer : CollisionSummary {
+    std::vector<CollisionData> collisions; // the sampled records, getSampleCount() of them are valid
+
+    uint32_t getSampleCount() const { return std::min(sampleCount, static_cast<uint32_t>(collisions.size())); }
+};
+
+/// <summary>
+/// Impact speed bin of a colliding pair, same as collisionSpeedBin in the shader
+/// </summary>
+inline uint32_t getCollisionSpeedBin(float impactSpeed) {
+    float octave = std::floor(std::log2(std::max(impactSpeed, 1e-6f) / COLLISION_SPEED_BASE));
+    return static_cast<uint32_t>(std::clamp(octave, 0.0f, static_cast<float>(COLLISION_SPEED_BINS - 1)));
+}
+
+/// <summary>
+/// Region of the world of a colliding pair, same as collisionRegion in the shader
+/// </summary>
+inline uint32_t getCollisionRegion(glm::vec2 position, glm::vec2 worldSize) {
+    const int last = static_cast<int>(COLLISION_REGIONS) - 1;
+    int x = std::clamp(static_cast<int>(position.x / worldSize.x * COLLISION_REGIONS), 0, last);
+    int y = std::clamp(static_cast<int>(position.y / worldSize.y * COLLISION_REGIONS), 0, last);
+    return static_cast<uint32_t>(y) * COLLISION_REGIONS + static_cast<uint32_t>(x);
+}
+
+/// <summary>
+/// All the values needed to advance the simulation one step
+/// Same set of values as the uniforms of particlesComputeShader.glsl
+/// </summary>
+struct SimulationStepParameters {
+    float deltaTime = 0.01f;
+    float stepScale = 1.0f;     // deltaTime / REFERENCE_DELTA_TIME, the per step damping and thermostat limits are scaled by it
+    glm::vec2 worldSize;
+    float targetTemperature;
+    float coupling;
+    bool applyThermostat;
+    float depthFieldScale;      // 0 when there is no depth field
+    glm::vec2 videoOffset;
+    glm::vec2 videoScale;
+    glm::vec2 sourceSize;
+    const PairPotentialTable* pairPotential; // force by r², shared by both backends
+    float cutoff;               // range of the pair potential table
+    float neighbourSkin;        // extra range of the cpu neighbour lists, 0 to search the cells every step
+    bool enableCollisionLogging;
+    uint32_t frameNumber;
+};
+
+/// <summary>
+/// Step length the velocity damping (0.99) and the thermostat limits (0.95..1.05) were tuned for
+/// </summary>
+constexpr float REFERENCE_DELTA_TIME = 0.01f;
+
+/// <summary>
+/// Largest acceleration and speed over the particles in a step, the input of the adaptive timestep
+/// </summary>
+struct SimulationStepStats {
+    float maxAcceleration = 0.0f;
+    float maxVelocity = 0.0f;
+};
+
+/// <summary>
+/// Interface of the physics step implementations (GPU compute shader, CPU threads)
+/// A backend owns its device resources and advances ParticleSystem::active, filling the collision summary and sampled records
+/// Collision positions are reported in world coordinates; the simulator does the normalization
+/// Results can arrive late: a step may fill them with the newest finished step instead of the one it just dispatched
+/// </summary>
+class SimulationBackend {
+public:
+    virtual ~SimulationBackend() = default;
+
+    /// <summary>
+    /// Allocate the backend resources, maxCollisions is the size of the sample of collision records
+    /// </summary>
+    /// <returns>false if the backend can not run on this machine</returns>
+    virtual bool setup(const ParticleSystem& particles, size_t maxCollisions) = 0;
+
+    /// <summary>
+    /// Called when the size of the active set changed outside the step. The particles the backend already had keep their
+    /// state (particles.active may be behind it), the added ones are taken from particles.active
+    /// </summary>
+    virtual void uploadParticles(const ParticleSystem& particles) = 0;
+
+    /// <summary>
+    /// Receive a new depth field frame, 8 bits per pixel, where white is near
+    /// </summary>
+    virtual void updateDepthField(const unsigned char* pixels, int width, int height) = 0;
+
+    /// <summary>
+    /// Dispatch a step; particles.active is only replaced when a new state is ready, and then particles.keepPreviousPositions
+    /// is called right before it, so the render interpolates between the two newest states that were actually delivered
+    /// </summary>
+    virtual void step(ParticleSystem& particles, const SimulationStepParameters& params, CollisionBuffer& collisions) = 0;
+
+    virtual std::string getName() const = 0;
+
+    /// <summary>
+    /// Whether the steps have to run on the main thread, where the gl context of the backend is
+    /// </summary>
+    virtual bool needsMainThread() const { return false; }
+
+    /// <summary>
+    /// Milliseconds the last step was blocked waiting for the device results
+    /// </summary>
+    virtual float getReadbackWaitTime() const { return 0.0f; }
+
+    /// <summary>
+    /// Times the neighbour lists were rebuilt since startup, backends without lists return 0
+    /// </summary>
+    virtual uint32_t getNeighbourListRebuilds() const { return 0; }
+
+    /// <summary>
+    /// Extremes of the newest finished step (the same step the particles came from)
+    /// </summary>
+    virtual SimulationStepStats getStepStats() const = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// <summary>
+/// Lock-free hand over of the latest value from one writer thread to one reader thread
+/// The writer fills its buffer and publishes it, the reader picks the newest published one; neither ever waits for the other
+/// and no value is copied: the three buffers only change owner (writer, reader, or the one in the middle waiting to be picked)
+/// A value published before the reader picked the previous one replaces it, the reader only gets the latest
+/// </summary>
+template<typename T>
+class TripleBuffer {
+public:
+    /// <summary>
+    /// Set all three buffers, only while no other thread is using them
+    /// </summary>
+    void reset(const T& value) {
+        for (T& buffer : buffers) buffer = value;
+    }
+
+    // writer side
+
+    /// <summary>
+    /// The buffer the writer owns, holds whatever was written to it two publishes ago
+    /// </summary>
+    T& getWriteBuffer() { return buffers[writeIndex]; }
+
+    void publish() {
+        writeIndex = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // reader side
+
+    /// <summary>
+    /// Take the newest published buffer, if there is one the reader has not seen
+    /// </summary>
+    /// <returns>whether getReadBuffer changed</returns>
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    /// <summary>
+    /// The buffer the reader owns, valid until its next update
+    /// </summary>
+    const T& getReadBuffer() const { return buffers[readIndex]; }
+
+    /// <summary>
+    /// Same buffer, the reader may change it as nobody else touches it until it is handed back by an update
+    /// </summary>
+    T& getReadBuffer() { return buffers[readIndex]; }
+
+private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH = 0x4; // the middle buffer was published after the reader last took one
+
+    T buffers[3];
+    std::atomic<uint8_t> middle{ 1 };
+    uint8_t writeIndex = 0;
+    uint8_t readIndex = 2;
+};
@@ -0,0 +1,332 @@
+#include "VelocityAutocorrelation.h"
+
+void VelocityAutocorrelation::setup() {
+    velocityHistory.clear();
+    velocityHistory.resize(MAX_FRAMES);
+    storedFrames = 0;
+    fftRunning = false;
+    multiTau.release();
+    mode = VACMode::FFT;
+    layoutTimeLags = 0;
+    lastVelocities.clear();
+    hasLastState = false;
+    nextSample = 0;
+}
+
+void VelocityAutocorrelation::add(const std::vector<glm::vec2>& velocities, double simulatedTime, VACData& data, VACMode newMode, uint32_t calculationInterval) {
+    if (velocities.empty()) return;
+
+    // the first state starts the samples at its time, so does one that does not follow the last (a clock that went
+    // back, or a gap longer than the history, as when the VAC was off): interpolating over it would make up the velocities
+    if (!hasLastState || simulatedTime < lastTime || simulatedTime - lastTime > MAX_FRAMES * SAMPLE_INTERVAL) {
+        lastVelocities = velocities;
+        lastTime = simulatedTime;
+        sampleOrigin = simulatedTime;
+        nextSample = 0;
+        hasLastState = true;
+    }
+
+    const uint64_t lastSample = static_cast<uint64_t>(std::floor((simulatedTime - sampleOrigin) / SAMPLE_INTERVAL + 1e-9));
+
+    for (; nextSample <= lastSample; nextSample++) {
+        const double time = sampleOrigin + static_cast<double>(nextSample) * SAMPLE_INTERVAL;
+        const double interval = simulatedTime - lastTime;
+
+        // particles added or removed in between: the new state as it is
+        if (interval <= 0.0 || lastVelocities.size() != velocities.size()) {
+            sample = velocities;
+        }
+        else {
+            const float t = static_cast<float>(std::clamp((time - lastTime) / interval, 0.0, 1.0));
+            sample.resize(velocities.size());
+            for (size_t i = 0; i < velocities.size(); i++) {
+                sample[i] = glm::mix(lastVelocities[i], velocities[i], t);
+            }
+        }
+        update(sample, data, newMode, static_cast<uint32_t>(nextSample), calculationInterval);
+    }
+
+    lastVelocities = velocities;
+    lastTime = simulatedTime;
+}
+
+void VelocityAutocorrelation::update(const std::vector<glm::vec2>& velocities, VACData& data, VACMode newMode, uint32_t sampleNumber, uint32_t calculationInterval) {
+    calculationInterval = std::max(calculationInterval, 1u);
+
+    setMode(newMode);
+    updateLayout(data);
+    data.currentFrame++;
+
+    if (mode == VACMode::MULTI_TAU) {
+        // always current: the correlator is updated by every sample
+        multiTau.add(velocities);
+        const double zeroLag = multiTau.getCorrelation(0);
+        for (uint32_t i = 0; i < data.vacValues.size(); i++) {
+            data.vacValues[i] = zeroLag > 0.0 ? static_cast<float>(multiTau.getCorrelation(i) / zeroLag) : 0.0f;
+        }
+        data.lastCalculationFrame = sampleNumber;
+        data.timeOrigins = data.currentFrame;
+        return;
+    }
+
+    storeFrame(velocities);
+
+    if (mode == VACMode::DIRECT) {
+        calculateDirect(data, sampleNumber, calculationInterval);
+        return;
+    }
+
+    if (!fftRunning) {
+        startFft(data, calculationInterval);
+        if (!fftRunning) return;
+    }
+    continueFft(data, sampleNumber);
+}
+
+/// <summary>
+/// Switching between the history and the multi-tau correlator frees the memory of the one left
+/// </summary>
+void VelocityAutocorrelation::setMode(VACMode newMode) {
+    if (newMode == mode) return;
+
+    if (newMode == VACMode::MULTI_TAU) {
+        for (std::vector<glm::vec2>& frame : velocityHistory) {
+            std::vector<glm::vec2>().swap(frame);
+        }
+        storedFrames = 0;
+    }
+    if (mode == VACMode::MULTI_TAU) {
+        multiTau.release();
+    }
+
+    fftRunning = false;
+    mode = newMode;
+    layoutTimeLags = 0;
+}
+
+/// <summary>
+/// Lags of the VAC values: every sample up to maxTimeLags for the history modes, the logarithmic ones of the multi-tau correlator
+/// </summary>
+void VelocityAutocorrelation::updateLayout(VACData& data) {
+    if (layoutTimeLags == data.maxTimeLags) return;
+    layoutTimeLags = data.maxTimeLags;
+
+    const uint32_t timeLags = (mode == VACMode::MULTI_TAU) ? std::min(data.maxTimeLags, multiTau.getLagCount()) : data.maxTimeLags;
+    data.vacValues.assign(timeLags, 0.0f);
+    data.timePoints.resize(timeLags);
+    for (uint32_t i = 0; i < timeLags; i++) {
+        const uint32_t lag = (mode == VACMode::MULTI_TAU) ? multiTau.getLag(i) : i;
+        data.timePoints[i] = static_cast<float>(lag * SAMPLE_INTERVAL);
+    }
+}
+
+void VelocityAutocorrelation::storeFrame(const std::vector<glm::vec2>& velocities) {
+    velocityHistory[storedFrames % MAX_FRAMES] = velocities;
+    storedFrames++;
+}
+
+/// <summary>
+/// Correlation of the newest sample with each of the samples before it
+/// </summary>
+void VelocityAutocorrelation::calculateDirect(VACData& data, uint32_t sampleNumber, uint32_t calculationInterval) {
+    if (storedFrames < 2) return;
+
+    // Calculate VAC less frequently for better performance
+    if ((sampleNumber - data.lastCalculationFrame) < calculationInterval) return;
+    data.lastCalculationFrame = sampleNumber;
+
+    uint32_t availableFrames = std::min(storedFrames, MAX_FRAMES);
+    uint32_t maxTimeLags = std::min(data.maxTimeLags, availableFrames - 1);
+
+    // Reset VAC values
+    std::fill(data.vacValues.begin(), data.vacValues.end(), 0.0f);
+
+    // Get current velocity (t=0)
+    const std::vector<glm::vec2>& current = velocityHistory[(storedFrames - 1) % MAX_FRAMES];
+
+    // sum correlations across all particles
+    for (uint32_t dt = 0; dt < maxTimeLags; dt++) {
+        // Get velocity at time dt ago
+        const std::vector<glm::vec2>& past = velocityHistory[(storedFrames - 1 - dt + MAX_FRAMES) % MAX_FRAMES];
+        const size_t count = std::min(current.size(), past.size());
+
+        double correlation = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            correlation += glm::dot(current[i], past[i]);
+        }
+
+        data.vacValues[dt] = static_cast<float>(correlation);
+    }
+
+    // Normalize so VAC(0) = 1
+    if (data.vacValues[0] > 0.0f) {
+        float normalizationFactor = 1.0f / data.vacValues[0];
+        for (uint32_t i = 0; i < maxTimeLags; i++) {
+            data.vacValues[i] *= normalizationFactor;
+        }
+    }
+    data.timeOrigins = 1;
+}
+
+/// <summary>
+/// Fix the window of the next calculation: the newest samples of the history that stay in it
+/// for all the samples the slices take (calculationInterval, or more when the particles do not fit in the per sample budget)
+/// </summary>
+void VelocityAutocorrelation::startFft(const VACData& data, uint32_t calculationInterval) {
+    if (storedFrames < 2) return;
+
+    const uint32_t newestCount = static_cast<uint32_t>(velocityHistory[(storedFrames - 1) % MAX_FRAMES].size());
+    uint32_t frames = std::max(calculationInterval, (newestCount + FFT_PARTICLES_PER_FRAME - 1) / FFT_PARTICLES_PER_FRAME);
+    frames = std::min(frames, MAX_FRAMES / 2);
+
+    const uint32_t length = std::min(storedFrames, MAX_FRAMES - frames);
+    if (length < 2) return;
+
+    windowStart = storedFrames - length;
+    windowLength = length;
+    fftTimeLags = std::min(data.maxTimeLags, windowLength);
+
+    // the particles present in every sample of the window
+    fftParticleCount = UINT32_MAX;
+    for (uint32_t t = 0; t < windowLength; t++) {
+        const size_t count = velocityHistory[(windowStart + t) % MAX_FRAMES].size();
+        fftParticleCount = std::min(fftParticleCount, static_cast<uint32_t>(count));
+    }
+    if (fftParticleCount == 0) return;
+
+    // zero padded past the last lag, so the circular correlation of the fft does not wrap into the lags
+    uint32_t size = 2;
+    while (size < windowLength + fftTimeLags - 1) size *= 2;
+    setupFftSize(size);
+
+    powerSpectrum.assign(fftSize, 0.0);
+    nextParticle = 0;
+    particlesPerFrame = (fftParticleCount + frames - 1) / frames;
+    fftRunning = true;
+}
+
+/// <summary>
+/// Power spectrum of the next slice of particles, and the correlation once all of them are in
+/// </summary>
+void VelocityAutocorrelation::continueFft(VACData& data, uint32_t sampleNumber) {
+    const uint32_t end = std::min(nextParticle + particlesPerFrame, fftParticleCount);
+    seriesReal.resize(static_cast<size_t>(PARTICLE_BLOCK) * fftSize);
+    seriesImag.resize(static_cast<size_t>(PARTICLE_BLOCK) * fftSize);
+
+    for (uint32_t first = nextParticle; first < end; first += PARTICLE_BLOCK) {
+        const uint32_t block = std::min(PARTICLE_BLOCK, end - first);
+
+        // both components at once: the correlation of vx + i vy has v(t).v(t+dt) as its real part
+        for (uint32_t t = 0; t < windowLength; t++) {
+            const glm::vec2* frame = velocityHistory[(windowStart + t) % MAX_FRAMES].data() + first;
+            for (uint32_t b = 0; b < block; b++) {
+                seriesReal[b * fftSize + t] = frame[b].x;
+                seriesImag[b * fftSize + t] = frame[b].y;
+            }
+        }
+
+        for (uint32_t b = 0; b < block; b++) {
+            float* re = &seriesReal[b * fftSize];
+            float* im = &seriesImag[b * fftSize];
+            std::fill(re + windowLength, re + fftSize, 0.0f);
+            std::fill(im + windowLength, im + fftSize, 0.0f);
+
+            // the spectrum stays in bit reversed order, the inverse transform takes it like that
+            fftForward(re, im);
+            for (uint32_t k = 0; k < fftSize; k++) {
+                powerSpectrum[k] += re[k] * re[k] + im[k] * im[k];
+            }
+        }
+    }
+    nextParticle = end;
+    if (nextParticle < fftParticleCount) return;
+
+    float* correlation = seriesReal.data();
+    float* imaginary = seriesImag.data();
+    for (uint32_t k = 0; k < fftSize; k++) {
+        correlation[k] = static_cast<float>(powerSpectrum[k]);
+        imaginary[k] = 0.0f;
+    }
+    fftInverse(correlation, imaginary);
+
+    // average over the time origins of each lag, normalized so VAC(0) = 1
+    std::fill(data.vacValues.begin(), data.vacValues.end(), 0.0f);
+    const uint32_t timeLags = std::min(fftTimeLags, static_cast<uint32_t>(data.vacValues.size()));
+    const float zeroLag = correlation[0] / static_cast<float>(windowLength);
+    if (zeroLag > 0.0f) {
+        for (uint32_t dt = 0; dt < timeLags; dt++) {
+            data.vacValues[dt] = correlation[dt] / static_cast<float>(windowLength - dt) / zeroLag;
+        }
+    }
+
+    data.lastCalculationFrame = sampleNumber;
+    data.timeOrigins = windowLength;
+    fftRunning = false;
+}
+
+/// <summary>
+/// Twiddles of every stage, the ones of the stage with butterflies half apart at [half, 2 * half)
+/// </summary>
+void VelocityAutocorrelation::setupFftSize(uint32_t size) {
+    if (size == fftSize) return;
+    fftSize = size;
+
+    twiddleReal.resize(size);
+    twiddleImag.resize(size);
+    for (uint32_t half = 1; half < size; half *= 2) {
+        for (uint32_t j = 0; j < half; j++) {
+            const double angle = -TWO_PI * static_cast<double>(j) / static_cast<double>(2 * half);
+            twiddleReal[half + j] = static_cast<float>(std::cos(angle));
+            twiddleImag[half + j] = static_cast<float>(std::sin(angle));
+        }
+    }
+}
+
+/// <summary>
+/// In place forward transform of fftSize values, radix-2 decimation in frequency: natural order in, bit reversed out
+/// </summary>
+void VelocityAutocorrelation::fftForward(float* re, float* im) const {
+    for (uint32_t half = fftSize / 2; half >= 1; half /= 2) {
+        const float* wr = &twiddleReal[half];
+        const float* wi = &twiddleImag[half];
+        for (uint32_t start = 0; start < fftSize; start += 2 * half) {
+            float* aRe = re + start;
+            float* aIm = im + start;
+            float* bRe = aRe + half;
+            float* bIm = aIm + half;
+            for (uint32_t j = 0; j < half; j++) {
+                const float dRe = aRe[j] - bRe[j];
+                const float dIm = aIm[j] - bIm[j];
+                aRe[j] += bRe[j];
+                aIm[j] += bIm[j];
+                bRe[j] = dRe * wr[j] - dIm * wi[j];
+                bIm[j] = dRe * wi[j] + dIm * wr[j];
+            }
+        }
+    }
+}
+
+/// <summary>
+/// In place inverse transform (without the 1 / fftSize), radix-2 decimation in time: bit reversed order in, natural out
+/// </summary>
+void VelocityAutocorrelation::fftInverse(float* re, float* im) const {
+    for (uint32_t half = 1; half < fftSize; half *= 2) {
+        const float* wr = &twiddleReal[half];
+        const float* wi = &twiddleImag[half];
+        for (uint32_t start = 0; start < fftSize; start += 2 * half) {
+            float* aRe = re + start;
+            float* aIm = im + start;
+            float* bRe = aRe + half;
+            float* bIm = aIm + half;
+            for (uint32_t j = 0; j < half; j++) {
+                // conjugate twiddles
+                const float tRe = bRe[j] * wr[j] + bIm[j] * wi[j];
+                const float tIm = bIm[j] * wr[j] - bRe[j] * wi[j];
+                bRe[j] = aRe[j] - tRe;
+                bIm[j] = aIm[j] - tIm;
+                aRe[j] += tRe;
+                aIm[j] += tIm;
+            }
+        }
+    }
+}
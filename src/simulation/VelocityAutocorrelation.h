@@ -0,0 +1,106 @@
+#pragma once
+
+#include "ofMain.h"
+#include "particles.h"
+#include "MultiTauCorrelator.h"
+#include <vector>
+
+// VAC (Velocity Autocorrelation Function) structures
+struct VACData {
+    std::vector<float> vacValues;           // VAC(t) values for each time lag
+    std::vector<float> timePoints;          // Time points corresponding to each VAC value
+    uint32_t maxTimeLags;                   // Maximum number of time lags to calculate
+    uint32_t currentFrame;                  // Samples taken so far
+    bool isEnabled;                         // Whether VAC calculation is enabled
+    uint32_t lastCalculationFrame;          // Sample of the last calculation
+    uint32_t timeOrigins;                   // Samples averaged as t=0 in the last calculation
+
+    VACData() : maxTimeLags(60), currentFrame(0), isEnabled(true), lastCalculationFrame(0), timeOrigins(0) {
+        vacValues.resize(maxTimeLags, 0.0f);
+        timePoints.resize(maxTimeLags);
+        for (uint32_t i = 0; i < maxTimeLags; i++) {
+            timePoints[i] = static_cast<float>(i) * 0.01f;
+        }
+    }
+};
+
+enum class VACMode {
+    DIRECT = 0, // newest sample as the only time origin, O(lags x particles)
+    FFT = 1,    // all the time origins of the history, through the power spectrum of each particle (Wiener-Khinchin)
+    MULTI_TAU = 2, // streaming, on logarithmic lags up to minutes, without the history
+    COUNT
+};
+
+/// <summary>
+/// Velocity auto-correlation of the particles, over a history of their velocities of the last MAX_FRAMES samples,
+/// or, in multi-tau mode, updated on every sample by a MultiTauCorrelator that needs no history
+/// The states of the simulation come at uneven steps of simulated time (adaptive timestep, a varying amount of steps per
+/// tick), so they are resampled every SAMPLE_INTERVAL of simulated time, interpolated between the two states around
+/// each sample: a lag is the same time whatever the frame rate and the timestep
+/// The fft mode correlates every sample of the history with every other one at once: the velocity series of a particle,
+/// zero padded, goes to the frequency domain, the power spectra of all the particles are summed, and the sum goes back
+/// as the correlation summed over particles and time origins. The particles are done in slices over calculationInterval
+/// samples (more if a slice would go over FFT_PARTICLES_PER_FRAME), on a window of the history that stays the same until the last slice
+/// </summary>
+class VelocityAutocorrelation {
+public:
+    static constexpr uint32_t MAX_FRAMES = 512;
+    static constexpr double SAMPLE_INTERVAL = 0.01; // simulated seconds, the reference step of the simulation
+
+    void setup();
+
+    /// <summary>
+    /// Add the velocities of a state of the simulation, simulatedTime seconds after startup, and advance the calculation
+    /// for every sample time it passed; vacValues change when a calculation is finished (every calculationInterval
+    /// samples, or more in fft mode with many particles; every sample in multi-tau mode)
+    /// </summary>
+    void add(const std::vector<glm::vec2>& velocities, double simulatedTime, VACData& data, VACMode mode, uint32_t calculationInterval);
+
+private:
+    void update(const std::vector<glm::vec2>& velocities, VACData& data, VACMode mode, uint32_t sampleNumber, uint32_t calculationInterval);
+    void setMode(VACMode newMode);
+    void updateLayout(VACData& data);
+    void storeFrame(const std::vector<glm::vec2>& velocities);
+    void calculateDirect(VACData& data, uint32_t sampleNumber, uint32_t calculationInterval);
+    void startFft(const VACData& data, uint32_t calculationInterval);
+    void continueFft(VACData& data, uint32_t sampleNumber);
+    void setupFftSize(uint32_t size);
+    void fftForward(float* re, float* im) const;
+    void fftInverse(float* re, float* im) const;
+
+    VACMode mode = VACMode::FFT;
+    uint32_t layoutTimeLags = 0; // maxTimeLags the VAC values were laid out for, 0 to lay them out again
+
+    // resampling on simulated time
+    std::vector<glm::vec2> lastVelocities; // of the last state added
+    double lastTime = 0.0;
+    double sampleOrigin = 0.0;             // simulated time of the first sample
+    uint64_t nextSample = 0;               // index of the next sample from sampleOrigin
+    bool hasLastState = false;
+    std::vector<glm::vec2> sample;
+
+    std::vector<std::vector<glm::vec2>> velocityHistory; // by sample % MAX_FRAMES, then particle
+    uint32_t storedFrames = 0;
+
+    MultiTauCorrelator multiTau;
+
+    // fft calculation in progress
+    bool fftRunning = false;
+    uint32_t windowStart = 0;       // first history sample of the window
+    uint32_t windowLength = 0;
+    uint32_t fftTimeLags = 0;
+    uint32_t fftParticleCount = 0;
+    uint32_t nextParticle = 0;
+    uint32_t particlesPerFrame = 0;
+    std::vector<double> powerSpectrum;
+    std::vector<float> seriesReal;  // PARTICLE_BLOCK series of fftSize
+    std::vector<float> seriesImag;
+
+    // radix-2 twiddles of the current fft size
+    uint32_t fftSize = 0;
+    std::vector<float> twiddleReal;
+    std::vector<float> twiddleImag;
+
+    static constexpr uint32_t PARTICLE_BLOCK = 16; // particles gathered at once from each history sample
+    static constexpr uint32_t FFT_PARTICLES_PER_FRAME = 512; // a few milliseconds of transforms
+};
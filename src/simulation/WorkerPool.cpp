@@ -0,0 +1,93 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+/// <summary>
+/// Start the pool threads
+/// </summary>
+/// <param name="threadCount">total threads including the caller, 0 uses all the available cores</param>
+WorkerPool::WorkerPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 1; i < threadCount; i++) {
+        workers.emplace_back(&WorkerPool::workerLoop, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+/// <summary>
+/// Run fn over [0, count) split in chunks, blocking until all the chunks are done
+/// The calling thread works on chunks too
+/// </summary>
+/// <param name="count">size of the range</param>
+/// <param name="fn">fn(begin, end, workerIndex)</param>
+/// <param name="minChunkSize">smaller ranges than this are not worth to send to other threads</param>
+void WorkerPool::parallelFor(size_t count, const RangeFunction& fn, size_t minChunkSize) {
+    if (count == 0) return;
+
+    // a few chunks per thread, so faster threads can take over the work of the slower ones
+    size_t chunks = std::max<size_t>(1, std::min(size() * 4, count / std::max<size_t>(1, minChunkSize)));
+
+    if (workers.empty() || chunks == 1) {
+        fn(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        chunkSize = (count + chunks - 1) / chunks;
+        nextChunk = 0;
+        activeWorkers = workers.size();
+        generation++;
+    }
+    jobReady.notify_all();
+
+    runChunks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this] { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::runChunks(size_t workerIndex) {
+    while (true) {
+        size_t begin = nextChunk.fetch_add(1) * chunkSize;
+        if (begin >= jobCount) break;
+        size_t end = std::min(begin + chunkSize, jobCount);
+        (*job)(begin, end, workerIndex);
+    }
+}
+
+void WorkerPool::workerLoop(size_t workerIndex) {
+    uint64_t lastGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [&] { return stopping || generation != lastGeneration; });
+            if (stopping) return;
+            lastGeneration = generation;
+        }
+
+        runChunks(workerIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeWorkers--;
+        }
+        jobDone.notify_one();
+    }
+}
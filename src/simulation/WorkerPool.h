@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+/// <summary>
+/// Persistent pool of worker threads used to split the CPU work (physics, blur, ...) across all cores
+/// Threads are created once and sleep between jobs, so a parallelFor call does not spawn threads every frame
+/// </summary>
+class WorkerPool {
+public:
+    /// <summary>
+    /// job callback: fn(begin, end, workerIndex), workerIndex is in [0, size()) and can be used to index per-thread scratch data
+    /// </summary>
+    using RangeFunction = std::function<void(size_t, size_t, size_t)>;
+
+    explicit WorkerPool(size_t threadCount = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /// <summary>
+    /// number of threads taking part in a job, including the calling thread
+    /// </summary>
+    size_t size() const { return workers.size() + 1; }
+
+    void parallelFor(size_t count, const RangeFunction& fn, size_t minChunkSize = 64);
+
+private:
+    void workerLoop(size_t workerIndex);
+    void runChunks(size_t workerIndex);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+
+    const RangeFunction* job = nullptr;
+    size_t jobCount = 0;
+    size_t chunkSize = 1;
+    std::atomic<size_t> nextChunk{ 0 };
+    size_t activeWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
@@ -12,17 +12,16 @@ void ParticleSystem::setup(size_t maxPoolSize, size_t initialAmount) {
 
     pool.resize(maxPoolSize);
 
-    int i = 0;
     // Initialize the particles in the pool
-    for (auto& p : pool) {
-        //p.index = i++;
+    for (size_t i = 0; i < maxPoolSize; i++) {
         // Set initial position, velocity, etc.
-        p.position.x = ofRandom(1, ofGetWidth()-2);
-        p.position.y = ofRandom(1, ofGetHeight()-2);
-        p.velocity = glm::vec2(ofRandom(-10.0f, 10.0f), ofRandom(-10.0f, 10.0f));
-        p.mass = 5.0;
-        p.radius = 2.0;
+        pool.x[i] = ofRandom(1, ofGetWidth()-2);
+        pool.y[i] = ofRandom(1, ofGetHeight()-2);
+        pool.vx[i] = ofRandom(-10.0f, 10.0f);
+        pool.vy[i] = ofRandom(-10.0f, 10.0f);
     }
+    mass = 5.0;
+    radius = 2.0;
 
     active = pool;
 
@@ -41,28 +40,47 @@ void ParticleSystem::resize(size_t newActiveAmount) {
 
     if (currentSize == newSize) return;
 
-    //active = std::vector<Particle>(pool.begin(), pool.begin() + newSize); // basic vector copy, works but does not update pool back with modified active info
+    //active = ParticleArrays(pool.begin(), pool.begin() + newSize); // basic vector copy, works but does not update pool back with modified active info
 
     // COMMENT: I wanted to use vector views, because it is more performant: active would be a limited size reference to the original pool vector, so needs zero processing, but I got compilation errors, maybe due the of compiling flags 
 
     if (newSize < currentSize) { // remove items from active
 
         // first update the pool with current active values
-        for (int i = newSize; i < currentSize; i++) {
-            pool[i] = active[i];
-        }
+        pool.copyRange(active, newSize, currentSize - newSize);
 
         // then, remove the excedent from active
-        active.erase(active.begin() + newSize, active.end());
+        active.resize(newSize);
     }
     else if (newSize > currentSize) {  // add elements to active from pool
-        for (int i = currentSize; i < newSize; ++i) {
-            //pool[i].radius = pool[1].radius;
-            active.push_back(pool[i]);
-        }
+        active.resize(newSize);
+        active.copyRange(pool, currentSize, newSize - currentSize);
     }
 }
 
+/// <summary>
+/// Save the active positions before a backend replaces them with a new state
+/// </summary>
+/// <param name="steps">simulation steps between the saved state and the new one</param>
+void ParticleSystem::keepPreviousPositions(uint32_t steps) {
+    previousX = active.x;
+    previousY = active.y;
+    previousSteps = std::max(1u, steps);
+    stateGeneration++;
+}
+
+/// <summary>
+/// Position of an active particle at the render time, between the last two simulation steps
+/// Particles that were not in the previous step (the active set grew) are not interpolated
+/// </summary>
+glm::vec2 ParticleSystem::getInterpolatedPosition(size_t i) const {
+    glm::vec2 position = active.getPosition(i);
+    if (i >= previousX.size()) return position;
+
+    glm::vec2 previous(previousX[i], previousY[i]);
+    return previous + (position - previous) * interpolation;
+}
+
 /// <summary>
 /// Get the size of the active set
 /// </summary>
@@ -73,26 +91,23 @@ size_t ParticleSystem::size() {
 
 
 /// <summary>
-/// Update the radius in all particles, active and pool
-/// TODO: If radius is allways the same for all particles, we must use a single variable (maybe on the particle system) instead of having it on each particle, mostly because radius is a visual property not used in the simulation (not as mass for example)
+/// Update the radius of all particles, active and pool
 /// </summary>
 /// <param name="newRadiuses"></param>
 void ParticleSystem::updateRadiuses(float newRadiuses) {
-    for (auto &p : active) {
-        p.radius = newRadiuses;
-    }
-    for (auto &p : pool) {
-        p.radius = newRadiuses;
-    }
+    radius = newRadiuses;
 }
 
 /// <summary>
 // Randomize the positions for the pool particles when screen is resized
 // so, they are ready to fill the new screen size, not always at their initial positions
+// Called by the simulation tick: the size is the one of the tick, and the generator its own (ofRandom is not thread safe)
 /// </summary>
-void ParticleSystem::randomizePoolPositions() {
-	for (auto& p : pool) {
-		p.position.x = ofRandom(1, ofGetWidth() - 2);
-		p.position.y = ofRandom(1, ofGetHeight() - 2);
+void ParticleSystem::randomizePoolPositions(float width, float height, std::mt19937& random) {
+	std::uniform_real_distribution<float> randomX(1.0f, std::max(width - 2.0f, 1.0f));
+	std::uniform_real_distribution<float> randomY(1.0f, std::max(height - 2.0f, 1.0f));
+	for (size_t i = 0; i < pool.size(); i++) {
+		pool.x[i] = randomX(random);
+		pool.y[i] = randomY(random);
 	}
 }
@@ -1,27 +1,80 @@
 #pragma once
 #include <vector>
 #include <algorithm>
+#include <new>
+#include <random>
 //#include <ranges>
 #include "ofMain.h"
 
 /// <summary>
-/// Partice structure to hold all data from a single particle
+/// Allocator for the particle arrays, aligned so the simulation kernels can use aligned SIMD loads (32 bytes, AVX)
 /// </summary>
-struct Particle {
-    //int index;
+template <typename T, size_t Alignment = 32>
+struct AlignedAllocator {
+    using value_type = T;
 
-    glm::vec2 position;
-    glm::vec2 velocity;
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
 
-    float radius = 2.0;
-    float mass = 5.0;
-    //float kineticEnergy = 1.0;
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+using ParticleArray = std::vector<float, AlignedAllocator<float>>;
+
+/// <summary>
+/// A set of particles stored as structure of arrays: one contiguous array per component
+/// Keeps the data the simulation streams through (positions and velocities) packed, 16 bytes per particle
+/// </summary>
+struct ParticleArrays {
+    ParticleArray x;
+    ParticleArray y;
+    ParticleArray vx;
+    ParticleArray vy;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void resize(size_t count) {
+        x.resize(count);
+        y.resize(count);
+        vx.resize(count);
+        vy.resize(count);
+    }
+
+    void swap(ParticleArrays& other) {
+        x.swap(other.x);
+        y.swap(other.y);
+        vx.swap(other.vx);
+        vy.swap(other.vy);
+    }
+
+    glm::vec2 getPosition(size_t i) const { return glm::vec2(x[i], y[i]); }
+    glm::vec2 getVelocity(size_t i) const { return glm::vec2(vx[i], vy[i]); }
 
-    //std::vector<float> minimumDistance;
-    //std::vector<float> LJenergyTermA;
-    //std::vector<float> LJenergyTermB;
-    //std::vector<float> LJgradientTermA;
-    //std::vector<float> LJgradientTermB;
+    /// <summary>
+    /// Copy the range [from, from + count) of another set to this one, at the same indices
+    /// </summary>
+    void copyRange(const ParticleArrays& other, size_t from, size_t count) {
+        std::copy_n(other.x.begin() + from, count, x.begin() + from);
+        std::copy_n(other.y.begin() + from, count, y.begin() + from);
+        std::copy_n(other.vx.begin() + from, count, vx.begin() + from);
+        std::copy_n(other.vy.begin() + from, count, vy.begin() + from);
+    }
 };
 
 
@@ -29,6 +82,7 @@ struct Particle {
 /// Particle system responsible of provide new particles to the simulation
 /// Creates a pool from the begining from which takes in out particles
 /// Pool is in sync from the active particle updates
+/// Radius and mass are the same for every particle, so they are kept once for the whole system
 /// </summary>
 class ParticleSystem {
 public:
@@ -37,20 +91,41 @@ public:
     /// <summary>
     /// The active particle set, the one used by the simulation
     /// </summary>
-    std::vector<Particle> active;
-    
+    ParticleArrays active;
+
     /// <summary>
     /// Holds the larger pool set from where new particles comes from
     /// </summary>
-    std::vector<Particle> pool;
+    ParticleArrays pool;
+
+    float radius = 2.0;
+    float mass = 5.0;
+
+    /// <summary>
+    /// Positions of the active set before the last state a backend delivered, the render interpolates from them to the active ones
+    /// </summary>
+    ParticleArray previousX;
+    ParticleArray previousY;
+    uint32_t previousSteps = 1;     // simulation steps from the previous positions to the active ones
+    uint64_t stateGeneration = 0;   // increased every time a backend delivers a new state
+    double stateTime = 0.0;         // simulated seconds of the active state since startup, set by the backend with it
+
+    /// <summary>
+    /// Where the render time is between the previous and the active positions [0..1]
+    /// </summary>
+    float interpolation = 1.0f;
 
     void setup(size_t maxPoolSize, size_t initialAmount);
 
+    void keepPreviousPositions(uint32_t steps = 1);
+
+    glm::vec2 getInterpolatedPosition(size_t i) const;
+
     void resize(size_t newActiveCount);
 
     size_t size();
 
     void updateRadiuses(float newRadius);
 
-	void randomizePoolPositions();
+	void randomizePoolPositions(float width, float height, std::mt19937& random);
 };
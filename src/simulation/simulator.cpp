@@ -1,9 +1,15 @@
 #include "simulator.h"
+#include "GpuSimulationBackend.h"
+#include "CpuSimulationBackend.h"
 #include "ofLog.h"
 #include <iomanip>
 #include <algorithm>
 #include <numeric>
 
+Simulator::~Simulator() {
+    stopThread();
+}
+
 void Simulator::setup(SimulationParameters* params, GuiApp* globalParams) {
     parameters = params;
     globalParameters = globalParams;
@@ -11,21 +17,20 @@ void Simulator::setup(SimulationParameters* params, GuiApp* globalParams) {
     particles.setup(parameters->amount.getMax(), parameters->amount);
     particles.updateRadiuses(parameters->radius);
 
-    setupComputeShader();
     setupCollisionBuffer();
-    setupClusterAnalysis();
-    setupVACAnalysis();
+    analysisWorker.setup(MIN_CLUSTER_SIZE, MAX_CLUSTERS_PER_FRAME);
 
-    glGenTextures(1, &depthFieldTexture);
-    glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // the first tick starts from the current settings, and the render from the initial particles
+    shareControls();
+    tickControls = sharedControls;
+    appliedWorldSizeGeneration = tickControls.worldSizeGeneration;
+    appliedPoolResetGeneration = tickControls.poolResetGeneration;
+    publishState(0);
+    states.update();
 
-    std::vector<float> initialDepth(width * height, 0.5f);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, initialDepth.data());
-    glBindTexture(GL_TEXTURE_2D, 0);
+    setupBackend();
+    lastClockTime = ofGetElapsedTimef();
+    startThread();
 
     parameters->amount.addListener(this, &Simulator::onGUIChangeAmmount);
     parameters->radius.addListener(this, &Simulator::onGUIChangeRadius);
@@ -34,307 +39,442 @@ void Simulator::setup(SimulationParameters* params, GuiApp* globalParams) {
     parameters->coupling.addListener(this, &Simulator::onCouplingChanged);
     parameters->depthFieldScale.addListener(this, &Simulator::onDepthFieldScaleChanged);
     parameters->enableCollisionLogging.addListener(this, &Simulator::onCollisionLoggingChanged);
+    parameters->useCpuSimulation.addListener(this, &Simulator::onUseCpuSimulationChanged);
 
 
     globalParameters->renderParameters.windowSize.addListener(this, &Simulator::onRenderwindowResize);
+}
+
+/// <summary>
+/// Creates the physics backend: the compute shader one, unless the cpu is requested or the gpu can not run it
+/// </summary>
+void Simulator::setupBackend() {
+    backend.reset();
+
+    if (!parameters->useCpuSimulation) {
+        backend = std::make_unique<GpuSimulationBackend>();
+        if (!backend->setup(particles, MAX_COLLISIONS_PER_FRAME)) {
+            ofLogWarning("Simulator::setupBackend") << "GPU simulation not available, falling back to the CPU";
+            backend.reset();
+        }
+    }
+
+    if (!backend) {
+        backend = std::make_unique<CpuSimulationBackend>();
+        backend->setup(particles, MAX_COLLISIONS_PER_FRAME);
+    }
 
-    // Create and initialize the SSBO
-    glGenBuffers(1, &ssboParticles);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, particles.active.size() * sizeof(Particle), particles.active.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // the new backend starts without the current depth field (the last frame the ticks took)
+    updateDepthField();
+    lastNeighbourListRebuilds = backend->getNeighbourListRebuilds();
+
+    ofLogNotice("Simulator::setupBackend") << "Simulation running on the " << backend->getName();
 }
 
 void Simulator::setupCollisionBuffer() {
-    // Initialize internal collision buffer for GPU operations
+    // Initialize internal collision buffer for the backend
+    static_cast<CollisionSummary&>(collisionBuffer) = {};
     collisionBuffer.maxCollisions = MAX_COLLISIONS_PER_FRAME;
-    collisionBuffer.collisionCount = 0;
-    collisionBuffer.frameNumber = 0;
-    collisionBuffer.padding = 0;
     collisionBuffer.collisions.resize(MAX_COLLISIONS_PER_FRAME);
 
-    // Initialize public collision data (for external access)
-    collisionData.maxCollisions = MAX_COLLISIONS_PER_FRAME;
-    collisionData.collisionCount = 0;
-    collisionData.frameNumber = 0;
-    collisionData.padding = 0;
-    collisionData.collisions.resize(MAX_COLLISIONS_PER_FRAME);
+    // Initialize public collision summary (for external access)
+    collisionSummary = collisionBuffer;
+    tickCollisionSummary = collisionBuffer;
+}
 
-    // Create GPU buffer
-    glGenBuffers(1, &ssboCollisions);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
+/// <summary>
+/// Main thread side of a frame: hand the settings to the simulation (and run it, when it has no thread),
+/// then pick the newest published state and analysis for the render, the audio and the gui
+/// </summary>
+void Simulator::update() {
+    shareControls();
+    if (!simulationThread.joinable()) {
+        tick();
+    }
+
+    // the newest analysis the worker finished, if any
+    analysisWorker.collect();
 
-    // Calculate total buffer size: header (4 uints) + collision array
-    size_t headerSize = 4 * sizeof(uint32_t);
-    size_t collisionArraySize = MAX_COLLISIONS_PER_FRAME * sizeof(CollisionData);
-    size_t totalBufferSize = headerSize + collisionArraySize;
+    const bool newState = states.update();
+    SimulationState& state = states.getReadBuffer();
 
-    glBufferData(GL_SHADER_STORAGE_BUFFER, totalBufferSize, nullptr, GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCollisions);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    parameters->simulationSteps = static_cast<float>(state.stepCount - lastStepCount);
+    lastStepCount = state.stepCount;
+
+    if (newState) {
+        parameters->deltaTime = state.deltaTime;
+        parameters->readbackWaitTime = state.readbackWaitTime;
+        parameters->neighbourListRebuildRate = state.neighbourListRebuildRate;
+        parameters->cameraLatency = state.cameraLatency;
+        collisionSummary = state.collisions;
+    }
 
-    ofLogNotice("Simulator::setupCollisionBuffer") << "Collision buffer created with " << MAX_COLLISIONS_PER_FRAME << " max collisions";
+    // the render time between the last two steps, the simulated time goes on after the state was published
+    state.particles.interpolation = ofClamp((ofGetElapsedTimef() - state.publishTime) / state.stepDuration, 0.0f, 1.0f);
 }
 
-void Simulator::setupComputeShader() {
-    computeShaderProgram = glCreateProgram();
-    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+/// <summary>
+/// The backends that do not need the main thread get a thread of their own
+/// </summary>
+void Simulator::startThread() {
+    if (simulationThread.joinable() || !backend || backend->needsMainThread()) return;
 
-    std::string shaderCode = ofBufferFromFile("shaders/particlesComputeShader.glsl").getText();
-    const char* shaderSource = shaderCode.c_str();
-    glShaderSource(computeShader, 1, &shaderSource, nullptr);
-    glCompileShader(computeShader);
+    threadStopping = false;
+    simulationThread = std::thread(&Simulator::threadLoop, this);
+    ofLogNotice("Simulator::startThread") << "Simulation running on its own thread";
+}
 
-    GLint compileStatus;
-    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus != GL_TRUE) {
-        char buffer[512];
-        glGetShaderInfoLog(computeShader, 512, nullptr, buffer);
-        ofLogError() << "Shader compilation failed: " << buffer;
-    }
+void Simulator::stopThread() {
+    if (!simulationThread.joinable()) return;
 
-    glAttachShader(computeShaderProgram, computeShader);
-    glLinkProgram(computeShaderProgram);
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        threadStopping = true;
+    }
+    threadWake.notify_one();
+    simulationThread.join();
+}
 
-    GLint linkStatus;
-    glGetProgramiv(computeShaderProgram, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus != GL_TRUE) {
-        char buffer[512];
-        glGetProgramInfoLog(computeShaderProgram, 512, nullptr, buffer);
-        ofLogError() << "Program linking failed: " << buffer;
+/// <summary>
+/// Tick, then sleep until the simulated time reaches the next step
+/// </summary>
+void Simulator::threadLoop() {
+    while (true) {
+        tick();
+
+        const float wait = std::max((deltaTime - stepAccumulator) / simulationSpeed, 0.0005f);
+        std::unique_lock<std::mutex> lock(threadMutex);
+        threadWake.wait_for(lock, std::chrono::duration<float>(wait), [this] { return threadStopping; });
+        if (threadStopping) return;
     }
+}
+
+/// <summary>
+/// Run the steps the clock asks for with the latest settings and camera frame, and publish the results
+/// </summary>
+void Simulator::tick() {
+    currentFrameNumber++;
+    applyControls();
 
-    glDeleteShader(computeShader);
-
-    // Set uniforms only once
-    deltaTimeLocation = glGetUniformLocation(computeShaderProgram, "deltaTime");
-    worldSizeLocation = glGetUniformLocation(computeShaderProgram, "worldSize");
-    targetTemperatureLocation = glGetUniformLocation(computeShaderProgram, "targetTemperature");
-    couplingLocation = glGetUniformLocation(computeShaderProgram, "coupling");
-    applyThermostatLocation = glGetUniformLocation(computeShaderProgram, "applyThermostat");
-    depthFieldScaleLocation = glGetUniformLocation(computeShaderProgram, "depthFieldScale");
-    videoOffsetLocation = glGetUniformLocation(computeShaderProgram, "videoOffset");
-    videoScaleLocation = glGetUniformLocation(computeShaderProgram, "videoScale");
-    sourceSizeLocation = glGetUniformLocation(computeShaderProgram, "sourceSize");
-    ljEpsilonLocation = glGetUniformLocation(computeShaderProgram, "ljEpsilon");
-    ljCutoffLocation = glGetUniformLocation(computeShaderProgram, "ljCutoff");
-    maxForceLocation = glGetUniformLocation(computeShaderProgram, "maxForce");
-    depthFieldLocation = glGetUniformLocation(computeShaderProgram, "depthField");
-    enableCollisionLoggingLocation = glGetUniformLocation(computeShaderProgram, "enableCollisionLogging");
-}
-
-void Simulator::setupClusterAnalysis() {
-    clusterData.clusterCount = 0;
-    clusterData.frameNumber = 0;
-    clusterData.minClusterSize = MIN_CLUSTER_SIZE;
-    clusterData.maxClusters = MAX_CLUSTERS_PER_FRAME;
-    clusterData.clusters.resize(MAX_CLUSTERS_PER_FRAME);
+    int steps = runSimulationSteps();
+
+    // ticks faster than the simulation rate have nothing new to analyze
+    if (steps == 0) return;
     
-    ofLogNotice("Simulator::setupClusterAnalysis") << "Cluster analysis initialized with min size: " << MIN_CLUSTER_SIZE 
-              << ", connection distance: " << clusterConnectionDistance;
+    // the backend may have no new results yet (asynchronous readback), collisions are only published once
+    if (tickControls.enableCollisionLogging && collisionBuffer.frameNumber != lastCollisionFrame) {
+        publishCollisions();
+    }
+
+    submitAnalysis();
+
+    publishState(steps);
 }
 
-void Simulator::setupVACAnalysis() {
-    velocityHistory.clear();
-    velocityHistory.resize(maxVelocityFrames);
-    
-    // Initialize each frame's velocity storage for ensemble center-of-mass velocity (single vec2 per frame)
-    for (auto& frame : velocityHistory) {
-        frame.resize(1); // Only store one velocity per frame (the ensemble velocity)
+/// <summary>
+/// Main thread: copy the parameters and settings the ticks use to the shared controls
+/// </summary>
+void Simulator::shareControls() {
+    controls.amount = static_cast<size_t>(parameters->amount.get());
+    controls.radius = parameters->radius.get();
+    controls.worldSize = parameters->worldSize.get();
+    controls.pairPotential = parameters->pairPotential.get();
+    controls.enableCollisionLogging = parameters->enableCollisionLogging.get();
+    controls.applyThermostat = applyThermostat;
+    controls.targetTemperature = targetTemperature;
+    controls.coupling = coupling;
+    controls.depthFieldScale = depthFieldScale;
+    controls.enableClusterAnalysis = enableClusterAnalysis;
+    controls.clusterConnectionDistance = clusterConnectionDistance;
+    controls.enableVACCalculation = enableVACCalculation;
+    controls.vacMode = vacMode;
+    controls.vacCalculationInterval = vacCalculationInterval;
+    controls.vacMaxTimeLags = vacMaxTimeLags;
+
+    std::lock_guard<std::mutex> lock(controlsMutex);
+    sharedControls = controls;
+}
+
+/// <summary>
+/// Tick side: take the latest settings and apply the ones that change the particles or the backend
+/// </summary>
+void Simulator::applyControls() {
+    {
+        std::lock_guard<std::mutex> lock(controlsMutex);
+        tickControls = sharedControls;
+    }
+
+    if (tickControls.worldSizeGeneration != appliedWorldSizeGeneration) {
+        appliedWorldSizeGeneration = tickControls.worldSizeGeneration;
+        width = tickControls.width;
+        height = tickControls.height;
+    }
+    if (tickControls.poolResetGeneration != appliedPoolResetGeneration) {
+        appliedPoolResetGeneration = tickControls.poolResetGeneration;
+        particles.randomizePoolPositions(static_cast<float>(tickControls.width), static_cast<float>(tickControls.height), poolRandom);
+    }
+
+    videoRect = tickControls.videoRect;
+    videoScaleX = videoRect.width / sourceWidth;
+    videoScaleY = videoRect.height / sourceHeight;
+
+    if (tickControls.amount != particles.active.size()) {
+        particles.resize(tickControls.amount);
+        backend->uploadParticles(particles);
+    }
+    // the radius reaches the backends with every step (particleRadius uniform), nothing to upload
+    if (static_cast<float>(tickControls.radius) != particles.radius) {
+        particles.updateRadiuses(tickControls.radius);
+    }
+
+    if (depthFrames.update()) {
+        hasDepthField = true;
+        const uint64_t captureTime = depthFrames.getReadBuffer().captureTime;
+        if (captureTime != 0) cameraLatency = (ofGetElapsedTimeMicros() - captureTime) / 1000.0f;
+        updateDepthField();
     }
-    
-    vacData = VACData(); // Reset VAC data
-    
-    ofLogNotice("Simulator::setupVACAnalysis") << "VAC analysis initialized with " 
-              << maxVelocityFrames << " frames history, using ensemble center-of-mass velocity";
 }
 
-void Simulator::update() {
-    currentFrameNumber++;
-    updateParticlesOnGPU();
-    
-    if (parameters->enableCollisionLogging) {
-        readCollisionData();
-        // Copy internal collision data to public collision data for external access
-        collisionData = collisionBuffer;
+/// <summary>
+/// Copy the particles and the stats of the tick for the main thread
+/// </summary>
+void Simulator::publishState(int steps) {
+    SimulationState& state = states.getWriteBuffer();
+    state.particles.active = particles.active;
+    state.particles.previousX = particles.previousX;
+    state.particles.previousY = particles.previousY;
+    state.particles.radius = particles.radius;
+    state.particles.mass = particles.mass;
+    state.particles.maxPoolSize = particles.maxPoolSize;
+    state.collisions = tickCollisionSummary;
+
+    stepCount += steps;
+    state.stepCount = stepCount;
+    // the interpolation only restarts when a backend delivered a new state, ticks without one (the gpu results are
+    // not ready yet) keep interpolating between the same two states instead of freezing on the newest one
+    if (particles.stateGeneration != publishedStateGeneration) {
+        publishedStateGeneration = particles.stateGeneration;
+        statePublishTime = ofGetElapsedTimef() - stepAccumulator / simulationSpeed;
+        stateStepDuration = deltaTime * particles.previousSteps / simulationSpeed;
     }
-    
-    // Perform cluster analysis if enabled (independent of collision logging)
-    if (enableClusterAnalysis) {
-        analyzeParticleClusters();
+    state.publishTime = statePublishTime;
+    state.stepDuration = stateStepDuration;
+    state.deltaTime = deltaTime;
+    state.readbackWaitTime = backend ? backend->getReadbackWaitTime() : 0.0f;
+    state.neighbourListRebuildRate = neighbourListRebuildRate;
+    state.cameraLatency = cameraLatency;
+
+    states.publish();
+}
+
+/// <summary>
+/// Hand copies of the particles to the analysis thread, the results come back on a later frame: the newest particles for
+/// the clusters, and the velocities of every new state the backend delivered (with its simulated time) for the VAC
+/// </summary>
+void Simulator::submitAnalysis() {
+    if (tickControls.enableClusterAnalysis) {
+        AnalysisInput& input = analysisWorker.getInput();
+        input.particles = particles.active;
+        input.worldSize = tickControls.worldSize;
+        input.frameSize = glm::vec2(width, height);
+        input.frameNumber = currentFrameNumber;
+        input.clusterConnectionDistance = tickControls.clusterConnectionDistance;
+        analysisWorker.submit();
     }
-    
-    // Store velocity data and calculate VAC if enabled
-    if (enableVACCalculation) {
-        storeVelocityFrame();
-        // Calculate VAC less frequently for better performance
-        if ((currentFrameNumber % vacCalculationInterval) == 0) {
-            calculateVAC();
-        }
+
+    if (tickControls.enableVACCalculation && particles.stateGeneration != analyzedStateGeneration) {
+        analysisWorker.submitVelocities(particles.active, particles.stateTime, tickControls.vacMode,
+            tickControls.vacCalculationInterval, tickControls.vacMaxTimeLags);
     }
+    analyzedStateGeneration = particles.stateGeneration;
 }
 
-void Simulator::updateParticlesOnGPU() {
-    // Reset collision counter for this frame
-    if (parameters->enableCollisionLogging) {
-        collisionBuffer.collisionCount = 0;
-        collisionBuffer.frameNumber = currentFrameNumber;
+/// <summary>
+/// Simulation clock: the real time since the last frame is accumulated (as simulated time) and consumed in steps of deltaTime,
+/// so the physics runs at the same speed whatever the frame rate of the app
+/// The time left in the accumulator sets the render interpolation between the last two delivered states (publishState)
+/// </summary>
+/// <returns>amount of steps run in this tick</returns>
+int Simulator::runSimulationSteps() {
+    float now = ofGetElapsedTimef();
+    stepAccumulator += (now - lastClockTime) * simulationSpeed;
+    lastClockTime = now;
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(uint32_t), &collisionBuffer);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    const uint64_t budgetStart = ofGetElapsedTimeMicros();
+    int steps = 0;
+
+    while (stepAccumulator >= deltaTime && steps < maxSubsteps) {
+        updateParticles();
+        stepAccumulator -= deltaTime;
+        steps++;
+
+        updateDeltaTime();
+
+        if (ofGetElapsedTimeMicros() - budgetStart > substepBudget * 1000.0f) break;
     }
 
-    glUseProgram(computeShaderProgram);
-
-    glUniform1f(deltaTimeLocation, 0.01f);
-    glUniform2f(worldSizeLocation, parameters->worldSize->x, parameters->worldSize->y);
-    glUniform1f(targetTemperatureLocation, targetTemperature);
-    glUniform1f(couplingLocation, coupling);
-    glUniform1i(applyThermostatLocation, applyThermostat ? 1 : 0);
-    glUniform1f(depthFieldScaleLocation, hasDepthField ? depthFieldScale : 0.0f);
-    glUniform2f(videoOffsetLocation, videoRect.x, videoRect.y);
-    glUniform2f(videoScaleLocation, videoScaleX, videoScaleY);
-    glUniform2f(sourceSizeLocation, sourceWidth, sourceHeight);
-    glUniform1f(ljEpsilonLocation, ljEpsilon);
-    glUniform1f(ljCutoffLocation, ljCutoff);
-    glUniform1f(maxForceLocation, maxForce);
-    glUniform1i(enableCollisionLoggingLocation, parameters->enableCollisionLogging ? 1 : 0);
-
-    // Bind depth field texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
-    glUniform1i(depthFieldLocation, 0);
-
-    // Bind particle buffer and collision buffer
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboParticles);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssboCollisions);
-
-    glDispatchCompute((particles.active.size() + 511) / 512, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-    // Read back particle data
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles);
-    Particle* ptr = (Particle*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    memcpy(particles.active.data(), ptr, particles.active.size() * sizeof(Particle));
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-}
-
-void Simulator::readCollisionData() {
-    // Read back collision data from GPU
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboCollisions);
-
-    // First read the header to get collision count
-    uint32_t* headerPtr = (uint32_t*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(uint32_t), GL_MAP_READ_BIT);
-    if (headerPtr) {
-        collisionBuffer.collisionCount = headerPtr[0];
-        collisionBuffer.maxCollisions = headerPtr[1];
-        collisionBuffer.frameNumber = headerPtr[2];
-        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-        // If there are collisions, read the collision data
-        if (collisionBuffer.collisionCount > 0) {
-            uint32_t actualCollisions = std::min(collisionBuffer.collisionCount, static_cast<uint32_t>(MAX_COLLISIONS_PER_FRAME));
-
-            size_t headerSize = 4 * sizeof(uint32_t);
-            size_t collisionDataSize = actualCollisions * sizeof(CollisionData);
-
-            CollisionData* collisionPtr = (CollisionData*)glMapBufferRange(
-                GL_SHADER_STORAGE_BUFFER,
-                headerSize,
-                collisionDataSize,
-                GL_MAP_READ_BIT
-            );
-
-            if (collisionPtr) {
-                // Copy collision data and normalize positions
-                for (uint32_t i = 0; i < actualCollisions; i++) {
-                    collisionBuffer.collisions[i] = collisionPtr[i];
-                    // Normalize collision positions to
-                    collisionBuffer.collisions[i].positionA = normalizePosition(collisionPtr[i].positionA);
-                    collisionBuffer.collisions[i].positionB = normalizePosition(collisionPtr[i].positionB);
-                }
-                glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-            }
-        }
+    // when the machine can not keep up, the time that was not simulated is dropped instead of carried over,
+    // otherwise every next frame would need more steps (and take even longer)
+    if (stepAccumulator >= deltaTime) {
+        stepAccumulator = std::fmod(stepAccumulator, deltaTime);
     }
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return steps;
 }
 
-void Simulator::updateVideoRect(const ofRectangle& rect) {
-    videoRect = rect;
-    videoScaleX = videoRect.width / sourceWidth;
-    videoScaleY = videoRect.height / sourceHeight;
+/// <summary>
+/// Pick the length of the next step from the fastest and the most accelerated particle of the last finished step,
+/// so calm scenes take long steps and violent ones (strong depth field pushes) short ones
+/// On the gpu the stats are one or two steps late (asynchronous readback), the growth limit covers that
+/// </summary>
+void Simulator::updateDeltaTime() {
+    SimulationStepStats stats = backend->getStepStats();
+    const float distance = stepDistance * particles.radius;
+
+    float dt = maxDeltaTime;
+    if (!std::isfinite(stats.maxVelocity) || !std::isfinite(stats.maxAcceleration)) {
+        dt = minDeltaTime;
+    }
+    else {
+        if (stats.maxVelocity > 0.0f) dt = std::min(dt, distance / stats.maxVelocity);
+        if (stats.maxAcceleration > 0.0f) dt = std::min(dt, std::sqrt(2.0f * distance / stats.maxAcceleration));
+    }
+
+    dt = std::min(dt, deltaTime * maxDeltaTimeGrowth);
+    deltaTime = ofClamp(dt, minDeltaTime, maxDeltaTime);
 }
 
-void Simulator::onGUIChangeAmmount(float& value) {
-    particles.resize(value);
+/// <summary>
+/// Rebuild the pair force table if the selected potential or any of its constants changed
+/// (the table is tiny, but the gpu backend uploads it again on every rebuild)
+/// </summary>
+void Simulator::updatePairPotential() {
+    PairPotential potential = static_cast<PairPotential>(std::clamp(tickControls.pairPotential, 0, static_cast<int>(PairPotential::COUNT) - 1));
+    const float sigma = particles.radius + particles.radius;
 
-    // Update the SSBO with the new size
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, particles.active.size() * sizeof(Particle), particles.active.data(), GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    
-    // No need to update sampling since we're using ensemble velocity
-    if (enableVACCalculation) {
-        //ofLogNotice("Simulator") << "VAC ensemble calculation updated for " << particles.active.size() << " particles";
+    if (!pairPotential.matches(potential, ljEpsilon, sigma, ljCutoff, maxForce)) {
+        pairPotential.build(potential, ljEpsilon, sigma, ljCutoff, maxForce);
     }
 }
 
+void Simulator::updateParticles() {
+    updatePairPotential();
+
+    SimulationStepParameters step;
+    step.deltaTime = deltaTime;
+    step.stepScale = deltaTime / REFERENCE_DELTA_TIME;
+    step.worldSize = tickControls.worldSize;
+    step.targetTemperature = tickControls.targetTemperature;
+    step.coupling = tickControls.coupling;
+    step.applyThermostat = tickControls.applyThermostat;
+    step.depthFieldScale = hasDepthField ? tickControls.depthFieldScale : 0.0f;
+    step.videoOffset = glm::vec2(videoRect.x, videoRect.y);
+    step.videoScale = glm::vec2(videoScaleX, videoScaleY);
+    step.sourceSize = glm::vec2(sourceWidth, sourceHeight);
+    step.pairPotential = &pairPotential;
+    step.cutoff = pairPotential.getRange();
+    step.neighbourSkin = neighbourSkin;
+    step.enableCollisionLogging = tickControls.enableCollisionLogging;
+    step.frameNumber = currentFrameNumber;
+
+    backend->step(particles, step, collisionBuffer);
+
+    // share of the steps that rebuilt the neighbour lists, smoothed
+    uint32_t rebuilds = backend->getNeighbourListRebuilds();
+    float rebuilt = (rebuilds != lastNeighbourListRebuilds) ? 100.0f : 0.0f;
+    lastNeighbourListRebuilds = rebuilds;
+    neighbourListRebuildRate = ofLerp(neighbourListRebuildRate, rebuilt, 0.05f);
+}
+
+/// <summary>
+/// Copy the counts for external access and push each sampled record as an event, only the summary is copied as a whole
+/// Backends report collisions in world coordinates, the events carry the normalized range used by the audio
+/// </summary>
+void Simulator::publishCollisions() {
+    // the tick keeps the summary until publishState, the public collisionSummary is the main thread copy
+    lastCollisionFrame = collisionBuffer.frameNumber;
+    tickCollisionSummary = collisionBuffer;
+
+    const uint32_t actualCollisions = collisionBuffer.getSampleCount();
+    const glm::vec2 frameSize(width, height);
+    const float now = ofGetElapsedTimef();
+    for (uint32_t i = 0; i < actualCollisions; i++) {
+        const CollisionData& collision = collisionBuffer.collisions[i];
+
+        CollisionEvent event;
+        event.particleA = collision.particleA;
+        event.particleB = collision.particleB;
+        event.position = AnalysisWorker::normalizePosition((collision.positionA + collision.positionB) * 0.5f, frameSize);
+        event.impactSpeed = collision.impactSpeed;
+        event.frameNumber = currentFrameNumber;
+        event.time = now;
+
+        // a full ring means the audio is not draining, the rest of this frame would be dropped too
+        if (!collisionEvents.push(event)) break;
+    }
+}
+
+// the video rectangle, the world size and the particle amount and radius only change the controls, the next tick applies them
+void Simulator::updateVideoRect(const ofRectangle& rect) {
+    controls.videoRect = rect;
+}
+
+void Simulator::onGUIChangeAmmount(float& value) {
+    // the next tick resizes the particles and updates the backend with the new size
+    controls.amount = static_cast<size_t>(value);
+}
+
 void Simulator::onRenderwindowResize(glm::vec2& worldSize) {
     updateWorldSize(worldSize.x, worldSize.y);
-    particles.randomizePoolPositions();
+    controls.poolResetGeneration++;
 }
 
 void Simulator::updateWorldSize(int _width, int _height) {
-    width = _width;
-    height = _height;
+    controls.width = _width;
+    controls.height = _height;
+    controls.worldSizeGeneration++;
     parameters->worldSize.set(glm::vec2(_width, _height));
     updateVideoRect(ofRectangle(0, 0, _width, _height));
 }
 
-void Simulator::updateDepthFieldTexture() {
+/// <summary>
+/// Tick side: give the backend the last camera frame taken
+/// </summary>
+void Simulator::updateDepthField() {
     if (!hasDepthField) return;
 
-    const unsigned char* pixels = currentDepthField->getPixels().getData();
-    int frameWidth = currentDepthField->getWidth();
-    int frameHeight = currentDepthField->getHeight();
-    std::vector<float> normalizedPixels(frameWidth * frameHeight);
+    const DepthFrame& frame = depthFrames.getReadBuffer();
 
-    // Normalize and invert pixels
-    for (int i = 0; i < frameWidth * frameHeight; i++) {
-        normalizedPixels[i] = 1.0f - (pixels[i] * INV255);
+    // keep the world size in sync with the frame size
+    if (frame.width != width || frame.height != height) {
+        width = frame.width;
+        height = frame.height;
     }
 
-    // Update texture dimensions if changed
-    if (frameWidth != width || frameHeight != height) {
-        width = frameWidth;
-        height = frameHeight;
-        glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, normalizedPixels.data());
-    }
-    else {
-        glBindTexture(GL_TEXTURE_2D, depthFieldTexture);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, normalizedPixels.data());
-    }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    backend->updateDepthField(frame.pixels.data(), frame.width, frame.height);
 }
 
-void Simulator::recieveFrame(ofxCvGrayscaleImage& frame) {
+/// <summary>
+/// Take a camera frame as the depth field, the ticks only get it (copy, upload and gradient) when its generation is new
+/// captureTime is when the camera acquired the frame, for the latency stat
+/// </summary>
+void Simulator::recieveFrame(ofxCvGrayscaleImage& frame, uint64_t frameGeneration, uint64_t captureTime) {
     if (frame.getWidth() == 0 || frame.getHeight() == 0) return;
-    currentDepthField = &frame;
-    hasDepthField = true;
-    updateDepthFieldTexture();
+    if (receivedDepthFrame && frameGeneration == depthFieldGeneration) return;
+    depthFieldGeneration = frameGeneration;
+    receivedDepthFrame = true;
+
+    DepthFrame& depthFrame = depthFrames.getWriteBuffer();
+    depthFrame.width = frame.getWidth();
+    depthFrame.height = frame.getHeight();
+    depthFrame.captureTime = captureTime;
+    const unsigned char* pixels = frame.getPixels().getData();
+    depthFrame.pixels.assign(pixels, pixels + static_cast<size_t>(depthFrame.width) * depthFrame.height);
+    depthFrames.publish();
 }
 
 void Simulator::onGUIChangeRadius(int& value) {
-    particles.updateRadiuses((int)value);
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboParticles);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, particles.active.size() * sizeof(Particle), particles.active.data(), GL_DYNAMIC_COPY);
+    controls.radius = value;
 }
 
 void Simulator::onApplyThermostatChanged(bool& value) {
@@ -357,6 +497,15 @@ void Simulator::onCollisionLoggingChanged(bool& value) {
     ofLogNotice("Simulator") << "Collision logging " << (value ? "enabled" : "disabled") << " via GUI";
 }
 
+void Simulator::onUseCpuSimulationChanged(bool& value) {
+    ofLogNotice("Simulator") << "Switching simulation to the " << (value ? "cpu" : "gpu") << " via GUI";
+
+    // the gpu backend is created on the main thread, where its gl context is
+    stopThread();
+    setupBackend();
+    startThread();
+}
+
 void Simulator::applyBerendsenThermostat() {
     // Placeholder for Berendsen thermostat function
 }
@@ -368,240 +517,14 @@ void Simulator::keyReleased(ofKeyEventArgs& e) {
     case 'N':
         // Decrease VAC calculation frequency (increase interval)
         vacCalculationInterval = std::min(60u, vacCalculationInterval + 5);
-        ofLogNotice("Simulator") << "VAC calculation interval increased to " << vacCalculationInterval << " frames";
+        ofLogNotice("Simulator") << "VAC calculation interval increased to " << vacCalculationInterval << " samples";
         break;
     case 'H':
         // Increase VAC calculation frequency (decrease interval)
         vacCalculationInterval = std::max(5u, vacCalculationInterval - 5);
-        ofLogNotice("Simulator") << "VAC calculation interval decreased to " << vacCalculationInterval << " frames";
+        ofLogNotice("Simulator") << "VAC calculation interval decreased to " << vacCalculationInterval << " samples";
         break;
     default:
         break;
     }
 }
-
-void Simulator::analyzeParticleClusters() {
-    // Disjoint Set (Union-Find Data Structure)
-    const uint32_t MAX_PARTICLES_FOR_CLUSTER_ANALYSIS = 512; // Limit analysis to first 512 particles
-    const uint32_t particleCount = std::min(static_cast<uint32_t>(particles.active.size()), MAX_PARTICLES_FOR_CLUSTER_ANALYSIS);
-    
-    if (particleCount < MIN_CLUSTER_SIZE) {
-        clusterData.clusterCount = 0;
-        return;
-    }
-    
-    
-    // Initialize Union-Find data structures
-    std::vector<uint32_t> parent(particleCount);
-    std::vector<uint32_t> rank(particleCount, 0);
-    
-    // Initialize parent array - each particle is its own parent initially
-    for (uint32_t i = 0; i < particleCount; i++) {
-        parent[i] = i;
-    }
-    
-    // Process collisions to build connected components
-    performUnionFind(parent, rank);
-    
-    // Group particles by their root parent to form clusters
-    std::vector<std::unordered_set<uint32_t>> clusterMembers;
-    std::vector<uint32_t> rootToClusterIndex(particleCount, UINT32_MAX);
-    
-    // Find all unique roots and create cluster groups
-    for (uint32_t i = 0; i < particleCount; i++) {
-        uint32_t root = findRoot(parent, i);
-        
-        if (rootToClusterIndex[root] == UINT32_MAX) {
-            rootToClusterIndex[root] = static_cast<uint32_t>(clusterMembers.size());
-            clusterMembers.emplace_back();
-        }
-        
-        clusterMembers[rootToClusterIndex[root]].insert(i);
-    }
-   
-    
-    // Filter clusters by minimum size and calculate statistics
-    calculateClusterStatistics(parent, clusterMembers);
-}
-
-void Simulator::performUnionFind(std::vector<uint32_t>& parent, std::vector<uint32_t>& rank) {
-    // Distance-based clustering for nearby particles (primary method)
-    const uint32_t maxParticles = static_cast<uint32_t>(parent.size());
-    const float connectionThresholdSq = clusterConnectionDistance * clusterConnectionDistance;
-    uint32_t connectionsFound = 0;
-    
-    for (uint32_t i = 0; i < maxParticles; i++) {
-        for (uint32_t j = i + 1; j < maxParticles; j++) {
-            const Particle& p1 = particles.active[i];
-            const Particle& p2 = particles.active[j];
-            
-            glm::vec2 diff = p1.position - p2.position;
-            float distanceSq = glm::dot(diff, diff);
-            
-            // Use cluster connection distance as the only threshold
-            if (distanceSq <= connectionThresholdSq) {
-                unionSets(parent, rank, i, j);
-                connectionsFound++;
-            }
-        }
-    }
-
-//#ifdef _DEBUG
-//    if (currentFrameNumber % 60 == 0) {
-//        ofLogNotice("Simulator::ClusterDebug") << "Found " << connectionsFound << " particle connections using distance-based clustering only";
-//    }
-//#endif
-}
-
-uint32_t Simulator::findRoot(std::vector<uint32_t>& parent, uint32_t particle) {
-    if (parent[particle] != particle) {
-        parent[particle] = findRoot(parent, parent[particle]); // Path compression
-    }
-    return parent[particle];
-}
-
-void Simulator::unionSets(std::vector<uint32_t>& parent, std::vector<uint32_t>& rank, uint32_t a, uint32_t b) {
-    uint32_t rootA = findRoot(parent, a);
-    uint32_t rootB = findRoot(parent, b);
-    
-    if (rootA != rootB) {
-        // Union by rank for better performance
-        if (rank[rootA] < rank[rootB]) {
-            parent[rootA] = rootB;
-        } else if (rank[rootA] > rank[rootB]) {
-            parent[rootB] = rootA;
-        } else {
-            parent[rootB] = rootA;
-            rank[rootA]++;
-        }
-    }
-}
-
-void Simulator::calculateClusterStatistics(const std::vector<uint32_t>& parent, const std::vector<std::unordered_set<uint32_t>>& clusterMembers) {
-    clusterData.frameNumber = currentFrameNumber;
-    clusterData.clusterCount = 0;
-    
-    uint32_t clusterIndex = 0;
-    
-    for (const auto& cluster : clusterMembers) {
-        // Only consider clusters with minimum required size
-        if (cluster.size() >= MIN_CLUSTER_SIZE && clusterIndex < MAX_CLUSTERS_PER_FRAME) {
-            ClusterStats& stats = clusterData.clusters[clusterIndex];
-            
-            stats.groupIndex = clusterIndex;
-            stats.particleCount = static_cast<uint32_t>(cluster.size());
-            stats.frameNumber = currentFrameNumber;
-            
-            // Calculate center position and average velocity
-            glm::vec2 totalPosition(0.0f);
-            glm::vec2 totalVelocity(0.0f);
-            
-            for (uint32_t particleId : cluster) {
-                const Particle& particle = particles.active[particleId];
-                totalPosition += particle.position;
-                totalVelocity += particle.velocity;
-            }
-            
-            glm::vec2 centerPosition = totalPosition / static_cast<float>(cluster.size());
-            stats.averageVelocity = totalVelocity / static_cast<float>(cluster.size());
-            
-            // Calculate spatial spread (standard deviation of positions)
-            float spatialVariance = 0.0f;
-            float velocityVariance = 0.0f;
-            
-            for (uint32_t particleId : cluster) {
-                const Particle& particle = particles.active[particleId];
-                
-                glm::vec2 positionDiff = particle.position - centerPosition;
-                spatialVariance += glm::dot(positionDiff, positionDiff);
-                
-                glm::vec2 velocityDiff = particle.velocity - stats.averageVelocity;
-                velocityVariance += glm::dot(velocityDiff, velocityDiff);
-            }
-            
-            float spatialSpread = std::sqrt(spatialVariance / static_cast<float>(cluster.size()));
-            stats.velocitySpread = std::sqrt(velocityVariance / static_cast<float>(cluster.size()));
-            
-            // normalize cluster data
-            stats.centerPosition = normalizePosition(centerPosition);
-            stats.spatialSpread = normalizeDistance(spatialSpread);
-            
-            clusterIndex++;
-        }
-    }
-    
-    clusterData.clusterCount = clusterIndex;
-}
-
-glm::vec2 Simulator::normalizePosition(const glm::vec2& position) {
-    // convert world coordinates to normalized -1 to 1 range
-    float normalizedX = (2.0f * position.x / static_cast<float>(width)) - 1.0f;
-    float normalizedY = (2.0f * position.y / static_cast<float>(height)) - 1.0f;
-    return glm::vec2(normalizedX, normalizedY);
-}
-
-float Simulator::normalizeDistance(float distance) {
-    // normalize distance relative to the diagonal of the world space
-    float worldDiagonal = std::sqrt(static_cast<float>(width * width + height * height));
-    return (2.0f * distance / worldDiagonal);
-}
-
-void Simulator::storeVelocityFrame() {
-    if (!enableVACCalculation || particles.active.empty()) return;
-
-    uint32_t frameIndex = vacData.currentFrame % maxVelocityFrames;
-
-    if (velocityHistory[frameIndex].size() != particles.active.size()) {
-        velocityHistory[frameIndex].resize(particles.active.size());
-    }
-
-    for (size_t i = 0; i < particles.active.size(); i++) {
-        velocityHistory[frameIndex][i] = particles.active[i].velocity;
-    }
-
-    vacData.currentFrame++;
-}
-
-void Simulator::calculateVAC() {
-    if (!enableVACCalculation || vacData.currentFrame < 2 || particles.active.empty()) return;
-
-    if ((currentFrameNumber - vacData.lastCalculationFrame) < vacCalculationInterval) return;
-    vacData.lastCalculationFrame = currentFrameNumber;
-
-    uint32_t availableFrames = std::min(vacData.currentFrame, maxVelocityFrames);
-    uint32_t maxTimeLags = std::min(vacData.maxTimeLags, availableFrames - 1);
-
-    // Reset VAC values
-    std::fill(vacData.vacValues.begin(), vacData.vacValues.end(), 0.0f);
-
-    // sum correlations across all particles
-    for (uint32_t dt = 0; dt < maxTimeLags; dt++) {
-        double correlation = 0.0;
-
-        for (size_t particleIdx = 0; particleIdx < particles.active.size(); particleIdx++) {
-            // Get current velocity (t=0)
-            uint32_t currentFrameIdx = (vacData.currentFrame - 1) % maxVelocityFrames;
-            if (velocityHistory[currentFrameIdx].size() <= particleIdx) continue;
-
-            glm::vec2 v0 = velocityHistory[currentFrameIdx][particleIdx];
-
-            // Get velocity at time dt ago
-            uint32_t pastFrameIdx = (vacData.currentFrame - 1 - dt + maxVelocityFrames) % maxVelocityFrames;
-            if (velocityHistory[pastFrameIdx].size() <= particleIdx) continue;
-
-            glm::vec2 vt = velocityHistory[pastFrameIdx][particleIdx];
-
-            correlation += glm::dot(v0, vt);
-        }
-
-        vacData.vacValues[dt] = static_cast<float>(correlation);
-    }
-
-    // Normalize so VAC(0) = 1
-    if (vacData.vacValues[0] > 0.0f) {
-        float normalizationFactor = 1.0f / vacData.vacValues[0];
-        for (uint32_t i = 0; i < maxTimeLags; i++) {
-            vacData.vacValues[i] *= normalizationFactor;
-        }
-    }
-}
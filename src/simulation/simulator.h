@@ -1,91 +1,74 @@
 #pragma once
 
 #include "ofMain.h"
-#include <GL/glew.h>
 #include "../gui/GuiApp.h"
 //#include "ofxOpenCv.h" // TODO: research on using a different datastructure to pass the frame segment and avoid loading opencv here
 #include "particles.h"
-#include <unordered_set>
-
-struct CollisionData {
-    uint32_t particleA;
-    uint32_t particleB;
-    glm::vec2 positionA;
-    glm::vec2 positionB;
-    float distance;
-    float velocityMagnitude;
-    uint32_t valid;
-    uint32_t padding; // for alignment
-};
-
-struct CollisionBuffer {
-    uint32_t collisionCount;
-    uint32_t maxCollisions;
-    uint32_t frameNumber;
-    uint32_t padding;
-    std::vector<CollisionData> collisions;
-};
-
-// Cluster analysis structures
-struct ClusterStats {
-    uint32_t groupIndex;           // Unique cluster ID
-    uint32_t particleCount;        // Number of particles in cluster
-    glm::vec2 centerPosition;      // Spatial center of cluster
-    float spatialSpread;           // Standard deviation of particle positions
-    glm::vec2 averageVelocity;     // Average velocity of cluster
-    float velocitySpread;          // Standard deviation of velocities
-    uint32_t frameNumber;          // Frame when this cluster was detected
-};
-
-struct ClusterAnalysisData {
-    uint32_t clusterCount;         // Number of clusters found
-    uint32_t frameNumber;          // Current frame number
-    uint32_t minClusterSize;       // Minimum particles to consider a cluster
-    uint32_t maxClusters;          // Maximum number of clusters we can store
-    std::vector<ClusterStats> clusters;
-};
-
-// VAC (Velocity Autocorrelation Function) structures
-struct VACData {
-    std::vector<float> vacValues;           // VAC(t) values for each time lag
-    std::vector<float> timePoints;          // Time points corresponding to each VAC value
-    uint32_t maxTimeLags;                   // Maximum number of time lags to calculate
-    uint32_t currentFrame;                  // Current frame number for data collection
-    bool isEnabled;                         // Whether VAC calculation is enabled
-    uint32_t lastCalculationFrame;          // Track when VAC was last calculated
-    
-    VACData() : maxTimeLags(60), currentFrame(0), isEnabled(true), lastCalculationFrame(0) {
-        vacValues.resize(maxTimeLags, 0.0f);
-        timePoints.resize(maxTimeLags);
-        for (uint32_t i = 0; i < maxTimeLags; i++) {
-            timePoints[i] = static_cast<float>(i) * 0.01f;
-        }
-    }
+#include "SimulationBackend.h"
+#include "AnalysisWorker.h"
+#include "CollisionEvents.h"
+#include "TripleBuffer.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// <summary>
+/// What the simulator publishes after its steps: a copy of the particles (without the pool) and the stats of the steps
+/// </summary>
+struct SimulationState {
+    ParticleSystem particles;       // active set, positions before the last step, radius and mass
+    CollisionSummary collisions = {}; // newest step with collisions
+    uint64_t stepCount = 0;         // steps since startup
+    float publishTime = 0.0f;       // clock time the simulated time had reached when published
+    float stepDuration = 0.01f;     // real seconds between the previous and the newest state, the render interpolates over it
+    float deltaTime = REFERENCE_DELTA_TIME;
+    float readbackWaitTime = 0.0f;
+    float neighbourListRebuildRate = 0.0f;
+    float cameraLatency = 0.0f;     // milliseconds from the capture of the newest camera frame to a tick taking it
 };
 
+/// <summary>
+/// Runs the physics at its own clock, on a thread of its own when the backend allows it (the cpu one; the gpu one needs the
+/// gl context of the main thread, so it runs from update instead). Either way the results go out through a triple buffer that the
+/// render, the audio and the gui read on the main thread, so a slow gui frame does not stall the physics and the other way around
+/// The gui side only changes its own copy of the settings, the simulation takes them at the start of each tick
+/// </summary>
 class Simulator {
 public:
+    ~Simulator();
+
     void setup(SimulationParameters* params, GuiApp* globalParams);
     void update();
     void updateWorldSize(int _width, int _height);
-    void recieveFrame(ofxCvGrayscaleImage& frame);
+    void recieveFrame(ofxCvGrayscaleImage& frame, uint64_t frameGeneration, uint64_t captureTime);
     void updateVideoRect(const ofRectangle& rect);
 
     void keyReleased(ofKeyEventArgs& e);
 
-    ParticleSystem particles;
+    // Newest published particles, with the interpolation at the last update; valid until the next update
+    const ParticleSystem& getParticles() const { return states.getReadBuffer().particles; }
     
-    CollisionBuffer collisionData;
-    ClusterAnalysisData clusterData;
-    VACData vacData;
+    // Counts of the newest step with collisions, and its sampled records as events for the audio to drain
+    CollisionSummary collisionSummary;
+    CollisionEventRing collisionEvents;
+
+    // Latest finished analysis, from the analysis thread; valid until the next update
+    const ClusterAnalysisData& getClusterData() const { return analysisWorker.getResults().clusterData; }
+    const VACData& getVACData() const { return analysisWorker.getResults().vacData; }
     
     // VAC control methods
     bool isVACEnabled() const { return enableVACCalculation; }
     void setVACEnabled(bool enabled) { enableVACCalculation = enabled; }
-    uint32_t getMaxVelocityFrames() const { return maxVelocityFrames; }
+    uint32_t getMaxVelocityFrames() const { return VelocityAutocorrelation::MAX_FRAMES; }
+    uint32_t getVACMaxTimeLags() const { return vacMaxTimeLags; }
+    void setVACMaxTimeLags(uint32_t timeLags) { vacMaxTimeLags = std::min(timeLags, getMaxVelocityFrames()); }
+    VACMode getVACMode() const { return vacMode; }
+    void setVACMode(VACMode mode) { vacMode = mode; }
     
     // Collision data access method
-    const CollisionBuffer& getCollisionData() const { return collisionData; }
+    const CollisionSummary& getCollisionSummary() const { return collisionSummary; }
     bool isCollisionLoggingEnabled() const { return parameters->enableCollisionLogging; }
     void setCollisionLoggingEnabled(bool enabled) { parameters->enableCollisionLogging = enabled; }
     
@@ -95,47 +78,68 @@ public:
     float getClusterConnectionDistance() const { return clusterConnectionDistance; }
     void setClusterConnectionDistance(float distance) { clusterConnectionDistance = distance; }
 
-    GLint deltaTimeLocation;
-    GLint worldSizeLocation;
-    GLint targetTemperatureLocation;
-    GLint couplingLocation;
-    GLint applyThermostatLocation;
-    GLint depthFieldScaleLocation;
-    GLint videoOffsetLocation;
-    GLint videoScaleLocation;
-    GLint sourceSizeLocation;
-    GLint ljEpsilonLocation;
-    GLint ljSigmaLocation;
-    GLint ljCutoffLocation;
-    GLint maxForceLocation;
-    GLint depthFieldLocation;
-    GLint enableCollisionLoggingLocation;
-
-    static const size_t MAX_COLLISIONS_PER_FRAME = 1024;
+    // Backend in use ("gpu" or "cpu")
+    std::string getBackendName() const { return backend ? backend->getName() : "none"; }
+    bool isThreaded() const { return simulationThread.joinable(); }
+
+    static const size_t MAX_COLLISIONS_PER_FRAME = 256; // sampled records, the counts cover all the collisions
     static const size_t MAX_CLUSTERS_PER_FRAME = 10;
     static const uint32_t MIN_CLUSTER_SIZE = 10;
-    static const uint32_t MAX_PARTICLES_FOR_CLUSTER_ANALYSIS = 512; // Limit analysis to first 512 particles
 
 
 private:
-    void setupComputeShader();
-    void updateParticlesOnGPU();
-    void updateDepthFieldTexture();
+    /// <summary>
+    /// Everything a tick reads that the main thread can change, copied at the start of the tick
+    /// </summary>
+    struct SimulationControls {
+        size_t amount = 0;
+        int radius = 2;
+        glm::vec2 worldSize;
+        int width = 640;
+        int height = 576;
+        uint32_t worldSizeGeneration = 0;   // changes with width and height
+        uint32_t poolResetGeneration = 0;   // changes when the pool positions have to be randomized
+        ofRectangle videoRect = ofRectangle(0, 0, -45, -45);
+        int pairPotential = 0;
+        bool enableCollisionLogging = false;
+        bool applyThermostat = true;
+        float targetTemperature = 2000.0f;
+        float coupling = 0.5f;
+        float depthFieldScale = 0.0f;
+        bool enableClusterAnalysis = true;
+        float clusterConnectionDistance = 50.0f;
+        bool enableVACCalculation = true;
+        VACMode vacMode = VACMode::FFT;
+        uint32_t vacCalculationInterval = 5;
+        uint32_t vacMaxTimeLags = 60;
+    };
+
+    /// <summary>
+    /// A camera frame for the depth field, copied so the camera can go on with the next one
+    /// </summary>
+    struct DepthFrame {
+        std::vector<unsigned char> pixels;
+        int width = 0;
+        int height = 0;
+        uint64_t captureTime = 0; // microseconds since startup when the camera acquired it
+    };
+
+    void setupBackend();
+    void startThread();
+    void stopThread();
+    void threadLoop();
+    void tick();
+    void applyControls();
+    void shareControls();
+    void publishState(int steps);
+    int runSimulationSteps();
+    void updateDeltaTime();
+    void updatePairPotential();
+    void updateParticles();
+    void updateDepthField();
     void setupCollisionBuffer();
-    void readCollisionData();
-    
-    // Cluster analysis methods
-    void setupClusterAnalysis();
-    void analyzeParticleClusters();
-    void performUnionFind(std::vector<uint32_t>& parent, std::vector<uint32_t>& rank);
-    uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t particle);
-    void unionSets(std::vector<uint32_t>& parent, std::vector<uint32_t>& rank, uint32_t a, uint32_t b);
-    void calculateClusterStatistics(const std::vector<uint32_t>& parent, const std::vector<std::unordered_set<uint32_t>>& clusterMembers);
-
-    // VAC (Velocity Autocorrelation Function) methods
-    void setupVACAnalysis();
-    void calculateVAC();
-    void storeVelocityFrame();
+    void publishCollisions();
+    void submitAnalysis();
 
     // listeners
     void onRenderwindowResize(glm::vec2& worldSize);
@@ -146,23 +150,78 @@ private:
     void onCouplingChanged(float& value);
     void onDepthFieldScaleChanged(float& value);
     void onCollisionLoggingChanged(bool& value);
+    void onUseCpuSimulationChanged(bool& value);
     void applyBerendsenThermostat();
 
-    GLuint ssboParticles;
-    GLuint ssboCollisions;
-    GLuint computeShaderProgram;
-    GLuint depthFieldTexture;
+    // the physics step implementation, gpu compute shader or cpu threads
+    std::unique_ptr<SimulationBackend> backend;
+
+    // simulation thread, only with backends that can step outside the main thread
+    std::thread simulationThread;
+    std::mutex threadMutex;
+    std::condition_variable threadWake;
+    bool threadStopping = false;
+
+    // main thread copy of the settings, the shared one (under controlsMutex), and the one of the running tick
+    SimulationControls controls;
+    SimulationControls sharedControls;
+    SimulationControls tickControls;
+    std::mutex controlsMutex;
+    uint32_t appliedWorldSizeGeneration = 0;
+    uint32_t appliedPoolResetGeneration = 0;
+
+    // results of the ticks for the main thread, and the camera frames for the ticks
+    TripleBuffer<SimulationState> states;
+    TripleBuffer<DepthFrame> depthFrames;
+    uint64_t lastStepCount = 0; // main thread, steps of the state read by the last update
+
+    // the particles being simulated, only touched by the tick
+    ParticleSystem particles;
+    std::mt19937 poolRandom{ std::random_device{}() }; // the tick's own generator, for the pool positions
+    uint64_t stepCount = 0;
+    float neighbourListRebuildRate = 0.0f;
+    uint32_t lastCollisionFrame = 0;
+    CollisionSummary tickCollisionSummary = {};
+    float cameraLatency = 0.0f;
 
     bool applyThermostat = true;
     float targetTemperature = 2000.0;
     float coupling = 0.5;
     float depthFieldScale = -100000.0f;
     bool hasDepthField = false;
-    float ljEpsilon = 10.0f;    // Lennard-Jones well depth
-    float ljCutoff = 150.0f;    // Interaction cutoff
-    float maxForce = 10000.0f;  // Force clamping
-
-    ofxCvGrayscaleImage* currentDepthField;
+    float ljEpsilon = 10.0f;    // well depth (energy scale) of the pair potential
+    float ljCutoff = 150.0f;    // Interaction cutoff, the pair potential table may end before it
+    float neighbourSkin = 10.0f; // Margin of the cpu neighbour lists, rebuilt when a particle moves half of it
+    uint32_t lastNeighbourListRebuilds = 0;
+    float maxForce = 100000.0f; // Force clamping, only a guard against blow-ups, the adaptive timestep handles strong forces
+
+    // pair force by r², rebuilt when the potential, its constants or the radius change
+    PairPotentialTable pairPotential;
+
+    // simulation clock: the simulated time advances simulationSpeed seconds per second of real time, in steps of deltaTime,
+    // as many per frame as the elapsed time asks for, up to maxSubsteps and substepBudget
+    float simulationSpeed = 0.9f; // the former 0.01 step per frame at 90 fps
+    int maxSubsteps = 8;
+    float substepBudget = 12.0f; // milliseconds per frame
+    float stepAccumulator = 0.0f; // simulated time not run yet
+    float lastClockTime = 0.0f;
+
+    // interpolation of the newest state the backend delivered, set by publishState
+    uint64_t publishedStateGeneration = 0;
+    uint64_t analyzedStateGeneration = 0; // newest state whose velocities went to the VAC
+    float statePublishTime = 0.0f;
+    float stateStepDuration = REFERENCE_DELTA_TIME;
+
+    // adaptive timestep (CFL-like): in one step no particle moves more than stepDistance times its radius,
+    // neither by its velocity nor by its acceleration
+    float deltaTime = REFERENCE_DELTA_TIME;
+    float minDeltaTime = 0.001f;
+    float maxDeltaTime = 0.02f;
+    float stepDistance = 1.0f;
+    float maxDeltaTimeGrowth = 1.2f; // per step, a calm step can be followed by a violent one
+
+    uint64_t depthFieldGeneration = 0; // camera frame generation of the last frame received
+    bool receivedDepthFrame = false;
 
     ofRectangle videoRect = ofRectangle(0, 0, -45, -45);
     float videoScaleX = 1.4;
@@ -176,23 +235,20 @@ private:
     SimulationParameters* parameters;
     GuiApp* globalParameters;
 
-    const float INV255 = 1.0f / 255.0f;
-
-    // Internal collision buffer for GPU operations
+    // Internal collision buffer filled by the backend
     CollisionBuffer collisionBuffer;
-    uint32_t currentFrameNumber = 0;
+    uint32_t currentFrameNumber = 0; // ticks since startup
     
     // Cluster analysis settings
     bool enableClusterAnalysis = true;
     float clusterConnectionDistance = 50.0f;
 
-    // VAC calculation settings and data storage
-    std::vector<std::vector<glm::vec2>> velocityHistory; 
-    uint32_t maxVelocityFrames = 512;
-    uint32_t vacCalculationInterval = 5;                 
+    // VAC calculation settings
+    uint32_t vacCalculationInterval = 5;
+    uint32_t vacMaxTimeLags = 60;
+    VACMode vacMode = VACMode::FFT;
     bool enableVACCalculation = true;
 
-    // Normalization functions
-    glm::vec2 normalizePosition(const glm::vec2& position);
-    float normalizeDistance(float distance);
+    // cluster analysis and VAC, on their own thread
+    AnalysisWorker analysisWorker;
 };
\ No newline at end of file